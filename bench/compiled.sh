@@ -0,0 +1,56 @@
+#!/bin/sh
+# Compares executing a text job file with executing its compiled form.
+# Usage: bench/compiled.sh [commands] [threads]
+# Run from the repository root after building ems. Every state access still
+# sleeps, even with -d 0, so keep SHOWs rare to leave parsing visible.
+
+set -e
+
+COMMANDS=${1:-20000}
+THREADS=${2:-4}
+EMS=$(pwd)/ems
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir "$WORK/text" "$WORK/compiled"
+
+# A few large events, then random reservations with the odd SHOW and LIST
+awk -v n="$COMMANDS" 'BEGIN {
+  srand(42);
+  for (e = 1; e <= 8; e++) print "CREATE " e " 100 100";
+  print "BARRIER";
+  for (i = 0; i < n; i++) {
+    e = int(rand() * 8) + 1;
+    line = "RESERVE " e " [";
+    k = int(rand() * 4) + 1;
+    for (j = 0; j < k; j++) {
+      line = line sprintf("%s(%d,%d)", j ? " " : "", int(rand() * 100) + 1,
+                          int(rand() * 100) + 1);
+    }
+    print line "]";
+    if (i % 10000 == 0) print "SHOW " e;
+    if (i % 20000 == 0) print "LIST";
+  }
+}' > "$WORK/text/bench.jobs"
+
+"$EMS" compile "$WORK/text/bench.jobs" "$WORK/compiled/bench.jobsb"
+
+run() {
+  start=$(date +%s.%N)
+  "$EMS" -d 0 -p "$1" -t "$THREADS" > /dev/null 2>&1
+  end=$(date +%s.%N)
+  awk -v a="$start" -v b="$end" 'BEGIN { printf "%.3f", b - a }'
+}
+
+echo "text:     $(wc -c < "$WORK/text/bench.jobs") bytes," \
+  "$(run "$WORK/text") s"
+echo "compiled: $(wc -c < "$WORK/compiled/bench.jobsb") bytes," \
+  "$(run "$WORK/compiled") s"
+
+if cmp -s "$WORK/text/bench.out" "$WORK/compiled/bench.jobsb.out"; then
+  echo "outputs match"
+elif [ "$THREADS" -gt 1 ]; then
+  echo "outputs differ, as expected with more than one thread"
+else
+  echo "outputs differ" && exit 1
+fi
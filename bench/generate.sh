@@ -0,0 +1,107 @@
+#!/bin/sh
+# Generates a directory of synthetic job files.
+# Usage: bench/generate.sh [options] <dir>
+#   -f <files>     Number of job files (default 4)
+#   -n <commands>  Commands per file, after the CREATEs (default 10000)
+#   -e <events>    Events created by every file (default 16)
+#   -r <rows>      Rows of each event (default 20)
+#   -c <cols>      Columns of each event (default 20)
+#   -s <seats>     Largest RESERVE, in seats (default 4)
+#   -S <percent>   Share of SHOW among SHOW and RESERVE (default 1)
+#   -b <every>     One BARRIER every this many commands, 0 for none
+#                  (default 0)
+#   -w <every>     One WAIT 1 every this many commands, 0 for none
+#                  (default 0)
+#   -z <exponent>  Zipf exponent of event popularity, 0 for uniform
+#                  (default 1)
+#   -x <seed>      Random seed (default 42)
+# Every file creates its events first, so files can run in separate
+# processes. A SHOW reads every seat of its event, each read sleeping even
+# with -d 0, so it costs as much as hundreds of RESERVEs. Prints the number
+# of commands written.
+
+set -e
+
+FILES=4
+COMMANDS=10000
+EVENTS=16
+ROWS=20
+COLS=20
+SEATS=4
+SHOW=1
+BARRIER=0
+WAIT=0
+ZIPF=1
+SEED=42
+
+while getopts f:n:e:r:c:s:S:b:w:z:x: option; do
+  case $option in
+  f) FILES=$OPTARG ;;
+  n) COMMANDS=$OPTARG ;;
+  e) EVENTS=$OPTARG ;;
+  r) ROWS=$OPTARG ;;
+  c) COLS=$OPTARG ;;
+  s) SEATS=$OPTARG ;;
+  S) SHOW=$OPTARG ;;
+  b) BARRIER=$OPTARG ;;
+  w) WAIT=$OPTARG ;;
+  z) ZIPF=$OPTARG ;;
+  x) SEED=$OPTARG ;;
+  *) sed -n '2,21s/^# \{0,1\}//p' "$0" >&2 && exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+  sed -n '2,21s/^# \{0,1\}//p' "$0" >&2
+  exit 1
+fi
+mkdir -p "$1"
+
+awk -v dir="$1" -v files="$FILES" -v n="$COMMANDS" -v events="$EVENTS" \
+  -v rows="$ROWS" -v cols="$COLS" -v seats="$SEATS" -v show="$SHOW" \
+  -v barrier="$BARRIER" -v wait="$WAIT" -v zipf="$ZIPF" -v seed="$SEED" '
+# Picks an event with probability proportional to 1 / rank^zipf
+function pick_event(   u, lo, hi, mid) {
+  u = rand() * cdf[events];
+  lo = 1; hi = events;
+  while (lo < hi) {
+    mid = int((lo + hi) / 2);
+    if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+BEGIN {
+  srand(seed);
+  for (e = 1; e <= events; e++) cdf[e] = cdf[e - 1] + 1 / e ^ zipf;
+
+  total = 0;
+  for (f = 0; f < files; f++) {
+    file = sprintf("%s/bench%03d.jobs", dir, f);
+    printf "" > file;
+    for (e = 1; e <= events; e++) print "CREATE " e " " rows " " cols > file;
+    print "BARRIER" > file;
+    total += events + 1;
+
+    for (i = 1; i <= n; i++) {
+      e = pick_event();
+      if (rand() * 100 < show) {
+        print "SHOW " e > file;
+      } else {
+        k = int(rand() * seats) + 1;
+        line = "RESERVE " e " [";
+        for (j = 0; j < k; j++) {
+          line = line sprintf("%s(%d,%d)", j ? " " : "", int(rand() * rows) + 1,
+                              int(rand() * cols) + 1);
+        }
+        print line "]" > file;
+      }
+      if (barrier > 0 && i % barrier == 0) { print "BARRIER" > file; total++; }
+      if (wait > 0 && i % wait == 0) { print "WAIT 1" > file; total++; }
+    }
+    total += n;
+    close(file);
+  }
+  print total;
+}'
@@ -0,0 +1,90 @@
+#!/bin/sh
+# Runs ems over a synthetic workload for every combination of settings.
+# Usage: bench/run.sh [options] [-- generator options]
+#   -t <list>  Thread counts (default "1 2 4")
+#   -m <list>  Process counts (default "1 4")
+#   -d <list>  Delays, in milliseconds (default "0")
+#   -R <runs>  Runs of each combination (default 5)
+#   -j <dir>   Job directory to run instead of generating one
+#   -o <opts>  Other options passed to ems, such as "-q" or "-g 64"
+# Run from the repository root after building ems. Generator options are
+# those of bench/generate.sh. For each combination, prints the commands per
+# second of the median run and percentiles of the time of a whole run.
+
+set -e
+
+THREADS="1 2 4"
+PROCS="1 4"
+DELAYS="0"
+RUNS=5
+JOBS=
+OPTIONS=
+
+while getopts t:m:d:R:j:o: option; do
+  case $option in
+  t) THREADS=$OPTARG ;;
+  m) PROCS=$OPTARG ;;
+  d) DELAYS=$OPTARG ;;
+  R) RUNS=$OPTARG ;;
+  j) JOBS=$OPTARG ;;
+  o) OPTIONS=$OPTARG ;;
+  *) sed -n '2,12s/^# \{0,1\}//p' "$0" >&2 && exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+EMS=$(pwd)/ems
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ -z "$JOBS" ]; then
+  JOBS=$WORK/jobs
+  sh "$BENCH/generate.sh" "$@" "$JOBS" > /dev/null
+fi
+
+# Every line but comments and blank ones is a command, compiled files are
+# counted from their source when it is next to them
+OPS=$(cat "$JOBS"/*.jobs 2>/dev/null | grep -cv '^[[:space:]]*\(#.*\)\{0,1\}$' ||
+  true)
+if [ "$OPS" -eq 0 ]; then
+  echo "no text job files in $JOBS" >&2 && exit 1
+fi
+
+run() {
+  start=$(date +%s.%N)
+  # shellcheck disable=SC2086
+  "$EMS" $OPTIONS -p "$JOBS" -t "$1" -m "$2" -d "$3" > /dev/null 2>&1
+  end=$(date +%s.%N)
+  awk -v a="$start" -v b="$end" 'BEGIN { printf "%.6f\n", b - a }'
+}
+
+echo "$OPS commands in $(ls "$JOBS" | grep -c '\.jobsb\{0,1\}$') files," \
+  "$RUNS runs each"
+printf '%8s %6s %6s %12s %9s %9s %9s\n' threads procs delay ops/s \
+  p50_s p90_s p99_s
+
+for d in $DELAYS; do
+  for m in $PROCS; do
+    for t in $THREADS; do
+      i=0
+      : > "$WORK/times"
+      while [ "$i" -lt "$RUNS" ]; do
+        run "$t" "$m" "$d" >> "$WORK/times"
+        i=$((i + 1))
+      done
+
+      # Nearest-rank percentiles of the run times
+      sort -n "$WORK/times" | awk -v ops="$OPS" -v t="$t" -v m="$m" -v d="$d" '
+        function rank(p,   r) {
+          r = int(p * NR / 100 + 0.999999);
+          return time[r < 1 ? 1 : r];
+        }
+        { time[NR] = $1 }
+        END {
+          printf "%8s %6s %6s %12.0f %9.3f %9.3f %9.3f\n", t, m, d,
+                 ops / rank(50), rank(50), rank(90), rank(99);
+        }'
+    done
+  done
+done
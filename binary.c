@@ -0,0 +1,325 @@
+#include "binary.h"
+
+#include <stdio.h>
+
+#include "output.h"
+
+#define BINARY_FLUSH_SIZE 65536
+
+// Writes out the buffered part of a compiled file
+static int flush_output(int out_fd, struct Buffer *out) {
+  ssize_t written = safe_write(out_fd, out->data, (ssize_t)out->length);
+  int failed = written != (ssize_t)out->length;
+
+  out->length = 0;
+  return failed;
+}
+
+// Encodes a run of seats of a parsed command
+static int append_seats(struct Buffer *out, struct CommandRecord *cmd,
+                        size_t first, size_t count) {
+  for (size_t i = first; i < first + count; i++) {
+    struct BinarySeat seat = {(uint32_t)cmd->xs[i], (uint32_t)cmd->ys[i]};
+    if (buffer_append(out, (const char *)&seat, sizeof(seat)) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Encodes a single parsed command
+static int encode_command(struct Buffer *out, struct CommandRecord *cmd) {
+  struct BinaryRecord record = {0};
+
+  switch (cmd->type) {
+  case CMD_CREATE:
+    record.op = BINARY_CREATE;
+    record.id = cmd->event_id;
+    record.arg[0] = (uint32_t)cmd->num_rows;
+    record.arg[1] = (uint32_t)cmd->num_cols;
+    break;
+
+  case CMD_RESERVE:
+    record.op = BINARY_RESERVE;
+    record.count = (uint16_t)cmd->num_seats;
+    record.id = cmd->event_id;
+    break;
+
+  case CMD_RESERVE_MULTI:
+    record.op = BINARY_RESERVE_MULTI;
+    record.count = (uint16_t)cmd->num_events;
+    record.id = (uint32_t)cmd->num_events;
+    for (size_t i = 0; i < cmd->num_events; i++) {
+      record.count = (uint16_t)(record.count + cmd->event_seats[i]);
+    }
+    break;
+
+  case CMD_RESERVE_BEST:
+    record.op = BINARY_RESERVE_BEST;
+    record.id = cmd->event_id;
+    record.arg[0] = (uint32_t)cmd->num_seats;
+    record.arg[1] = (uint32_t)cmd->same_row;
+    break;
+
+  case CMD_CANCEL:
+    record.op = BINARY_CANCEL;
+    record.id = cmd->event_id;
+    record.arg[0] = cmd->reservation_id;
+    break;
+
+  case CMD_SHOW:
+    record.op = BINARY_SHOW;
+    record.id = cmd->event_id;
+    break;
+
+  case CMD_SHOWRES:
+    record.op = BINARY_SHOWRES;
+    record.id = cmd->event_id;
+    record.arg[0] = cmd->reservation_id;
+    break;
+
+  case CMD_AVAILABLE:
+    record.op = BINARY_AVAILABLE;
+    record.id = cmd->event_id;
+    break;
+
+  case CMD_LIST_EVENTS:
+    record.op = BINARY_LIST_EVENTS;
+    break;
+
+  case CMD_WAIT:
+    record.op = BINARY_WAIT;
+    record.id = cmd->delay;
+    record.arg[0] = (uint32_t)cmd->has_thread;
+    record.arg[1] = cmd->thread_id;
+    break;
+
+  case CMD_SNAPSHOT:
+    record.op = BINARY_SNAPSHOT;
+    break;
+
+  case CMD_STATS:
+    record.op = BINARY_STATS;
+    break;
+
+  case CMD_BARRIER:
+    record.op = BINARY_BARRIER;
+    break;
+
+  case CMD_HELP:
+    record.op = BINARY_HELP;
+    break;
+
+  case CMD_INVALID:
+    record.op = BINARY_INVALID;
+    break;
+
+  case CMD_EMPTY:
+  case EOC:
+    return 0; // Nothing to execute
+  }
+
+  if (buffer_append(out, (const char *)&record, sizeof(record)) != 0)
+    return 1;
+
+  if (record.op != BINARY_RESERVE_MULTI)
+    return append_seats(out, cmd, 0, record.count);
+
+  // Seats of a RESERVE_MULTI are grouped by event, each behind its event
+  size_t first = 0;
+  for (size_t i = 0; i < cmd->num_events; i++) {
+    struct BinarySeat event = {cmd->event_ids[i],
+                               (uint32_t)cmd->event_seats[i]};
+    if (buffer_append(out, (const char *)&event, sizeof(event)) != 0 ||
+        append_seats(out, cmd, first, cmd->event_seats[i]) != 0)
+      return 1;
+    first += cmd->event_seats[i];
+  }
+  return 0;
+}
+
+int binary_compile(struct Reader *reader, int out_fd) {
+  struct BinaryHeader header = {BINARY_MAGIC, BINARY_VERSION};
+  struct CommandRecord cmd;
+  struct Buffer out;
+  int failed = 0;
+
+  buffer_init(&out);
+  failed = buffer_append(&out, (const char *)&header, sizeof(header));
+
+  while (!failed && parse_command(reader, &cmd) != EOC) {
+    if (encode_command(&out, &cmd) != 0) {
+      fprintf(stderr, "Error allocating memory for compiled file\n");
+      failed = 1;
+    } else if (out.length >= BINARY_FLUSH_SIZE) {
+      failed = flush_output(out_fd, &out);
+    }
+  }
+
+  if (!failed) {
+    failed = flush_output(out_fd, &out);
+  }
+  buffer_free(&out);
+  return failed;
+}
+
+int binary_read_header(struct Reader *reader) {
+  struct BinaryHeader header;
+
+  if (reader_read(reader, (char *)&header, sizeof(header)) != sizeof(header))
+    return 1;
+
+  return header.magic != BINARY_MAGIC || header.version != BINARY_VERSION;
+}
+
+// Reads the seats of a RESERVE_MULTI record, grouped by event
+static enum Command read_multi(struct Reader *reader,
+                              const struct BinaryRecord *binary,
+                              struct CommandRecord *record) {
+  size_t num_events = 0;
+  size_t num_seats = 0;
+  size_t left = 0; // Seats of the current event still to be read
+  int valid = binary->id > 0 && binary->id <= MAX_MULTI_EVENTS;
+
+  // Every entry is read, even those of an invalid record, so the next
+  // record starts in the right place
+  for (size_t i = 0; i < binary->count; i++) {
+    struct BinarySeat seat;
+    if (reader_read(reader, (char *)&seat, sizeof(seat)) != sizeof(seat)) {
+      fprintf(stderr, "Truncated compiled job file\n");
+      return record->type;
+    }
+    if (!valid)
+      continue;
+
+    if (left > 0) {
+      record->xs[num_seats] = seat.row;
+      record->ys[num_seats++] = seat.col;
+      left--;
+    } else if (num_events < binary->id && seat.col > 0 &&
+               seat.col <= MAX_RESERVATION_SIZE - num_seats) {
+      record->event_ids[num_events] = seat.row;
+      record->event_seats[num_events++] = seat.col;
+      left = seat.col;
+    } else {
+      valid = 0;
+    }
+  }
+
+  if (valid && left == 0 && num_events == binary->id) {
+    record->type = CMD_RESERVE_MULTI;
+    record->num_events = num_events;
+  }
+  return record->type;
+}
+
+enum Command binary_next_command(struct Reader *reader,
+                                 struct CommandRecord *record) {
+  struct BinaryRecord binary;
+  size_t length = reader_read(reader, (char *)&binary, sizeof(binary));
+
+  if (length == 0)
+    return record->type = EOC;
+  if (length != sizeof(binary)) {
+    fprintf(stderr, "Truncated compiled job file\n");
+    return record->type = CMD_INVALID;
+  }
+
+  record->type = CMD_INVALID;
+  switch ((enum BinaryOp)binary.op) {
+  case BINARY_CREATE:
+    record->type = CMD_CREATE;
+    record->event_id = binary.id;
+    record->num_rows = binary.arg[0];
+    record->num_cols = binary.arg[1];
+    break;
+
+  case BINARY_RESERVE:
+    // Every seat is read, even those of an invalid record, so the next
+    // record starts in the right place
+    for (size_t i = 0; i < binary.count; i++) {
+      struct BinarySeat seat;
+      if (reader_read(reader, (char *)&seat, sizeof(seat)) != sizeof(seat)) {
+        fprintf(stderr, "Truncated compiled job file\n");
+        return record->type;
+      }
+      if (i < MAX_RESERVATION_SIZE) {
+        record->xs[i] = seat.row;
+        record->ys[i] = seat.col;
+      }
+    }
+
+    if (binary.count > 0 && binary.count <= MAX_RESERVATION_SIZE) {
+      record->type = CMD_RESERVE;
+      record->event_id = binary.id;
+      record->num_seats = binary.count;
+    }
+    break;
+
+  case BINARY_RESERVE_MULTI:
+    return read_multi(reader, &binary, record);
+
+  case BINARY_RESERVE_BEST:
+    if (binary.arg[1] > 1)
+      break;
+
+    record->type = CMD_RESERVE_BEST;
+    record->event_id = binary.id;
+    record->num_seats = binary.arg[0];
+    record->same_row = (int)binary.arg[1];
+    break;
+
+  case BINARY_CANCEL:
+    record->type = CMD_CANCEL;
+    record->event_id = binary.id;
+    record->reservation_id = binary.arg[0];
+    break;
+
+  case BINARY_SHOW:
+    record->type = CMD_SHOW;
+    record->event_id = binary.id;
+    break;
+
+  case BINARY_SHOWRES:
+    record->type = CMD_SHOWRES;
+    record->event_id = binary.id;
+    record->reservation_id = binary.arg[0];
+    break;
+
+  case BINARY_AVAILABLE:
+    record->type = CMD_AVAILABLE;
+    record->event_id = binary.id;
+    break;
+
+  case BINARY_LIST_EVENTS:
+    record->type = CMD_LIST_EVENTS;
+    break;
+
+  case BINARY_WAIT:
+    record->type = CMD_WAIT;
+    record->delay = binary.id;
+    record->has_thread = binary.arg[0] != 0;
+    record->thread_id = binary.arg[1];
+    break;
+
+  case BINARY_SNAPSHOT:
+    record->type = CMD_SNAPSHOT;
+    break;
+
+  case BINARY_STATS:
+    record->type = CMD_STATS;
+    break;
+
+  case BINARY_BARRIER:
+    record->type = CMD_BARRIER;
+    break;
+
+  case BINARY_HELP:
+    record->type = CMD_HELP;
+    break;
+
+  case BINARY_INVALID:
+    break;
+  }
+
+  return record->type;
+}
@@ -0,0 +1,79 @@
+#ifndef EMS_BINARY_H
+#define EMS_BINARY_H
+
+#include <stdint.h>
+
+#include "parser.h"
+#include "reader.h"
+
+// Compiled job files (.jobsb) hold the commands of a text job file as fixed
+// layout records, so they can be executed without tokenizing any text. Fields
+// are stored in the byte order of the machine that compiled the file; the
+// magic number doubles as a byte order check.
+
+#define BINARY_MAGIC 0x42534d45 // "EMSB" when stored little endian
+#define BINARY_VERSION 1
+
+enum BinaryOp {
+  BINARY_CREATE = 1,
+  BINARY_RESERVE = 2,
+  BINARY_RESERVE_BEST = 3,
+  BINARY_SHOW = 4,
+  BINARY_AVAILABLE = 5,
+  BINARY_LIST_EVENTS = 6,
+  BINARY_WAIT = 7,
+  BINARY_BARRIER = 8,
+  BINARY_HELP = 9,
+  BINARY_INVALID = 10, // Kept so the error is reported when it is executed
+  BINARY_SNAPSHOT = 11,
+  BINARY_CANCEL = 12,
+  BINARY_SHOWRES = 13,
+  BINARY_STATS = 14,
+  BINARY_RESERVE_MULTI = 15
+};
+
+struct BinaryHeader {
+  uint32_t magic;   /// BINARY_MAGIC.
+  uint32_t version; /// BINARY_VERSION.
+};
+
+// Every command is one record, RESERVE is followed by count seats.
+// RESERVE_MULTI is followed by count seats too: for each of its events, one
+// holding the event id and number of seats in place of row and column, then
+// its seats.
+struct BinaryRecord {
+  uint16_t op;     /// Command, one of BinaryOp.
+  uint16_t count;  /// Number of seats following a RESERVE or RESERVE_MULTI.
+  uint32_t id;     /// Event id, delay of WAIT, number of events of
+                   /// RESERVE_MULTI.
+  uint32_t arg[2]; /// Rows and columns of CREATE, seats and same row flag of
+                   /// RESERVE_BEST, thread flag and id of WAIT, reservation
+                   /// id of CANCEL and SHOWRES.
+};
+
+struct BinarySeat {
+  uint32_t row; /// Row of the seat.
+  uint32_t col; /// Column of the seat.
+};
+
+/// Compiles a text job file.
+/// @param reader Reader over the text job file.
+/// @param out_fd File descriptor to write the compiled file to.
+/// @return 0 if the file was compiled successfully, 1 otherwise.
+int binary_compile(struct Reader *reader, int out_fd);
+
+/// Reads and checks the header of a compiled job file.
+/// @param reader Reader over the compiled job file.
+/// @return 0 if the header is valid, 1 otherwise.
+int binary_read_header(struct Reader *reader);
+
+/// Reads the next command of a compiled job file. Has the same contract as
+/// parse_command, so the two can be used interchangeably.
+/// @param reader Reader over the compiled job file, past its header.
+/// @param record Pointer to the record to store the command and its
+/// arguments in. Its seq and ticket fields are left untouched.
+/// @return The command read, CMD_INVALID if it is malformed, EOC at the end.
+enum Command binary_next_command(struct Reader *reader,
+                                 struct CommandRecord *record);
+
+#endif // EMS_BINARY_H
@@ -0,0 +1,150 @@
+#include "cache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Mixes the owner and key of a line, so neighbouring rows spread over the
+// shards and buckets
+static uint64_t line_hash(const void *owner, size_t key) {
+  uint64_t hash = (uint64_t)(uintptr_t)owner ^ ((uint64_t)key << 1);
+  hash = (hash ^ (hash >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  hash = (hash ^ (hash >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return hash ^ (hash >> 31);
+}
+
+static void destroy_shards(struct CacheShard *shards, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    pthread_mutex_destroy(&shards[i].lock);
+    free(shards[i].lines);
+    free(shards[i].buckets);
+  }
+  free(shards);
+}
+
+int cache_init(struct Cache *cache, size_t capacity) {
+  cache->shards = NULL;
+  cache->num_shards = 0;
+  if (capacity == 0)
+    return 0;
+
+  size_t num_shards = capacity < CACHE_SHARDS ? capacity : CACHE_SHARDS;
+  struct CacheShard *shards = calloc(num_shards, sizeof(struct CacheShard));
+  if (shards == NULL)
+    return 1;
+
+  for (size_t i = 0; i < num_shards; i++) {
+    struct CacheShard *shard = &shards[i];
+    // The first shards take the lines that do not divide evenly
+    shard->capacity = capacity / num_shards + (i < capacity % num_shards);
+
+    size_t num_buckets = 1;
+    while (num_buckets < shard->capacity) {
+      num_buckets <<= 1;
+    }
+    shard->mask = num_buckets - 1;
+    shard->lines = calloc(shard->capacity, sizeof(struct CacheLine));
+    shard->buckets = calloc(num_buckets, sizeof(size_t));
+
+    if (shard->lines == NULL || shard->buckets == NULL ||
+        pthread_mutex_init(&shard->lock, NULL) != 0) {
+      free(shard->lines);
+      free(shard->buckets);
+      destroy_shards(shards, i);
+      return 1;
+    }
+  }
+
+  cache->shards = shards;
+  cache->num_shards = num_shards;
+  return 0;
+}
+
+void cache_destroy(struct Cache *cache) {
+  if (cache->shards != NULL) {
+    destroy_shards(cache->shards, cache->num_shards);
+  }
+  cache->shards = NULL;
+  cache->num_shards = 0;
+}
+
+int cache_enabled(const struct Cache *cache) { return cache->shards != NULL; }
+
+// Unlinks a line from its bucket. The shard's lock must be held.
+static void unlink_line(struct CacheShard *shard, size_t line,
+                        size_t bucket) {
+  size_t *link = &shard->buckets[bucket];
+  while (*link != line + 1) {
+    link = &shard->lines[*link - 1].next;
+  }
+  *link = shard->lines[line].next;
+}
+
+// Picks the line to fill next, evicting one once the shard is full. The
+// shard's lock must be held.
+static size_t take_line(struct CacheShard *shard, int *dirty) {
+  *dirty = 0;
+  if (shard->used < shard->capacity)
+    return shard->used++;
+
+  // Every line is passed over at most once before one is found, since the
+  // hand clears the references it passes
+  while (shard->lines[shard->hand].referenced) {
+    shard->lines[shard->hand].referenced = 0;
+    shard->hand = (shard->hand + 1) % shard->capacity;
+  }
+  size_t line = shard->hand;
+  shard->hand = (shard->hand + 1) % shard->capacity;
+
+  struct CacheLine *victim = &shard->lines[line];
+  uint64_t hash = line_hash(victim->owner, victim->key);
+  unlink_line(shard, line, (size_t)(hash >> 32) & shard->mask);
+  *dirty = victim->dirty;
+  return line;
+}
+
+enum CacheResult cache_access(struct Cache *cache, const void *owner,
+                              size_t key, int write) {
+  uint64_t hash = line_hash(owner, key);
+  struct CacheShard *shard = &cache->shards[hash % cache->num_shards];
+  size_t bucket = (size_t)(hash >> 32) & shard->mask;
+
+  pthread_mutex_lock(&shard->lock);
+  for (size_t next = shard->buckets[bucket]; next != 0;) {
+    struct CacheLine *line = &shard->lines[next - 1];
+    if (line->owner == owner && line->key == key) {
+      line->referenced = 1;
+      line->dirty |= write != 0;
+      pthread_mutex_unlock(&shard->lock);
+      return CACHE_HIT;
+    }
+    next = line->next;
+  }
+
+  int dirty;
+  size_t index = take_line(shard, &dirty);
+  struct CacheLine *line = &shard->lines[index];
+  line->owner = owner;
+  line->key = key;
+  line->referenced = 1;
+  line->dirty = write != 0;
+  line->next = shard->buckets[bucket];
+  shard->buckets[bucket] = index + 1;
+  pthread_mutex_unlock(&shard->lock);
+
+  return dirty ? CACHE_WRITE_BACK : CACHE_MISS;
+}
+
+size_t cache_flush(struct Cache *cache) {
+  size_t written = 0;
+
+  for (size_t i = 0; i < cache->num_shards; i++) {
+    struct CacheShard *shard = &cache->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    for (size_t line = 0; line < shard->used; line++) {
+      written += shard->lines[line].dirty;
+      shard->lines[line].dirty = 0;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return written;
+}
@@ -0,0 +1,78 @@
+#ifndef EMS_CACHE_H
+#define EMS_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Cache tier in front of the state store, whose every access pays the state
+// access delay. The store stays authoritative and holds every value; the
+// cache tracks which of its lines (an event, or a row of an event's seats)
+// are resident, so that an access to one of them does not pay the delay.
+//
+// A bounded number of lines is kept, split into shards that each have their
+// own lock. A full shard evicts with the CLOCK algorithm: the hand skips,
+// and clears, the lines accessed since it last passed. Written lines are
+// dirty until they are written back to the store, on eviction or on flush.
+
+#define CACHE_SHARDS 16
+
+enum CacheResult {
+  CACHE_HIT,        /// The line was resident.
+  CACHE_MISS,       /// The line was read from the store.
+  CACHE_WRITE_BACK, /// The line was read from the store, evicting a dirty
+                    /// line that was written back to it.
+};
+
+struct CacheLine {
+  const void *owner;        /// Structure the line belongs to, NULL if empty.
+  size_t key;               /// Line within its owner.
+  size_t next;              /// Next line in the same bucket, plus one.
+  unsigned char referenced; /// Set on every access, cleared by the hand.
+  unsigned char dirty;      /// Set once written, until written back.
+};
+
+struct CacheShard {
+  pthread_mutex_t lock;    /// Guards the fields below.
+  struct CacheLine *lines; /// Lines of the shard.
+  size_t capacity;         /// Number of lines.
+  size_t used;             /// Number of lines ever filled.
+  size_t hand;             /// Next line the clock hand looks at.
+  size_t *buckets;         /// First line of each hash bucket, plus one.
+  size_t mask;             /// Number of buckets minus one, a power of two.
+};
+
+struct Cache {
+  struct CacheShard *shards; /// Shards, NULL if the cache is disabled.
+  size_t num_shards;         /// Number of shards.
+};
+
+/// Initializes an empty cache.
+/// @param cache Cache to initialize.
+/// @param capacity Number of lines, 0 to disable the cache.
+/// @return 0 if the cache was initialized, 1 if out of memory.
+int cache_init(struct Cache *cache, size_t capacity);
+
+/// Destroys a cache, without writing anything back.
+/// @param cache Cache to destroy.
+void cache_destroy(struct Cache *cache);
+
+/// Checks if a cache is enabled.
+/// @param cache Cache to check.
+/// @return 1 if it is, 0 if every access goes to the store.
+int cache_enabled(const struct Cache *cache);
+
+/// Accesses a line through a cache, filling it on a miss.
+/// @param cache Cache to access, enabled.
+/// @param owner Structure the line belongs to.
+/// @param key Line within its owner.
+/// @param write Nonzero if the line is written, which makes it dirty.
+/// @return How the access was served.
+enum CacheResult cache_access(struct Cache *cache, const void *owner,
+                              size_t key, int write);
+
+/// Writes back every dirty line of a cache, keeping them resident.
+/// @param cache Cache to flush.
+/// @return Number of lines written back.
+size_t cache_flush(struct Cache *cache);
+
+#endif // EMS_CACHE_H
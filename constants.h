@@ -1,2 +1,25 @@
 #define MAX_RESERVATION_SIZE 256
+#define MAX_MULTI_EVENTS 8 // Events of a single RESERVE_MULTI
 #define STATE_ACCESS_DELAY_MS 10
+#define EVENT_LOCK_STRIPES 32 // At most 64, stripes are tracked in a bitmask.
+                              // ThreadSanitizer tracks 64 locks held by a
+                              // thread, and a SHOW holds every stripe and the
+                              // event's lock, so 32 leaves room for both.
+#define PIPELINE_QUEUE_SIZE 256 // Power of two
+#define WAL_COMMIT_BUDGET_US 1000 // Default wait for a log group to fill
+#define TRACE_RING_SPANS 65536 // Spans kept per thread when tracing, the
+                               // oldest are overwritten
+#define SEAT_TILE_SEATS 4096 // Power of two. Seats per tile of an event,
+                             // allocated on the first reservation in it
+#define BITMAP_GROUP_WORDS 512 // Words of occupancy bitmap per group of
+                               // rows, allocated like the tiles
+#define OUTPUT_BATCH 64 // Outputs written by a single writev
+#define OUTPUT_SPARE 64 // Written outputs kept for reuse per output file
+#define OUTPUT_MAX_QUEUED (16 << 20) // Bytes of output waiting to be written
+                                     // before commits wait for the writer
+#define SERVER_MAX_CLIENTS 1024 // Power of two. Connections served at once
+#define SERVER_MAX_PENDING (1 << 20) // Bytes received or to be sent per
+                                     // client before the server waits for it
+#define SERVER_BACKLOG 128   // Connections waiting to be accepted
+#define SERVER_MAX_EVENTS 64 // Socket events handled per wait
+#define SERVER_READ_SIZE 16384 // Bytes read from a client at a time
@@ -1,9 +1,23 @@
 #include "eventlist.h"
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "memory.h"
+
+#define INITIAL_BUCKETS 64
+
+// Maps an event id to a bucket using Fibonacci hashing, which spreads
+// sequential ids evenly across a power of two number of buckets
+static size_t bucket_index(unsigned int event_id, size_t num_buckets) {
+  uint64_t hash = (uint64_t)event_id * UINT64_C(11400714819323198485);
+  return (size_t)(hash >> 32) & (num_buckets - 1);
+}
+
 struct EventList *create_list() {
-  struct EventList *list = (struct EventList *)malloc(sizeof(struct EventList));
+  struct EventList *list =
+      (struct EventList *)mem_alloc(sizeof(struct EventList));
   // Checks if malloc failed
   if (!list)
     return NULL;
@@ -11,25 +25,91 @@ struct EventList *create_list() {
   // Initializes
   list->head = NULL;
   list->tail = NULL;
+  list->size = 0;
+  list->num_buckets = INITIAL_BUCKETS;
+  list->buckets = mem_calloc(list->num_buckets, sizeof(struct ListNode *));
   list->rwlock = (pthread_rwlock_t)PTHREAD_RWLOCK_INITIALIZER;
+  list->create_lock = (pthread_rwlock_t)PTHREAD_RWLOCK_INITIALIZER;
+  list->multi_lock = (pthread_rwlock_t)PTHREAD_RWLOCK_INITIALIZER;
+
+  // Checks if calloc failed
+  if (!list->buckets) {
+    mem_free(list);
+    return NULL;
+  }
 
   // Checks if rwlock_init failed
-  if (pthread_rwlock_init(&list->rwlock, NULL) != 0) {
-    free(list);
+  if (mem_rwlock_init(&list->rwlock) != 0) {
+    mem_free(list->buckets);
+    mem_free(list);
+    return NULL;
+  }
+  if (mem_rwlock_init(&list->create_lock) != 0) {
+    pthread_rwlock_destroy(&list->rwlock);
+    mem_free(list->buckets);
+    mem_free(list);
+    return NULL;
+  }
+  if (mem_rwlock_init(&list->multi_lock) != 0) {
+    pthread_rwlock_destroy(&list->create_lock);
+    pthread_rwlock_destroy(&list->rwlock);
+    mem_free(list->buckets);
+    mem_free(list);
+    return NULL;
+  }
+  if (arena_init(&list->arena) != 0) {
+    pthread_rwlock_destroy(&list->multi_lock);
+    pthread_rwlock_destroy(&list->create_lock);
+    pthread_rwlock_destroy(&list->rwlock);
+    mem_free(list->buckets);
+    mem_free(list);
     return NULL;
   }
 
   return list;
 }
 
+// Doubles the number of buckets. Must be called with the write lock held.
+// Failing to grow is not an error, lookups just get slower.
+static void grow_buckets(struct EventList *list) {
+  size_t num_buckets = list->num_buckets * 2;
+  struct ListNode **buckets =
+      mem_calloc(num_buckets, sizeof(struct ListNode *));
+  // Checks if calloc failed
+  if (!buckets)
+    return;
+
+  // Creation order is kept by the list itself, so chains can be rebuilt freely
+  for (struct ListNode *node = list->head; node; node = node->next) {
+    size_t index = bucket_index(node->event->id, num_buckets);
+    node->hash_next = buckets[index];
+    buckets[index] = node;
+  }
+
+  mem_free(list->buckets);
+  list->buckets = buckets;
+  list->num_buckets = num_buckets;
+}
+
+// Looks up a node by event id. Must be called with the lock held.
+static struct ListNode *find_node(struct EventList *list,
+                                  unsigned int event_id) {
+  struct ListNode *current =
+      list->buckets[bucket_index(event_id, list->num_buckets)];
+
+  while (current && current->event->id != event_id)
+    current = current->hash_next;
+
+  return current;
+}
+
 // Function to append a new event to the EventList
 int append_to_list(struct EventList *list, struct Event *event) {
   // Checks if the list is valid
   if (!list)
     return 1;
-  // Allocate memory for a new list node
-  struct ListNode *new_node =
-      (struct ListNode *)malloc(sizeof(struct ListNode));
+  // Allocate memory for a new list node, next to the events
+  struct ListNode *new_node = arena_alloc(&list->arena, sizeof(struct ListNode));
   // Checks if malloc failed
   if (!new_node)
     return 1;
@@ -37,11 +117,26 @@ int append_to_list(struct EventList *list, struct Event *event) {
   new_node->event = event;
   new_node->next = NULL;
 
-  if (pthread_rwlock_wrlock(&list->rwlock)) {
-    free(new_node);
+  // A node that is not appended stays in the arena until the list is freed
+  if (pthread_rwlock_wrlock(&list->rwlock))
     return 1;
+
+  // Checks for an existing event under the same lock as the insertion, so
+  // two threads creating the same id cannot both succeed
+  if (find_node(list, event->id) != NULL) {
+    pthread_rwlock_unlock(&list->rwlock);
+    return 2;
   }
 
+  // Keeps the load factor at or below one
+  if (list->size >= list->num_buckets)
+    grow_buckets(list);
+
+  size_t index = bucket_index(event->id, list->num_buckets);
+  new_node->hash_next = list->buckets[index];
+  list->buckets[index] = new_node;
+  list->size++;
+
   // If the list is empty, set the new node as both head and tail
   if (list->head == NULL) {
     list->head = new_node;
@@ -50,29 +145,34 @@ int append_to_list(struct EventList *list, struct Event *event) {
     list->tail->next = new_node;
     list->tail = new_node;
   }
+  // The node is already reachable through the index, so it can no longer be
+  // taken back out; the event is reported as appended either way
   if (pthread_rwlock_unlock(&list->rwlock) != 0) {
-    if (list->head == new_node)
-      list->head = NULL;
-    if (list->tail == new_node)
-      list->tail = NULL;
-    free(new_node);
-    return 1;
+    fprintf(stderr, "Error unlocking event list\n");
   }
 
   return 0;
 }
 
-// Function to free the memory of an event
-static void free_event(struct Event *event) {
-  if (!event)
-    return;
-
+// Destroys the locks and ledger of an event, its memory belongs to the arena
+static void destroy_event(struct Event *event) {
   if (pthread_rwlock_destroy(&event->rwlock) != 0) {
     // Error happening here makes no difference
   }
+  for (size_t i = 0; i < event->num_row_locks; i++) {
+    pthread_rwlock_destroy(&event->row_locks[i]);
+  }
+  pthread_rwlock_destroy(&event->runs_lock);
+  ledger_destroy(&event->ledger);
+}
+
+// Function to free the memory of an event
+void free_event(struct EventList *list, struct Event *event) {
+  if (!event)
+    return;
 
-  free(event->data);
-  free(event);
+  destroy_event(event);
+  arena_free(&list->arena, event);
 }
 
 // Function to free the memory of an EventList
@@ -80,19 +180,19 @@ void free_list(struct EventList *list) {
   if (!list)
     return;
 
-  struct ListNode *current = list->head;
-  while (current) {
-    struct ListNode *temp = current;
-    current = current->next;
-
-    free_event(temp->event);
-    free(temp);
+  for (struct ListNode *node = list->head; node; node = node->next) {
+    destroy_event(node->event);
   }
+  // Events and nodes go all at once
+  arena_release(&list->arena);
 
   if (pthread_rwlock_destroy(&list->rwlock) != 0) {
     // Error happening here makes no difference
   }
-  free(list);
+  pthread_rwlock_destroy(&list->create_lock);
+  pthread_rwlock_destroy(&list->multi_lock);
+  mem_free(list->buckets);
+  mem_free(list);
 }
 
 // Function to retrieve an event from the EventList based on its ID
@@ -104,20 +204,10 @@ struct Event *get_event(struct EventList *list, unsigned int event_id) {
   if (pthread_rwlock_rdlock(&list->rwlock) != 0)
     return NULL;
 
-  struct ListNode *current = list->head;
-
-  while (current) {
-    struct Event *event = current->event;
-    if (event->id == event_id) {
-      if (pthread_rwlock_unlock(&list->rwlock) != 0)
-        return NULL;
-      return event;
-    }
-    current = current->next;
-  }
+  struct ListNode *node = find_node(list, event_id);
 
   if (pthread_rwlock_unlock(&list->rwlock) != 0)
     return NULL;
 
-  return NULL;
+  return node ? node->event : NULL;
 }
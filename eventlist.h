@@ -3,41 +3,102 @@
 
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "ledger.h"
+#include "memory.h"
+#include "seats.h"
+
+// Runs of free seats of a range of rows, taken as one sequence of seats
+struct FreeRuns {
+  size_t head;        /// Free seats at the start of the range.
+  size_t tail;        /// Free seats at the end of the range.
+  size_t longest;     /// Longest run of free seats, possibly across rows.
+  size_t row_longest; /// Longest run of free seats within a single row.
+  size_t length;      /// Number of seats in the range.
+};
 
 struct Event {
-  unsigned int id;           /// Event id
-  unsigned int reservations; /// Number of reservations for the event.
-  pthread_rwlock_t rwlock;   /// Read-write lock for the event.
+  unsigned int id;                   /// Event id
+  _Atomic unsigned int reservations; /// Number of reservations for the event.
+  pthread_rwlock_t rwlock; /// Read-write lock for the event's structure.
+
+  pthread_rwlock_t *row_locks; /// Seat locks, row r uses (r - 1) % count.
+  size_t num_row_locks;        /// Number of seat locks.
 
   size_t cols; /// Number of columns.
   size_t rows; /// Number of rows.
 
-  unsigned int
-      *data; /// Array of size rows * cols with the reservations for each seat.
+  struct SeatGrid seats; /// Reservation id of each seat, rows * cols of
+                         /// them. Only widened with rwlock held for writing.
+                         /// The arrays of an event follow it in the same
+                         /// block, unless they are mapped or allocated
+                         /// later.
+
+  _Atomic(_Atomic uint64_t *) *occupied; /// Bitmap of reserved seats, rows
+                                         /// padded to full words, in groups
+                                         /// of group_rows rows. A group is
+                                         /// NULL until a seat in it is
+                                         /// reserved. Readable without any
+                                         /// lock.
+  size_t row_words;  /// Number of bitmap words per row.
+  size_t group_rows; /// Number of rows per bitmap group.
+  _Atomic size_t *max_free_run; /// Longest run of free seats of each row.
+  struct FreeRuns *free_runs; /// Tree of the free runs of the rows: node 1
+                              /// covers every row, node i has children 2i
+                              /// and 2i + 1, and leaf runs_leaves + r is row
+                              /// r. Guarded by runs_lock.
+  size_t runs_leaves;         /// Number of leaves, rows rounded up to a
+                              /// power of two.
+  pthread_rwlock_t runs_lock; /// Lock of free_runs, taken after seat locks.
+  int mapped; /// Set if the seats, bitmap and free runs live in a snapshot
+              /// mapping and must not be freed.
+
+  struct Ledger ledger; /// Seats of each reservation.
 };
 
 struct ListNode {
   struct Event *event;
-  struct ListNode *next;
+  struct ListNode *next;      // Next node in creation order
+  struct ListNode *hash_next; // Next node in the same hash bucket
 };
 
-// Linked list structure
+// Linked list structure, indexed by a hash table on the event id
 struct EventList {
   struct ListNode *head; // Head of the list
   struct ListNode *tail; // Tail of the list
+
+  struct ListNode **buckets; // Hash buckets, num_buckets is a power of two
+  size_t num_buckets;        // Number of hash buckets
+  size_t size;               // Number of events in the list
   pthread_rwlock_t rwlock;
+  pthread_rwlock_t create_lock; // Held for writing by whoever is creating an
+                                // event, from its existence check until it
+                                // is appended. Taken before rwlock.
+  pthread_rwlock_t multi_lock; // Held for reading by a reservation across
+                               // several events and for writing by a
+                               // snapshot, so a snapshot never holds part of
+                               // one. Taken before rwlock and event locks.
+  struct Arena arena; // Events and nodes, released with the list
 };
 
 /// Creates a new event list.
 /// @return Newly created event list, NULL on failure
 struct EventList *create_list();
 
-/// Appends a new node to the list.
+/// Appends a new node to the list, unless an event with the same id is
+/// already in it. The check and the insertion are done atomically.
 /// @param list Event list to be modified.
 /// @param data Event to be stored in the new node.
-/// @return 0 if the node was appended successfully, 1 otherwise.
+/// @return 0 if the node was appended successfully, 1 on failure, 2 if an
+/// event with the same id already exists.
 int append_to_list(struct EventList *list, struct Event *data);
 
+/// Frees an event that is not in any list.
+/// @param list Event list whose arena the event was allocated from.
+/// @param event Event to be freed.
+void free_event(struct EventList *list, struct Event *event);
+
 /// Removes a node from the list.
 /// @param list Event list to be modified.
 /// @return 0 if the node was removed successfully, 1 otherwise.
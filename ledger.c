@@ -0,0 +1,247 @@
+#include "ledger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+
+#define LEDGER_MIN_ENTRIES 16  // Entries of the first segment
+#define LEDGER_CHUNK_SEATS 256 // Seats allocated at a time for small blocks
+#define LEDGER_LARGE (LEDGER_CHUNK_SEATS / 4) // Blocks this large get a
+                                              // chunk of their own
+
+int ledger_init(struct Ledger *ledger, unsigned int unindexed) {
+  memset(ledger->segments, 0, sizeof(ledger->segments));
+  ledger->num_entries = 0;
+  ledger->chunks = NULL;
+  ledger->next = NULL;
+  ledger->left = 0;
+  memset(ledger->free_blocks, 0, sizeof(ledger->free_blocks));
+  ledger->unindexed = unindexed;
+  return mem_rwlock_init(&ledger->lock);
+}
+
+void ledger_destroy(struct Ledger *ledger) {
+  pthread_rwlock_destroy(&ledger->lock);
+  for (size_t i = 0; i < LEDGER_SEGMENTS; i++) {
+    mem_free(ledger->segments[i]);
+    ledger->segments[i] = NULL;
+  }
+  while (ledger->chunks != NULL) {
+    size_t *chunk = ledger->chunks;
+    memcpy(&ledger->chunks, chunk, sizeof(size_t *));
+    mem_free(chunk);
+  }
+}
+
+// Gets the entry of a reservation id, which must be below num_entries
+static struct LedgerEntry *entry_of(struct Ledger *ledger,
+                                    unsigned int reservation_id) {
+  size_t index = (size_t)reservation_id - 1;
+  size_t block = index / LEDGER_MIN_ENTRIES + 1;
+  unsigned int segment = 63 - (unsigned int)__builtin_clzll(block);
+  size_t first = LEDGER_MIN_ENTRIES * (((size_t)1 << segment) - 1);
+  return &ledger->segments[segment][index - first];
+}
+
+// Makes sure there is an entry for every id up to a reservation id,
+// allocating the segments that hold them. The write lock must be held.
+static int add_entries(struct Ledger *ledger, size_t num_entries) {
+  size_t capacity = 0;
+
+  for (size_t segment = 0;
+       segment < LEDGER_SEGMENTS && capacity < num_entries; segment++) {
+    size_t length = (size_t)LEDGER_MIN_ENTRIES << segment;
+    // New entries start zeroed, reservations with lower ids may still be
+    // committing
+    if (ledger->segments[segment] == NULL &&
+        (ledger->segments[segment] =
+             mem_calloc(length, sizeof(struct LedgerEntry))) == NULL)
+      return 1;
+    capacity += length;
+  }
+  if (capacity < num_entries)
+    return 1;
+
+  if (num_entries > ledger->num_entries) {
+    ledger->num_entries = num_entries;
+  }
+  return 0;
+}
+
+// Gets the class of the block holding a number of seats, the smallest i
+// such that 1 << i seats fit
+static unsigned int block_class(size_t num_seats) {
+  if (num_seats <= 1)
+    return 0;
+  return 64 - (unsigned int)__builtin_clzll(num_seats - 1);
+}
+
+// Takes a block for a number of seats, reusing the block of a cancelled
+// reservation of the same class if there is one. The write lock must be
+// held.
+static size_t *take_block(struct Ledger *ledger, size_t num_seats) {
+  unsigned int class = block_class(num_seats);
+  size_t size = (size_t)1 << class;
+  size_t *block = ledger->free_blocks[class];
+
+  if (block != NULL) {
+    memcpy(&ledger->free_blocks[class], block, sizeof(size_t *));
+    return block;
+  }
+
+  // Large blocks get a chunk of their own, small ones are carved from the
+  // newest chunk, leaving the end of a full one unused
+  if (size >= LEDGER_LARGE || size > ledger->left) {
+    size_t length = size >= LEDGER_LARGE ? size + 1 : LEDGER_CHUNK_SEATS;
+    size_t *chunk = mem_alloc(length * sizeof(size_t));
+    if (chunk == NULL)
+      return NULL;
+    memcpy(chunk, &ledger->chunks, sizeof(size_t *));
+    ledger->chunks = chunk;
+    if (size >= LEDGER_LARGE)
+      return chunk + 1;
+
+    ledger->next = chunk + 1;
+    ledger->left = length - 1;
+  }
+
+  block = ledger->next;
+  ledger->next += size;
+  ledger->left -= size;
+  return block;
+}
+
+// Puts the block of a cancelled reservation aside for the next one of its
+// class. The write lock must be held.
+static void release_block(struct Ledger *ledger, struct LedgerEntry *entry) {
+  unsigned int class = block_class(entry->count);
+
+  memcpy(entry->seats, &ledger->free_blocks[class], sizeof(size_t *));
+  ledger->free_blocks[class] = entry->seats;
+  entry->seats = NULL;
+  entry->count = 0;
+}
+
+int ledger_add(struct Ledger *ledger, unsigned int reservation_id,
+               size_t num_seats, const size_t *indices) {
+  if (pthread_rwlock_wrlock(&ledger->lock) != 0)
+    return 1;
+
+  size_t *seats = NULL;
+  if (add_entries(ledger, reservation_id) != 0 ||
+      (seats = take_block(ledger, num_seats)) == NULL) {
+    pthread_rwlock_unlock(&ledger->lock);
+    return 1;
+  }
+
+  struct LedgerEntry *entry = entry_of(ledger, reservation_id);
+  entry->seats = seats;
+  entry->count = num_seats;
+  memcpy(seats, indices, num_seats * sizeof(size_t));
+
+  pthread_rwlock_unlock(&ledger->lock);
+  return 0;
+}
+
+size_t ledger_copy(struct Ledger *ledger, unsigned int reservation_id,
+                   size_t *seats, size_t max) {
+  size_t count = 0;
+
+  if (reservation_id == 0 || pthread_rwlock_rdlock(&ledger->lock) != 0)
+    return 0;
+
+  if (reservation_id <= ledger->num_entries) {
+    struct LedgerEntry *entry = entry_of(ledger, reservation_id);
+    count = entry->count;
+    if (count <= max && count > 0) {
+      memcpy(seats, entry->seats, count * sizeof(size_t));
+    }
+  }
+
+  pthread_rwlock_unlock(&ledger->lock);
+  return count;
+}
+
+void ledger_drop(struct Ledger *ledger, unsigned int reservation_id) {
+  if (reservation_id == 0 || pthread_rwlock_wrlock(&ledger->lock) != 0)
+    return;
+
+  if (reservation_id <= ledger->num_entries) {
+    struct LedgerEntry *entry = entry_of(ledger, reservation_id);
+    if (entry->count > 0) {
+      release_block(ledger, entry);
+    }
+  }
+  pthread_rwlock_unlock(&ledger->lock);
+}
+
+int ledger_is_indexed(struct Ledger *ledger) {
+  if (pthread_rwlock_rdlock(&ledger->lock) != 0)
+    return 0;
+  int indexed = ledger->unindexed == 0;
+  pthread_rwlock_unlock(&ledger->lock);
+  return indexed;
+}
+
+int ledger_index(struct Ledger *ledger, const struct SeatGrid *seats,
+                 size_t num_seats) {
+  if (pthread_rwlock_wrlock(&ledger->lock) != 0)
+    return 1;
+  // Another thread may have indexed them since they were checked
+  unsigned int unindexed = ledger->unindexed;
+  if (unindexed == 0) {
+    pthread_rwlock_unlock(&ledger->lock);
+    return 0;
+  }
+
+  // Counts the seats of each restored reservation, then copies them to
+  // their blocks in a single pass over the seats
+  size_t *counts = calloc(2 * ((size_t)unindexed + 1), sizeof(size_t));
+  if (counts == NULL || add_entries(ledger, unindexed) != 0) {
+    free(counts);
+    pthread_rwlock_unlock(&ledger->lock);
+    return 1;
+  }
+  size_t *next = counts + unindexed + 1; // Seats copied of each reservation
+
+  for (size_t i = 0; i < num_seats; i++) {
+    // Reservations replayed from a log after the snapshot are already in
+    unsigned int id = seat_grid_get(seats, i);
+    if (id > 0 && id <= unindexed && entry_of(ledger, id)->count == 0) {
+      counts[id]++;
+    }
+  }
+
+  for (unsigned int id = 1; id <= unindexed; id++) {
+    if (counts[id] == 0)
+      continue;
+
+    struct LedgerEntry *entry = entry_of(ledger, id);
+    if ((entry->seats = take_block(ledger, counts[id])) == NULL) {
+      // Gives back the blocks taken so far
+      while (--id > 0) {
+        if (counts[id] > 0) {
+          release_block(ledger, entry_of(ledger, id));
+        }
+      }
+      free(counts);
+      pthread_rwlock_unlock(&ledger->lock);
+      return 1;
+    }
+    entry->count = counts[id];
+  }
+
+  // Seats are visited in order, so each reservation's seats come out sorted
+  for (size_t i = 0; i < num_seats; i++) {
+    unsigned int id = seat_grid_get(seats, i);
+    if (id > 0 && id <= unindexed && counts[id] > 0) {
+      entry_of(ledger, id)->seats[next[id]++] = i;
+    }
+  }
+
+  ledger->unindexed = 0;
+  free(counts);
+  pthread_rwlock_unlock(&ledger->lock);
+  return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef EMS_LEDGER_H
+#define EMS_LEDGER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "seats.h"
+
+#define LEDGER_SEGMENTS 32 // Segments of entries, enough for every id
+#define LEDGER_CLASSES 64  // Sizes of seat blocks, powers of two
+
+// Where the seats of one reservation are kept in its event's ledger
+struct LedgerEntry {
+  size_t *seats; /// Block holding the seats, sorted.
+  size_t count;  /// Number of seats, 0 if cancelled or never committed.
+};
+
+// Seats of every reservation of an event, so that one can be found or
+// released without scanning the whole event. Reservation ids are handed out
+// in sequence, so entries are indexed by id. Nothing is ever moved, since
+// shared memory is only given back with the whole mapping: entries live in
+// segments that double in size, and the seats of each reservation in a
+// block carved from a chunk, whose size is rounded up to a power of two so
+// that the block of a cancelled reservation can be reused by the next one
+// of its size.
+struct Ledger {
+  pthread_rwlock_t lock; /// Guards the fields below. Taken after the event's
+                         /// seat locks, never before.
+  struct LedgerEntry *segments[LEDGER_SEGMENTS]; /// Entries, each segment
+                                                 /// twice as long as the one
+                                                 /// before, allocated on use.
+  size_t num_entries;  /// Number of entries in use.
+  size_t *chunks;      /// Chunks of seat blocks, newest first, linked through
+                       /// their first word.
+  size_t *next;        /// Next free seat of the newest chunk.
+  size_t left;         /// Seats left in the newest chunk.
+  size_t *free_blocks[LEDGER_CLASSES]; /// Blocks of cancelled reservations
+                                       /// holding 1 << i seats, linked
+                                       /// through their first word.
+  unsigned int unindexed; /// Reservations restored from a snapshot, added to
+                          /// the ledger on first use.
+};
+
+/// Initializes an empty ledger.
+/// @param ledger Ledger to initialize.
+/// @param unindexed Number of reservations whose seats are only in the
+/// event's seat array, with ids 1 to unindexed.
+/// @return 0 if the ledger was initialized successfully, 1 otherwise.
+int ledger_init(struct Ledger *ledger, unsigned int unindexed);
+
+/// Destroys a ledger, freeing its memory.
+/// @param ledger Ledger to destroy.
+void ledger_destroy(struct Ledger *ledger);
+
+/// Records the seats of a new reservation.
+/// @param ledger Ledger to add to.
+/// @param reservation_id Id of the reservation, not yet in the ledger.
+/// @param num_seats Number of seats.
+/// @param indices Sorted array of the indices of the seats.
+/// @return 0 if the reservation was recorded, 1 if out of memory.
+int ledger_add(struct Ledger *ledger, unsigned int reservation_id,
+               size_t num_seats, const size_t *indices);
+
+/// Copies the seats of a reservation.
+/// @param ledger Ledger to read.
+/// @param reservation_id Id of the reservation.
+/// @param seats Array to copy the indices of the seats to.
+/// @param max Size of the array. Nothing is copied if it is too small.
+/// @return Number of seats of the reservation, 0 if there is no such
+/// reservation or it was cancelled.
+size_t ledger_copy(struct Ledger *ledger, unsigned int reservation_id,
+                   size_t *seats, size_t max);
+
+/// Marks a reservation as cancelled, so its seats' block can be reused.
+/// @param ledger Ledger to modify.
+/// @param reservation_id Id of the reservation.
+void ledger_drop(struct Ledger *ledger, unsigned int reservation_id);
+
+/// Checks if every reservation is in a ledger.
+/// @param ledger Ledger to check.
+/// @return 1 if they are, 0 if some restored ones must still be indexed.
+int ledger_is_indexed(struct Ledger *ledger);
+
+/// Adds the reservations restored from a snapshot to a ledger, if they are
+/// not in it yet.
+/// @note The event's seat locks must be held, so the seats do not change.
+/// @param ledger Ledger to add to.
+/// @param seats Reservation id of every seat of the event.
+/// @param num_seats Number of seats of the event.
+/// @return 0 if the reservations are in the ledger, 1 if out of memory.
+int ledger_index(struct Ledger *ledger, const struct SeatGrid *seats,
+                 size_t num_seats);
+
+#endif // EMS_LEDGER_H
@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,34 +12,275 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "binary.h"
 #include "constants.h"
+#include "memory.h"
 #include "operations.h"
+#include "output.h"
 #include "parser.h"
+#include "queue.h"
+#include "reader.h"
+#include "scheduler.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+#include "wal.h"
 
 void process_file(const char *filename);
 void *thread_function(void *params);
-unsigned int *wait_queue; // Array to hold waiting times for each thread
+void *pipeline_worker(void *params);
+
+// Workers shared by all the commands of one job file
+struct worker_pool {
+  struct Reader *reader;
+  // Reads the next command, from text or compiled job files
+  enum Command (*next_command)(struct Reader *, struct CommandRecord *);
+  int num_threads;
+
+  pthread_mutex_t mutex;     // Serializes parsing of the input file
+  pthread_barrier_t barrier; // Where workers meet on a BARRIER command
+  unsigned int barrier_generation; // Number of BARRIER commands parsed
+  unsigned int *wait_queue;        // Array to hold waiting times for each
+                                   // thread
+  int stop; // Set if the workers must exit before their next command
+
+  struct OutputSequencer output; // Writes the outputs in command order
+  size_t tickets; // Number of output tickets handed out, guarded by the
+                  // mutex in the shared parsing mode
+
+  // Pipeline mode only, the counters are guarded by the mutex
+  struct Queue ready;          // Parsed commands waiting for a worker
+  struct Queue free;           // Command records the reader can fill
+  size_t dispatched;           // Number of commands handed to workers
+  size_t completed;            // Number of those that were executed
+  pthread_cond_t progress;     // Signaled when a command is completed
+
+  struct Stats *stats; // Statistics of each worker, then of the reader of
+                       // the pipeline mode, MAX_THREADS + 1 in all
+  struct Trace *trace; // Timeline of the same threads, NULL if not tracing
+};
 
 struct thread_params {
-  int fd;
-  int out_fd;
+  struct worker_pool *pool;
   int thread_id;
+  unsigned int barrier_generation; // Number of barriers this thread has passed
+  struct Buffer out; // Where this thread renders its output, reused
 };
 
+static void run_workers(struct worker_pool *pool, pthread_t *threads,
+                        struct thread_params *params);
+static void run_pipeline(struct worker_pool *pool, pthread_t *threads,
+                         struct thread_params *params);
+static int run_scheduler(DIR *dir, unsigned int delay_ms);
+static int run_server(void);
+
 // Constants
 int MAX_PROC = 20;
 int MAX_THREADS = 2;
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-unsigned int barrier_flag = 0;
+int PIPELINE_MODE = 0; // Parse in a single reader thread, execute in workers
+size_t SHARED_STATE_MB = 0; // Size of the state shared by every job process,
+                            // 0 keeps a private copy per process
+int SCHEDULER_MODE = 0; // Run job files in a fixed pool of processes
+size_t JOB_WORKERS = 0; // Size of that pool, 0 for one per online CPU
+int LARGEST_FIRST = 0;  // Start the pool on the largest job files
+char *SNAPSHOT_PATH = NULL; // Snapshot restored at startup and written by
+                            // SNAPSHOT, absolute
+char *WAL_PATH = NULL; // Write-ahead log replayed at startup, absolute. When
+                       // each job file has a state of its own, the prefix of
+                       // one log per job file instead.
+unsigned int WAL_BUDGET_US = WAL_COMMIT_BUDGET_US; // Longest wait for a log
+                                                   // group to fill
+int STATS_REPORT = 0; // Write the statistics of each job file next to its
+                      // output
+int TRACE_MODE = 0;   // Write a timeline of each job file next to its output
+size_t CACHE_LINES = 0; // Events and rows of seats cached in front of the
+                        // delayed state, 0 for none
+char *SERVER_PATH = NULL; // Socket the commands are served on instead of
+                          // running job files, absolute
+
+// Answer to HELP
+static const char help_text[] =
+    "Available commands:\n"
+    "  CREATE <event_id> <num_rows> <num_columns>\n"
+    "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+    "  RESERVE_BEST <event_id> <num_seats> [same_row (0 or 1)]\n"
+    "    (with same_row 0, seats may go on from the end of a row into the\n"
+    "    start of the next)\n"
+    "  RESERVE_MULTI <event_id> [(<x1>,<y1>) ...] <event_id> "
+    "[(<x1>,<y1>) ...] ...\n"
+    "  CANCEL <event_id> <reservation_id>\n"
+    "  SHOW <event_id>\n"
+    "  SHOWRES <event_id> <reservation_id>\n"
+    "  AVAILABLE <event_id>\n"
+    "  LIST\n"
+    "  SNAPSHOT\n"
+    "  STATS\n"
+    "  WAIT <delay_ms> [thread_id]\n"
+    "  BARRIER\n"
+    "  HELP\n";
+
+/// Parses a decimal option value.
+/// @param arg Option argument.
+/// @param max Largest value accepted.
+/// @param value Pointer to the variable to store the value in.
+/// @return 0 if the value is valid, 1 otherwise.
+static int parse_option_value(const char *arg, unsigned long int max,
+                              unsigned long int *value) {
+  char *endptr;
+
+  errno = 0;
+  *value = strtoul(arg, &endptr, 10);
+  return arg[0] == '\0' || arg[0] == '-' || *endptr != '\0' ||
+         errno == ERANGE || *value > max;
+}
+
+/// Resolves a path relative to where ems was started, not to the job
+/// directory.
+/// @param path Path to resolve.
+/// @return Newly allocated absolute path, NULL on failure.
+static char *absolute_path(const char *path) {
+  char cwd[PATH_MAX];
+  size_t length = strlen(path) + 1;
+  int absolute = path[0] == '/';
+
+  if (!absolute && getcwd(cwd, sizeof(cwd)) == NULL)
+    return NULL;
+
+  char *result = malloc(absolute ? length : strlen(cwd) + 1 + length);
+  if (result == NULL)
+    return NULL;
+
+  if (absolute) {
+    strcpy(result, path);
+  } else {
+    sprintf(result, "%s/%s", cwd, path);
+  }
+  return result;
+}
+
+/// Gets the length of the extension of a text (.jobs) or compiled (.jobsb)
+/// job file.
+/// @return Length of the extension, 0 if the name is not a job file's.
+static size_t job_extension_length(const char *name) {
+  size_t length = strlen(name);
+
+  if (length > 5 && strcmp(&name[length - 5], ".jobs") == 0)
+    return 5;
+  if (length > 6 && strcmp(&name[length - 6], ".jobsb") == 0)
+    return 6;
+  return 0;
+}
+
+/// Gets the length of the part of a job file's name its outputs are named
+/// after: the name without .jobs for a text file, the whole name for a
+/// compiled one, so foo.jobs and foo.jobsb never write to the same files.
+/// @param name Name of the job file.
+/// @return Length of the part of the name.
+static size_t job_stem_length(const char *name) {
+  size_t length = strlen(name);
+  return job_extension_length(name) == 5 ? length - 5 : length;
+}
+
+/// Checks if each job file logs to a file of its own: when the job files do
+/// not share a state, replaying the records of one into the state of another
+/// would recreate its events there.
+/// @return 1 if the job files have logs of their own, 0 otherwise.
+static int job_logs(void) {
+  return WAL_PATH != NULL && SERVER_PATH == NULL && !mem_is_shared();
+}
+
+/// Opens the log of a job file, <log>.<name>, and replays it into the
+/// state, if job files have logs of their own. Must be called before the
+/// threads of the job file are started.
+/// @param filename Name of the job file.
+/// @return 0 if the log was opened or there is none to open, 1 otherwise
+/// (an error is printed).
+static int open_job_log(const char *filename) {
+  char path[PATH_MAX];
+
+  if (!job_logs())
+    return 0;
+
+  if (snprintf(path, sizeof(path), "%s.%.*s", WAL_PATH,
+               (int)job_stem_length(filename), filename) >= PATH_MAX) {
+    fprintf(stderr, "File name too long: %s\n", filename);
+    return 1;
+  }
+  if (wal_open(path, WAL_BUDGET_US) != 0 || ems_recover(path) != 0) {
+    fprintf(stderr, "Failed to recover log %s\n", path);
+    wal_close();
+    return 1;
+  }
+  return 0;
+}
+
+/// Checks if a directory entry is a job file.
+static int is_job_file(const char *name) {
+  return name[0] != '.' && job_extension_length(name) > 0;
+}
+
+/// Compiles a text job file, for "ems compile <file.jobs> [<file.jobsb>]".
+/// @return Exit status.
+static int compile_job_file(int argc, char *argv[]) {
+  char out_file_name[PATH_MAX];
+
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: %s compile <file.jobs> [<file.jobsb>]\n",
+            argv[0]);
+    return 1;
+  }
+
+  // Compiled files go next to their sources by default
+  if (snprintf(out_file_name, sizeof(out_file_name), "%sb", argv[2]) >=
+      PATH_MAX) {
+    fprintf(stderr, "File name too long: %s\n", argv[2]);
+    return 1;
+  }
+  const char *out_path = argc == 4 ? argv[3] : out_file_name;
+
+  int fd = open(argv[2], O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Failed to open file %s: %s\n", argv[2], strerror(errno));
+    return 1;
+  }
+  int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC,
+                    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (out_fd == -1) {
+    fprintf(stderr, "Failed to open file %s: %s\n", out_path,
+            strerror(errno));
+    close(fd);
+    return 1;
+  }
+
+  struct Reader reader;
+  int result = reader_open(&reader, fd);
+  if (result != 0) {
+    fprintf(stderr, "Failed to open reader for %s\n", argv[2]);
+  } else {
+    if ((result = binary_compile(&reader, out_fd)) != 0) {
+      fprintf(stderr, "Failed to compile %s\n", argv[2]);
+    }
+    reader_destroy(&reader);
+  }
+
+  close(fd);
+  close(out_fd);
+  return result;
+}
 
 int main(int argc, char *argv[]) {
   // Initialization
   unsigned int state_access_delay_ms = STATE_ACCESS_DELAY_MS;
   int option;
   DIR *dir = NULL;
+  const char *dir_path = NULL;
+
+  if (argc > 1 && strcmp(argv[1], "compile") == 0) {
+    return compile_job_file(argc, argv);
+  }
 
   // Parses arguments
-  while ((option = getopt(argc, argv, "d:p:m:t:")) != -1) {
+  while ((option = getopt(argc, argv, "d:p:m:t:qg:w:Ls:l:c:rTC:S:")) != -1) {
     switch (option) {
     case 'd':
       if (optarg == NULL) {
@@ -58,45 +300,206 @@ int main(int argc, char *argv[]) {
       break;
 
     case 'p':
-      if ((dir = opendir(optarg)) == NULL || chdir(optarg) == -1) {
+      // The directory is only entered once every path option is resolved
+      if ((dir = opendir(optarg)) == NULL) {
         fprintf(stderr, "Failed to open directory %s: %s\n", optarg,
                 strerror(errno));
         return 1;
       }
+      dir_path = optarg;
       break;
 
-    case 'm':
-      if (optarg == NULL) {
-        fprintf(stderr, "Invalid max proc value, defaulting to %d\n", MAX_PROC);
+    case 'm': {
+      unsigned long int value;
+      if (parse_option_value(optarg, INT_MAX, &value) || value == 0) {
+        fprintf(stderr, "Invalid max proc value\n");
+        return 1;
+      }
+      MAX_PROC = (int)value;
+      break;
+    }
+
+    case 't': {
+      unsigned long int value;
+      if (parse_option_value(optarg, INT_MAX, &value) || value == 0) {
+        fprintf(stderr, "Invalid max thread value\n");
+        return 1;
       }
-      MAX_PROC = atoi(optarg);
+      MAX_THREADS = (int)value;
       break;
+    }
 
-    case 't':
-      if (optarg == NULL) {
-        fprintf(stderr, "Invalid max thread value, defaulting to %d\n",
-                MAX_THREADS);
+    case 'q':
+      PIPELINE_MODE = 1;
+      break;
+
+    case 'g': {
+      char *end;
+      unsigned long int size = strtoul(optarg, &end, 10);
+
+      if (*end != '\0' || size == 0 || size > SIZE_MAX >> 20) {
+        fprintf(stderr, "Invalid shared state size\n");
+        return 1;
+      }
+
+      SHARED_STATE_MB = (size_t)size;
+      break;
+    }
+
+    case 'w': {
+      unsigned long int value;
+      if (parse_option_value(optarg, INT_MAX, &value)) {
+        fprintf(stderr, "Invalid worker count\n");
+        return 1;
+      }
+      SCHEDULER_MODE = 1;
+      JOB_WORKERS = (size_t)value;
+      break;
+    }
+
+    case 'L':
+      LARGEST_FIRST = 1;
+      break;
+
+    case 's':
+      free(SNAPSHOT_PATH);
+      if ((SNAPSHOT_PATH = absolute_path(optarg)) == NULL) {
+        fprintf(stderr, "Failed to resolve snapshot path\n");
+        return 1;
+      }
+      break;
+
+    case 'l':
+      free(WAL_PATH);
+      if ((WAL_PATH = absolute_path(optarg)) == NULL) {
+        fprintf(stderr, "Failed to resolve log path\n");
+        return 1;
+      }
+      break;
+
+    case 'c': {
+      unsigned long int value;
+      if (parse_option_value(optarg, UINT_MAX, &value)) {
+        fprintf(stderr, "Invalid group commit budget\n");
+        return 1;
+      }
+      WAL_BUDGET_US = (unsigned int)value;
+      break;
+    }
+
+    case 'r':
+      STATS_REPORT = 1;
+      break;
+
+    case 'T':
+      TRACE_MODE = 1;
+      break;
+
+    case 'C': {
+      unsigned long int value;
+      if (parse_option_value(optarg, UINT_MAX, &value)) {
+        fprintf(stderr, "Invalid cache size\n");
+        return 1;
+      }
+      CACHE_LINES = (size_t)value;
+      break;
+    }
+
+    case 'S':
+      free(SERVER_PATH);
+      if ((SERVER_PATH = absolute_path(optarg)) == NULL) {
+        fprintf(stderr, "Failed to resolve socket path\n");
+        return 1;
       }
-      MAX_THREADS = atoi(optarg);
       break;
     }
   }
 
   // Checks if correct number of arguments was passed
-  if (argc < 3 || dir == NULL) {
+  if (argc < 3 || (dir == NULL && SERVER_PATH == NULL)) {
     fprintf(stderr,
-            "Usage: %s -d <state_access_delay_ms> -p <path> -m <max_proc> -t "
-            "<max_threads>\n",
+            "Usage: %s -d <state_access_delay_ms> (-p <path> | -S <socket>) "
+            "-m <max_proc> -t <max_threads> [-q] [-g <shared_state_mb>] "
+            "[-w <workers>] [-L] [-s <snapshot>] [-l <log>] "
+            "[-c <group_commit_us>] [-r] [-T] [-C <cache_lines>]\n",
             argv[0]);
     return 1;
   }
+  // Without -p, the server runs in the current directory
+  if (dir == NULL) {
+    dir_path = ".";
+    if ((dir = opendir(dir_path)) == NULL) {
+      fprintf(stderr, "Failed to open directory %s: %s\n", dir_path,
+              strerror(errno));
+      return 1;
+    }
+  }
+
+  if (chdir(dir_path) == -1) {
+    fprintf(stderr, "Failed to open directory %s: %s\n", dir_path,
+            strerror(errno));
+    closedir(dir);
+    return 1;
+  }
+
+  // The state must be shared before it is created and the children forked
+  if (SHARED_STATE_MB > 0 && mem_init_shared(SHARED_STATE_MB << 20) != 0) {
+    fprintf(stderr, "Failed to map shared state: %s\n", strerror(errno));
+    closedir(dir);
+    return 1;
+  }
 
-  if (ems_init(state_access_delay_ms)) {
+  if (ems_init(state_access_delay_ms, CACHE_LINES)) {
     fprintf(stderr, "Failed to initialize EMS\n");
+    mem_destroy();
     closedir(dir);
     return 1;
   }
 
+  // Every job process starts from the restored events
+  if (SNAPSHOT_PATH != NULL && ems_restore(SNAPSHOT_PATH) != 0) {
+    fprintf(stderr, "Failed to restore snapshot %s\n", SNAPSHOT_PATH);
+    ems_terminate();
+    mem_destroy();
+    closedir(dir);
+    return 1;
+  }
+
+  // Then replays what was committed after it; the log is opened first so
+  // a torn record at its end is cut off before anything is appended. Job
+  // files with states of their own open their own logs instead.
+  if (WAL_PATH != NULL && !job_logs() &&
+      (wal_open(WAL_PATH, WAL_BUDGET_US) != 0 ||
+       ems_recover(WAL_PATH) != 0)) {
+    fprintf(stderr, "Failed to recover log %s\n", WAL_PATH);
+    wal_close();
+    ems_terminate();
+    mem_destroy();
+    closedir(dir);
+    return 1;
+  }
+
+  if (SERVER_PATH != NULL) {
+    int result = run_server();
+    wal_close();
+    ems_terminate();
+    mem_destroy();
+    closedir(dir);
+    free(SNAPSHOT_PATH);
+    free(WAL_PATH);
+    free(SERVER_PATH);
+    return result;
+  }
+
+  if (SCHEDULER_MODE) {
+    int result = run_scheduler(dir, state_access_delay_ms);
+    wal_close();
+    ems_terminate();
+    mem_destroy();
+    closedir(dir);
+    return result;
+  }
+
   struct dirent *file;
   int proc_count = 0;
   int status;
@@ -104,9 +507,8 @@ int main(int argc, char *argv[]) {
 
   // Iterates over all files in directory
   while ((file = readdir(dir)) != NULL) {
-    if (file->d_name[0] != '.' &&
-        strcmp(&file->d_name[strlen(file->d_name) - 4], "jobs") == 0) {
-      if (proc_count > MAX_PROC) {
+    if (is_job_file(file->d_name)) {
+      if (proc_count >= MAX_PROC) {
         // If number of processes reaches max, wait for any child process to
         // finish before starting a new one
 
@@ -124,8 +526,12 @@ int main(int argc, char *argv[]) {
         }
       }
 
+      fflush(stdout); // Keeps the child from repeating buffered output
       if ((pid = fork()) == 0) { // Child process
+        if (open_job_log(file->d_name) != 0)
+          exit(1);
         process_file(file->d_name);
+        wal_close();
         exit(0);
 
       } else { // Parent process
@@ -150,22 +556,233 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  wal_close();
   ems_terminate();
-  free(wait_queue);
+  mem_destroy();
   closedir(dir);
+  free(SNAPSHOT_PATH);
+  free(WAL_PATH);
   return 0;
 }
 
+/// Processes the job files a worker takes from the schedule, until none are
+/// left.
+/// @param schedule Schedule shared by the workers.
+/// @param files Names of the scheduled files.
+/// @param worker Index of this worker.
+/// @param delay_ms State access delay, used to reset the state.
+static void run_job_worker(struct Schedule *schedule, char **files,
+                           size_t worker, unsigned int delay_ms) {
+  ssize_t next;
+  int fresh = 1; // The state inherited from the parent is still empty
+
+  while ((next = schedule_next(schedule, worker)) >= 0) {
+    // Without a shared state, each job file starts from an empty one, or from
+    // the latest snapshot and its own log, as if it had a process of its own
+    if (!fresh && !mem_is_shared()) {
+      wal_close();
+      ems_terminate();
+      if (ems_init(delay_ms, CACHE_LINES) ||
+          (SNAPSHOT_PATH != NULL && ems_restore(SNAPSHOT_PATH) != 0)) {
+        fprintf(stderr, "Failed to initialize EMS\n");
+        exit(1);
+      }
+    }
+    fresh = 0;
+    if (open_job_log(files[next]) != 0)
+      exit(1);
+
+    process_file(files[next]);
+    printf("Worker %zu finished %s\n", worker, files[next]);
+    fflush(stdout);
+  }
+}
+
+/// Processes every job file of a directory with a fixed pool of worker
+/// processes.
+/// @param dir Directory to process, already the working directory.
+/// @param delay_ms State access delay.
+/// @return 0 if every worker exited successfully, 1 otherwise.
+static int run_scheduler(DIR *dir, unsigned int delay_ms) {
+  char **files = NULL;
+  off_t *sizes = NULL;
+  size_t num_files = 0;
+  size_t capacity = 0;
+  struct dirent *file;
+  int result = 0;
+
+  // Lists the job files up front so they can be split between the workers
+  while ((file = readdir(dir)) != NULL) {
+    if (!is_job_file(file->d_name))
+      continue;
+
+    if (num_files == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      char **new_files = realloc(files, capacity * sizeof(char *));
+      if (new_files != NULL)
+        files = new_files;
+      off_t *new_sizes = realloc(sizes, capacity * sizeof(off_t));
+      if (new_sizes != NULL)
+        sizes = new_sizes;
+
+      if (new_files == NULL || new_sizes == NULL) {
+        fprintf(stderr, "Failed to allocate memory for job files\n");
+        result = 1;
+        break;
+      }
+    }
+
+    struct stat st;
+    if ((files[num_files] = strdup(file->d_name)) == NULL) {
+      fprintf(stderr, "Failed to allocate memory for job files\n");
+      result = 1;
+      break;
+    }
+    sizes[num_files] = stat(file->d_name, &st) == 0 ? st.st_size : 0;
+    num_files++;
+  }
+
+  size_t num_workers = JOB_WORKERS;
+  if (num_workers == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = online > 0 ? (size_t)online : 1;
+  }
+  // Idle workers would only be forked to exit
+  if (num_workers > num_files)
+    num_workers = num_files;
+
+  struct Schedule *schedule = NULL;
+  if (result == 0 && num_workers > 0) {
+    schedule = schedule_create(sizes, num_files, num_workers, LARGEST_FIRST);
+    if (schedule == NULL) {
+      fprintf(stderr, "Failed to create job schedule\n");
+      result = 1;
+    }
+  }
+
+  size_t proc_count = 0;
+  for (size_t i = 0; schedule != NULL && i < num_workers; i++) {
+    fflush(stdout); // Keeps the child from repeating buffered output
+    pid_t pid = fork();
+
+    if (pid == 0) { // Child process
+      run_job_worker(schedule, files, i, delay_ms);
+      exit(0);
+    }
+    if (pid == -1) {
+      // The workers already running steal the files of the missing ones
+      fprintf(stderr, "Failed to fork worker: %s\n", strerror(errno));
+      result = 1;
+      break;
+    }
+    proc_count++;
+  }
+
+  // Wait for all worker processes to finish
+  while (proc_count > 0) {
+    int status;
+    pid_t pid = wait(&status);
+
+    if (pid <= 0) {
+      fprintf(stderr, "Failed to wait for child process: %s\n",
+              strerror(errno));
+      result = 1;
+      break;
+    }
+    printf("Child process %d exited with status %d\n", pid,
+           WEXITSTATUS(status));
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      result = 1;
+    proc_count--;
+  }
+
+  schedule_destroy(schedule);
+  for (size_t i = 0; i < num_files; i++) {
+    free(files[i]);
+  }
+  free(files);
+  free(sizes);
+  return result;
+}
+
+/// Opens a file next to a job file's output, named after the job file with
+/// another extension, truncating it.
+/// @param filename Name of the job file.
+/// @param extension Extension of the file to open, with its dot.
+/// @return File descriptor, -1 on failure (an error is printed).
+static int open_job_output(const char *filename, const char *extension) {
+  char name[PATH_MAX];
+
+  if (snprintf(name, sizeof(name), "%.*s%s", (int)job_stem_length(filename),
+               filename, extension) >= PATH_MAX) {
+    fprintf(stderr, "File name too long: %s\n", filename);
+    return -1;
+  }
+
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (fd == -1) {
+    fprintf(stderr, "Failed to open file %s: %s\n", name, strerror(errno));
+  }
+  return fd;
+}
+
+/// Writes the statistics of a job file's threads to <name>.stats.
+/// @param filename Name of the job file.
+/// @param stats Statistics of the threads, MAX_THREADS + 1 of them.
+static void write_stats_report(const char *filename, struct Stats *stats) {
+  struct Buffer report;
+
+  buffer_init(&report);
+  if (stats_report(stats, (size_t)MAX_THREADS + 1, &report) != 0) {
+    fprintf(stderr, "Failed to report statistics\n");
+    buffer_free(&report);
+    return;
+  }
+
+  int fd = open_job_output(filename, ".stats");
+  if (fd != -1) {
+    if (safe_write(fd, report.data, (ssize_t)report.length) !=
+        (ssize_t)report.length) {
+      fprintf(stderr, "Failed to write statistics\n");
+    }
+    close(fd);
+  }
+  buffer_free(&report);
+}
+
+/// Writes the timeline of a job file's threads to <name>.trace.json.
+/// @param filename Name of the job file.
+/// @param trace Trace of the threads, all of them finished.
+static void write_trace(const char *filename, struct Trace *trace) {
+  int fd = open_job_output(filename, ".trace.json");
+  if (fd == -1)
+    return;
+
+  if (trace_write(trace, fd) != 0) {
+    fprintf(stderr, "Failed to write trace\n");
+  }
+  close(fd);
+}
+
 void process_file(const char *filename) {
 
   int fd = -1;
   int out_fd = -1;
-  char out_file_name[32];
+  char out_file_name[PATH_MAX];
+  struct Reader reader;
+
+  int compiled = job_extension_length(filename) == 6;
+
+  // Generates output file name by switching extension to .out, or appending
+  // it to a compiled file's name
+  if (snprintf(out_file_name, sizeof(out_file_name), "%.*s.out",
+               (int)job_stem_length(filename), filename) >= PATH_MAX) {
+    fprintf(stderr, "File name too long: %s\n", filename);
+    return;
+  }
 
   fd = open(filename, O_RDONLY); // Opens input file
-  // Generates output file name by switching extension to .out
-  strncpy(out_file_name, filename, strlen(filename) - 4);
-  strcpy(&out_file_name[strlen(filename) - 4], "out\0");
 
   // Opens the output file for writing, creating it if necessary
   out_fd = open(out_file_name, O_WRONLY | O_CREAT | O_TRUNC,
@@ -184,245 +801,629 @@ void process_file(const char *filename) {
     return;
   }
 
+  // Maps the input file so commands are parsed by scanning memory
+  if (reader_open(&reader, fd) != 0) {
+    fprintf(stderr, "Failed to open reader for %s\n", filename);
+    close(fd);
+    close(out_fd);
+    return;
+  }
+  if (compiled && binary_read_header(&reader) != 0) {
+    fprintf(stderr, "Invalid compiled job file %s\n", filename);
+    reader_destroy(&reader);
+    close(fd);
+    close(out_fd);
+    return;
+  }
+
   pthread_t threads[MAX_THREADS];           // Array to store thread IDs
   struct thread_params params[MAX_THREADS]; // Array to store thread parameters
-  if (pthread_mutex_init(&mutex, NULL) != 0) {
+  struct worker_pool pool;
+
+  pool.reader = &reader;
+  pool.next_command = compiled ? binary_next_command : parse_command;
+  pool.num_threads = 0;
+  pool.barrier_generation = 0;
+  pool.stop = 0;
+  pool.tickets = 0;
+  pool.wait_queue = calloc((size_t)MAX_THREADS, sizeof(unsigned int));
+
+  if (pool.wait_queue == NULL) {
+    fprintf(stderr, "Failed to allocate memory for wait queue\n");
+    reader_destroy(&reader);
+    close(fd);
+    close(out_fd);
+    return;
+  }
+  pool.trace = NULL;
+  if ((pool.stats = stats_create((size_t)MAX_THREADS + 1)) == NULL ||
+      (TRACE_MODE &&
+       (pool.trace = trace_create((size_t)MAX_THREADS + 1)) == NULL)) {
+    fprintf(stderr, "Failed to allocate memory for statistics\n");
+    stats_destroy(pool.stats);
+    free(pool.wait_queue);
+    reader_destroy(&reader);
+    close(fd);
+    close(out_fd);
+    return;
+  }
+  if (pthread_mutex_init(&pool.mutex, NULL) != 0) {
     fprintf(stderr, "Failed to initialize mutex\n");
+    trace_destroy(pool.trace);
+    stats_destroy(pool.stats);
+    free(pool.wait_queue);
+    reader_destroy(&reader);
     close(fd);
     close(out_fd);
     return;
   }
-  void *thread_status = &barrier_flag;
-  wait_queue = malloc(sizeof(int) * (unsigned long)MAX_THREADS);
-
-  if (wait_queue == NULL) {
-    fprintf(stderr, "Failed to allocate memory for wait queue\n");
+  if (sequencer_init(&pool.output, out_fd) != 0) {
+    fprintf(stderr, "Failed to initialize output\n");
+    pthread_mutex_destroy(&pool.mutex);
+    trace_destroy(pool.trace);
+    stats_destroy(pool.stats);
+    free(pool.wait_queue);
+    reader_destroy(&reader);
     close(fd);
     close(out_fd);
     return;
   }
   for (int i = 0; i < MAX_THREADS; i++) {
-    wait_queue[i] = 0;
-  }
-
-  // Loops until threads exit through end of file
-  while (thread_status != NULL) {
-    barrier_flag = 0;                       // Reset barrier flag
-    for (int i = 0; i < MAX_THREADS; i++) { // Initialize threads
-      params[i].fd = fd;
-      params[i].out_fd = out_fd;
-      params[i].thread_id = i;
-
-      if (pthread_create(&threads[i], NULL, thread_function, &params[i]) != 0) {
-        fprintf(stderr, "Failed to create thread\n");
-        for (int j = 0; j < i; j++) {
-          if (pthread_join(threads[j], &thread_status) != 0) {
-            fprintf(stderr, "Failed to join thread\n");
-            close(fd);
-            close(out_fd);
-            return;
-          }
-        }
-        return;
-      }
-    }
-    // Joins threads after barrier or end of file
-    for (int i = 0; i < MAX_THREADS; i++) {
-      if (pthread_join(threads[i], &thread_status) != 0) {
-        fprintf(stderr, "Failed to join thread\n");
-        close(fd);
-        close(out_fd);
-        return;
-      }
-    }
-    // If threads exited through barrier, restart the loop
+    buffer_init(&params[i].out);
   }
+
+  if (PIPELINE_MODE) {
+    run_pipeline(&pool, threads, params);
+  } else {
+    run_workers(&pool, threads, params);
+  }
+
+  if (STATS_REPORT) {
+    write_stats_report(filename, pool.stats);
+  }
+  if (pool.trace != NULL) {
+    write_trace(filename, pool.trace);
+  }
+
   // Closes file
+  for (int i = 0; i < MAX_THREADS; i++) {
+    buffer_free(&params[i].out);
+  }
+  sequencer_destroy(&pool.output);
+  reader_destroy(&reader);
   close(fd);
   close(out_fd);
-  if (pthread_mutex_destroy(&mutex) != 0) {
+  trace_destroy(pool.trace);
+  stats_destroy(pool.stats);
+  free(pool.wait_queue);
+  if (pthread_mutex_destroy(&pool.mutex) != 0) {
     fprintf(stderr, "Failed to destroy mutex\n");
     return;
   }
 }
 
+/// Releases the parsing mutex of a pool, exiting the thread on failure.
+/// @param pool Pool the calling thread belongs to.
+/// @param thread_id Id of the calling thread.
+/// @param locked Value of stats_now when the mutex was acquired.
+static void unlock_parser(struct worker_pool *pool, int thread_id,
+                          uint64_t locked) {
+  stats_record(STATS_PARSER_HOLD, locked);
+  if (pthread_mutex_unlock(&pool->mutex) != 0) {
+    fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
+    pthread_exit(NULL);
+  }
+}
+
+/// Executes a WAIT command.
+/// @note Queueing a delay for another thread requires the pool's mutex.
+/// @param pool Pool the command belongs to.
+/// @param cmd Command to execute.
+static void execute_wait(struct worker_pool *pool, struct CommandRecord *cmd) {
+  if (cmd->has_thread && cmd->thread_id >= (unsigned int)pool->num_threads) {
+    fprintf(stderr, "Invalid thread id\n");
+    return;
+  }
+  if (cmd->delay > 0) {
+    if (cmd->has_thread) { // thread was specified
+      pool->wait_queue[cmd->thread_id] +=
+          cmd->delay; // queue wait for when specified thread unlocks
+    } else {          // no thread specified
+      ems_wait(cmd->delay);
+    }
+  }
+}
+
+/// Checks if a command writes to the output file.
+static int writes_output(enum Command type) {
+  return type == CMD_SHOW || type == CMD_SHOWRES || type == CMD_AVAILABLE ||
+         type == CMD_LIST_EVENTS || type == CMD_STATS ||
+         type == CMD_RESERVE_BEST;
+}
+
+/// Runs a command that does not involve other threads, recording whether it
+/// failed.
+/// @param cmd Command to run.
+/// @param stats Statistics reported by STATS, MAX_THREADS + 1 of them.
+/// @param out Buffer to render the output in.
+/// @return 0 if the command succeeded, 1 otherwise.
+static int run_command(struct CommandRecord *cmd, struct Stats *stats,
+                       struct Buffer *out) {
+  int failed = 0;
+
+  switch (cmd->type) {
+  case CMD_CREATE:
+    if ((failed = ems_create(cmd->event_id, cmd->num_rows, cmd->num_cols))) {
+      fprintf(stderr, "Failed to create event\n");
+    }
+    break;
+
+  case CMD_RESERVE:
+    // Attempts to reserve seats
+    if ((failed = ems_reserve(cmd->event_id, cmd->num_seats, cmd->xs,
+                              cmd->ys))) {
+      fprintf(stderr, "Failed to reserve seats\n");
+    }
+    break;
+
+  case CMD_RESERVE_BEST:
+    // Attempts to find and reserve adjacent seats
+    if ((failed = ems_reserve_best(cmd->event_id, cmd->num_seats,
+                                   cmd->same_row, out))) {
+      fprintf(stderr, "Failed to reserve seats\n");
+    }
+    break;
+
+  case CMD_RESERVE_MULTI:
+    // Attempts to reserve seats in every event, or in none
+    if ((failed = ems_reserve_multi(cmd->num_events, cmd->event_ids,
+                                    cmd->event_seats, cmd->xs, cmd->ys))) {
+      fprintf(stderr, "Failed to reserve seats\n");
+    }
+    break;
+
+  case CMD_CANCEL:
+    if ((failed = ems_cancel(cmd->event_id, cmd->reservation_id))) {
+      fprintf(stderr, "Failed to cancel reservation\n");
+    }
+    break;
+
+  case CMD_SHOW:
+    // Attempts to show event
+    if ((failed = ems_show(cmd->event_id, out))) {
+      fprintf(stderr, "Failed to show event\n");
+    }
+    break;
+
+  case CMD_SHOWRES:
+    if ((failed = ems_show_reservation(cmd->event_id, cmd->reservation_id,
+                                       out))) {
+      fprintf(stderr, "Failed to show reservation\n");
+    }
+    break;
+
+  case CMD_AVAILABLE:
+    if ((failed = ems_available(cmd->event_id, out))) {
+      fprintf(stderr, "Failed to show availability\n");
+    }
+    break;
+
+  case CMD_LIST_EVENTS:
+    if ((failed = ems_list_events(out))) {
+      fprintf(stderr, "Failed to list events\n");
+    }
+    break;
+
+  case CMD_SNAPSHOT:
+    if ((failed = SNAPSHOT_PATH == NULL)) {
+      fprintf(stderr, "No snapshot file, see -s\n");
+    } else if ((failed = ems_snapshot(SNAPSHOT_PATH))) {
+      fprintf(stderr, "Failed to write snapshot\n");
+    }
+    break;
+
+  case CMD_STATS:
+    // Threads keep recording while the report adds them up
+    if ((failed = stats_report(stats, (size_t)MAX_THREADS + 1, out))) {
+      fprintf(stderr, "Failed to report statistics\n");
+    }
+    break;
+
+  case CMD_INVALID: // handles invalid commands
+    failed = 1;
+    fprintf(stderr, "Invalid command. See HELP for usage\n");
+    break;
+
+  case CMD_HELP:
+    fputs(help_text, stdout);
+    break;
+
+  case CMD_WAIT:
+  case CMD_BARRIER:
+  case CMD_EMPTY:
+  case EOC:
+    break;
+  }
+
+  if (failed) {
+    stats_count(STATS_FAILED_COMMANDS);
+    if (cmd->type == CMD_RESERVE || cmd->type == CMD_RESERVE_BEST ||
+        cmd->type == CMD_RESERVE_MULTI) {
+      stats_count(STATS_FAILED_RESERVATIONS);
+    }
+  }
+  return failed;
+}
+
+/// Executes a command that does not involve the other threads of the pool.
+/// @note Commands that write to the output file must carry a ticket, which is
+/// committed even if the command fails.
+/// @param pool Pool the command belongs to.
+/// @param cmd Command to execute.
+/// @param out Buffer to render the output in, empty.
+static void execute_command(struct worker_pool *pool, struct CommandRecord *cmd,
+                            struct Buffer *out) {
+  uint64_t start = stats_now();
+  int failed = run_command(cmd, pool->stats, out);
+
+  if (writes_output(cmd->type)) {
+    // Output of a failed command may be incomplete, so none of it is kept
+    if (failed) {
+      out->length = 0;
+    }
+    uint64_t committing = stats_now();
+    sequencer_commit(&pool->output, cmd->ticket, out);
+    stats_record(STATS_OUTPUT, committing);
+  }
+  stats_record_command(cmd->type, start);
+}
+
+/// Runs a job file with workers that take turns parsing the input.
+/// @param pool Pool to run, with its reader, mutex and wait queue ready.
+/// @param threads Array of MAX_THREADS thread handles.
+/// @param params Array of MAX_THREADS thread parameters.
+static void run_workers(struct worker_pool *pool, pthread_t *threads,
+                        struct thread_params *params) {
+  // Workers block on the mutex until the barrier is sized to the number of
+  // threads that were actually created
+  pthread_mutex_lock(&pool->mutex);
+  for (int i = 0; i < MAX_THREADS; i++) { // Initialize threads
+    params[i].pool = pool;
+    params[i].thread_id = i;
+    params[i].barrier_generation = 0;
+
+    if (pthread_create(&threads[i], NULL, thread_function, &params[i]) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      break;
+    }
+    pool->num_threads++;
+  }
+
+  if (pool->num_threads == 0 ||
+      pthread_barrier_init(&pool->barrier, NULL,
+                           (unsigned int)pool->num_threads) != 0) {
+    fprintf(stderr, "Failed to initialize barrier\n");
+    // Makes the workers that were created stop at their first command
+    pool->stop = 1;
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->num_threads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    return;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  // Threads live until the end of the file, meeting at every barrier
+  for (int i = 0; i < pool->num_threads; i++) {
+    if (pthread_join(threads[i], NULL) != 0) {
+      fprintf(stderr, "Failed to join thread\n");
+    }
+  }
+  pthread_barrier_destroy(&pool->barrier);
+}
+
 void *thread_function(void *params) {
   // Extracts parameters from struct
   struct thread_params *thread_params = (struct thread_params *)params;
-  int fd = thread_params->fd;
-  int out_fd = thread_params->out_fd;
+  struct worker_pool *pool = thread_params->pool;
   int thread_id = thread_params->thread_id;
+  struct CommandRecord cmd;
+
+  stats_attach(&pool->stats[thread_id]);
+  trace_attach(pool->trace, (size_t)thread_id, "worker");
 
   // Continually processes commands
   while (1) {
-    unsigned int event_id, delay, target_id;
-    int do_wait;
-    size_t num_rows, num_columns, num_coords;
-    size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
-
     fflush(stdout);
-    if (pthread_mutex_lock(&mutex) != 0) {
+    uint64_t waiting = stats_now();
+    if (pthread_mutex_lock(&pool->mutex) != 0) {
       fprintf(stderr, "Failed to lock mutex in thread %d\n", thread_id);
       pthread_exit(NULL);
     }
+    stats_record(STATS_PARSER_WAIT, waiting);
+    uint64_t locked = stats_now();
+    if (pool->stop) {
+      pthread_mutex_unlock(&pool->mutex);
+      pthread_exit(NULL);
+    }
     // Checks if thread should wait
-    if (wait_queue[thread_id] > 0) {
-      ems_wait(wait_queue[thread_id]);
-      wait_queue[thread_id] = 0;
-    }
-    // Checks if barrier has been triggered
-    if (barrier_flag != 0) {
-      if (pthread_mutex_unlock(&mutex) != 0) {
-        // barrier flag is kept as one thread has already exited via barrier
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
-      }
-      pthread_exit(&barrier_flag);
+    if (pool->wait_queue[thread_id] > 0) {
+      ems_wait(pool->wait_queue[thread_id]);
+      pool->wait_queue[thread_id] = 0;
+    }
+    // Checks if a barrier has been triggered since this thread passed the
+    // last one
+    if (pool->barrier_generation != thread_params->barrier_generation) {
+      unlock_parser(pool, thread_id, locked);
+      waiting = stats_now();
+      pthread_barrier_wait(&pool->barrier);
+      stats_record(STATS_BARRIER_WAIT, waiting);
+      thread_params->barrier_generation++;
+      continue;
     }
 
     // Process the next command from the input file
-    switch (get_next(fd)) {
-    case CMD_CREATE:
-      if (parse_create(fd, &event_id, &num_rows, &num_columns) != 0) {
-        if (pthread_mutex_unlock(&mutex) != 0) { // all threads wait behind lock
-          fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-          pthread_exit(NULL);
-        }
-        fprintf(stderr, "Invalid command. See HELP for usage\n");
-        continue;
-      }
-      if (pthread_mutex_unlock(&mutex) != 0) { // all threads wait behind lock
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
-      }
-      if (ems_create(event_id, num_rows, num_columns)) {
-        fprintf(stderr, "Failed to create event\n");
-      }
-      break;
+    uint64_t parsing = stats_now();
+    enum Command type = pool->next_command(pool->reader, &cmd);
+    stats_record(STATS_PARSE, parsing);
+    // Outputs are written in the order their commands were parsed
+    if (writes_output(type)) {
+      cmd.ticket = pool->tickets++;
+    }
 
-    case CMD_RESERVE:
-      // Parses RESERVE command and extract reservation details
-      num_coords = parse_reserve(fd, MAX_RESERVATION_SIZE, &event_id, xs, ys);
-      if (pthread_mutex_unlock(&mutex) != 0) { // all threads wait behind lock
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
-      }
-      if (num_coords == 0) {
-        fprintf(stderr, "Invalid command. See HELP for usage\n");
-        continue;
-      }
-      // Attempts to reserve seats
-      if (ems_reserve(event_id, num_coords, xs, ys)) {
-        fprintf(stderr, "Failed to reserve seats\n");
-      }
+    switch (type) {
+    case CMD_WAIT:
+      // Other threads wait behind the lock
+      execute_wait(pool, &cmd);
+      unlock_parser(pool, thread_id, locked);
       break;
 
-    case CMD_SHOW:
-      // Parses SHOW command and extracts event ID
-      if (parse_show(fd, &event_id) != 0) {
-        if (pthread_mutex_unlock(&mutex) != 0) { // all threads wait behind lock
-          fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-          pthread_exit(NULL);
-        }
-        fprintf(stderr, "Invalid command. See HELP for usage\n");
-        continue;
-      }
-      // Attempts to show event
-      if (ems_show(event_id, out_fd)) {
-        fprintf(stderr, "Failed to show event\n");
-      }
-      if (pthread_mutex_unlock(&mutex) != 0) { // all threads wait behind lock
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
-      }
+    case CMD_BARRIER:
+      // Every other thread sees the new generation before parsing again
+      pool->barrier_generation++;
+      unlock_parser(pool, thread_id, locked);
+      waiting = stats_now();
+      pthread_barrier_wait(&pool->barrier);
+      stats_record(STATS_BARRIER_WAIT, waiting);
+      thread_params->barrier_generation++;
       break;
 
+    case EOC:
+      unlock_parser(pool, thread_id, locked);
+      pthread_exit(NULL);
+
+    case CMD_CREATE:
+    case CMD_RESERVE:
+    case CMD_RESERVE_BEST:
+    case CMD_RESERVE_MULTI:
+    case CMD_CANCEL:
+    case CMD_SHOW:
+    case CMD_SHOWRES:
+    case CMD_AVAILABLE:
     case CMD_LIST_EVENTS:
-      if (pthread_mutex_unlock(&mutex) != 0) { // all threads wait behind lock
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
-      }
-      if (ems_list_events(out_fd)) {
-        fprintf(stderr, "Failed to list events\n");
-      }
+    case CMD_SNAPSHOT:
+    case CMD_STATS:
+    case CMD_INVALID:
+    case CMD_HELP:
+    case CMD_EMPTY:
+      unlock_parser(pool, thread_id, locked);
+      execute_command(pool, &cmd, &thread_params->out);
       break;
+    }
+  }
+}
+
+/// Executes the commands handed out by the reader in run_pipeline.
+void *pipeline_worker(void *params) {
+  struct thread_params *thread_params = (struct thread_params *)params;
+  struct worker_pool *pool = thread_params->pool;
+  int thread_id = thread_params->thread_id;
+
+  stats_attach(&pool->stats[thread_id]);
+  trace_attach(pool->trace, (size_t)thread_id, "worker");
+
+  while (1) {
+    struct CommandRecord *cmd = queue_pop(&pool->ready);
+    // The reader hands out one empty record per worker at the end of file
+    if (cmd == NULL)
+      pthread_exit(NULL);
+
+    // Checks if thread should wait
+    pthread_mutex_lock(&pool->mutex);
+    unsigned int delay = pool->wait_queue[thread_id];
+    pool->wait_queue[thread_id] = 0;
+    pthread_mutex_unlock(&pool->mutex);
+    if (delay > 0) {
+      ems_wait(delay);
+    }
+
+    execute_command(pool, cmd, &thread_params->out);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->completed++;
+    pthread_cond_signal(&pool->progress);
+    pthread_mutex_unlock(&pool->mutex);
+
+    queue_push(&pool->free, cmd);
+  }
+}
+
+/// Parses the input in the calling thread and hands the commands to workers
+/// through a queue, until the end of the file.
+/// @param pool Pool to run the commands in.
+static void dispatch_commands(struct worker_pool *pool) {
+  size_t seq = 0;
+
+  while (1) {
+    struct CommandRecord *cmd = queue_pop(&pool->free);
+    uint64_t parsing = stats_now();
+    enum Command type = pool->next_command(pool->reader, cmd);
+    stats_record(STATS_PARSE, parsing);
+    cmd->seq = seq++;
 
+    switch (type) {
     case CMD_WAIT:
-      // Parses WAIT command and extracts delay and target ID
-      do_wait = parse_wait(fd, &delay, &target_id);
-      // Checks if parsing was unsuccessful
-      if (do_wait == -1) {
-        if (pthread_mutex_unlock(&mutex) != 0) { // all threads wait behind lock
-          fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-          pthread_exit(NULL);
-        }
-        fprintf(stderr, "Invalid command. See HELP for usage\n");
-        continue;
-      }
-      if (delay > 0) {
-        if (do_wait == 1) { // thread was specified
-          wait_queue[target_id] +=
-              delay; // queue wait for when specified thread unlocks
-          if (pthread_mutex_unlock(&mutex) != 0) {
-            fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-            pthread_exit(NULL);
-          }
-        } else { // do_wait == 0, no thread specified
-          ems_wait(delay);
-          if (pthread_mutex_unlock(&mutex) != 0) { // threads wait behind lock
-            fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-            pthread_exit(NULL);
-          }
-        }
+      // Stops reading, like a WAIT holding the parsing mutex would
+      if (cmd->has_thread) {
+        pthread_mutex_lock(&pool->mutex);
+        execute_wait(pool, cmd);
+        pthread_mutex_unlock(&pool->mutex);
+      } else {
+        execute_wait(pool, cmd);
       }
+      queue_push(&pool->free, cmd);
       break;
 
-    case CMD_INVALID: // handles invalid commands
-      if (pthread_mutex_unlock(&mutex) != 0) {
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
+    case CMD_BARRIER:
+      // Waits for every command read so far to be completed
+      pthread_mutex_lock(&pool->mutex);
+      while (pool->completed != pool->dispatched) {
+        pthread_cond_wait(&pool->progress, &pool->mutex);
       }
-      fprintf(stderr, "Invalid command. See HELP for usage\n");
+      pthread_mutex_unlock(&pool->mutex);
+      queue_push(&pool->free, cmd);
       break;
 
+    case CMD_INVALID:
     case CMD_HELP:
-      if (pthread_mutex_unlock(&mutex) != 0) {
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
-      }
-      printf("Available commands:\n"
-             "  CREATE <event_id> <num_rows> <num_columns>\n"
-             "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
-             "  SHOW <event_id>\n"
-             "  LIST\n"
-             "  WAIT <delay_ms> [thread_id]\n"
-             "  BARRIER\n"
-             "  HELP\n");
+    case CMD_EMPTY:
+      execute_command(pool, cmd, NULL);
+      queue_push(&pool->free, cmd);
       break;
 
-    case CMD_BARRIER:
-      if (barrier_flag == 0) {
-        barrier_flag = 1;
-      }
-      if (pthread_mutex_unlock(&mutex) != 0) {
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        barrier_flag = 0;
-        pthread_exit(NULL);
+    case EOC:
+      queue_push(&pool->free, cmd);
+      for (int i = 0; i < pool->num_threads; i++) {
+        queue_push(&pool->ready, NULL);
       }
-      pthread_exit(&barrier_flag);
-    case CMD_EMPTY:
-      if (pthread_mutex_unlock(&mutex) != 0) {
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
+      return;
+
+    case CMD_SHOW:
+    case CMD_SHOWRES:
+    case CMD_AVAILABLE:
+    case CMD_LIST_EVENTS:
+    case CMD_SNAPSHOT:
+    case CMD_STATS:
+    case CMD_CREATE:
+    case CMD_RESERVE:
+    case CMD_RESERVE_BEST:
+    case CMD_RESERVE_MULTI:
+    case CMD_CANCEL:
+      if (writes_output(type)) {
+        cmd->ticket = pool->tickets++;
       }
+      pthread_mutex_lock(&pool->mutex);
+      pool->dispatched++;
+      pthread_mutex_unlock(&pool->mutex);
+      queue_push(&pool->ready, cmd);
       break;
+    }
+  }
+}
 
-    case EOC:
-      if (pthread_mutex_unlock(&mutex) != 0) {
-        fprintf(stderr, "Failed to unlock mutex in thread %d\n", thread_id);
-        pthread_exit(NULL);
-      }
-      pthread_exit(NULL);
+/// Runs a job file with a single reader that parses every command and
+/// workers that only execute them.
+/// @param pool Pool to run, with its reader, mutex and wait queue ready.
+/// @param threads Array of MAX_THREADS thread handles.
+/// @param params Array of MAX_THREADS thread parameters.
+static void run_pipeline(struct worker_pool *pool, pthread_t *threads,
+                         struct thread_params *params) {
+  struct CommandRecord *records =
+      malloc(PIPELINE_QUEUE_SIZE * sizeof(struct CommandRecord));
+
+  pool->dispatched = 0;
+  pool->completed = 0;
+
+  if (records == NULL) {
+    fprintf(stderr, "Failed to allocate memory for command queue\n");
+    return;
+  }
+  if (queue_init(&pool->ready, PIPELINE_QUEUE_SIZE) != 0) {
+    fprintf(stderr, "Failed to initialize command queue\n");
+    free(records);
+    return;
+  }
+  if (queue_init(&pool->free, PIPELINE_QUEUE_SIZE) != 0) {
+    fprintf(stderr, "Failed to initialize command queue\n");
+    queue_destroy(&pool->ready);
+    free(records);
+    return;
+  }
+  pthread_cond_init(&pool->progress, NULL);
+
+  for (size_t i = 0; i < PIPELINE_QUEUE_SIZE; i++) {
+    queue_push(&pool->free, &records[i]);
+  }
+
+  for (int i = 0; i < MAX_THREADS; i++) { // Initialize threads
+    params[i].pool = pool;
+    params[i].thread_id = i;
+    params[i].barrier_generation = 0;
+
+    if (pthread_create(&threads[i], NULL, pipeline_worker, &params[i]) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      break;
+    }
+    pool->num_threads++;
+  }
+
+  if (pool->num_threads > 0) {
+    // The reader records its own statistics, until its pool is gone
+    stats_attach(&pool->stats[MAX_THREADS]);
+    trace_attach(pool->trace, (size_t)MAX_THREADS, "reader");
+    dispatch_commands(pool);
+    trace_attach(NULL, 0, NULL);
+    stats_attach(NULL);
+  }
+
+  for (int i = 0; i < pool->num_threads; i++) {
+    if (pthread_join(threads[i], NULL) != 0) {
+      fprintf(stderr, "Failed to join thread\n");
     }
   }
-}
\ No newline at end of file
+
+  pthread_cond_destroy(&pool->progress);
+  queue_destroy(&pool->free);
+  queue_destroy(&pool->ready);
+  free(records);
+}
+
+/// Executes a command sent to the server. WAIT delays the later commands of
+/// the same client, whatever thread it names, and the answer to HELP is sent
+/// to the client.
+/// @param context Statistics of the server, MAX_THREADS + 1 of them.
+/// @param cmd Command to execute.
+/// @param out Outputs of the client, the output of the command is appended.
+static void serve_command(void *context, struct CommandRecord *cmd,
+                          struct Buffer *out) {
+  uint64_t start = stats_now();
+  size_t length = out->length;
+
+  if (cmd->type == CMD_WAIT) {
+    ems_wait(cmd->delay);
+  } else if (cmd->type == CMD_HELP) {
+    if (buffer_append(out, help_text, sizeof(help_text) - 1) != 0) {
+      out->length = length;
+    }
+  } else if (run_command(cmd, context, out) != 0) {
+    // Output of a failed command may be incomplete, so none of it is kept
+    out->length = length;
+  }
+  stats_record_command(cmd->type, start);
+}
+
+/// Serves the commands of clients of the socket at SERVER_PATH, with
+/// MAX_THREADS workers, until stopped by a signal.
+/// @return 0 if the server stopped on a signal, 1 if it failed to start.
+static int run_server(void) {
+  struct Stats *stats = stats_create((size_t)MAX_THREADS + 1);
+
+  if (stats == NULL) {
+    fprintf(stderr, "Failed to allocate memory for statistics\n");
+    return 1;
+  }
+  int result = server_run(SERVER_PATH, MAX_THREADS, stats, serve_command,
+                          stats);
+  stats_destroy(stats);
+  return result;
+}
@@ -0,0 +1,297 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS is not part of POSIX.1-2008
+
+#include "memory.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Bookkeeping at the start of the shared mapping, so every process bumps the
+// same offset
+struct SharedRegion {
+  size_t size;         /// Size of the mapping.
+  _Atomic size_t used; /// Bytes handed out, including this header.
+};
+
+#define REGION_ALIGN alignof(max_align_t)
+
+#define ARENA_CHUNK_SIZE (1 << 20)          // Mapped at a time for small blocks
+#define ARENA_LARGE (ARENA_CHUNK_SIZE / 4)  // Blocks this large get their own
+#define ARENA_HUGE_PAGE ((size_t)2 << 20)   // Size of a transparent huge page
+
+// Header of every mapping of an arena, on a cache line of its own
+struct ArenaChunk {
+  struct ArenaChunk *next; /// Next older mapping.
+  size_t size;             /// Size of the mapping.
+  int large;               /// Set if it holds a single large block.
+};
+
+#define ARENA_HEADER MEM_CACHE_LINE
+
+// Header of memory handed back to an arena, at its start
+struct ArenaFree {
+  struct ArenaFree *next; /// Next memory handed back.
+  size_t size;            /// Size of the memory, a multiple of MEM_CACHE_LINE.
+};
+
+static struct SharedRegion *region = NULL;
+
+// Rounds size up to a multiple of the allocation alignment
+static size_t align_up(size_t size) {
+  return (size + REGION_ALIGN - 1) & ~(REGION_ALIGN - 1);
+}
+
+int mem_init_shared(size_t size) {
+  if (region != NULL || size <= align_up(sizeof(struct SharedRegion)))
+    return 1;
+
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return 1;
+
+  region = map;
+  region->size = size;
+  atomic_init(&region->used, align_up(sizeof(struct SharedRegion)));
+  return 0;
+}
+
+void mem_destroy(void) {
+  if (region == NULL)
+    return;
+
+  munmap(region, region->size);
+  region = NULL;
+}
+
+int mem_is_shared(void) { return region != NULL; }
+
+void *mem_alloc(size_t size) {
+  if (region == NULL)
+    return malloc(size);
+
+  size_t needed = align_up(size);
+  // Checks if rounding up overflowed
+  if (needed < size)
+    return NULL;
+
+  size_t used = atomic_load(&region->used);
+  do {
+    if (needed > region->size - used)
+      return NULL;
+  } while (!atomic_compare_exchange_weak(&region->used, &used, used + needed));
+
+  return (char *)region + used;
+}
+
+void *mem_calloc(size_t count, size_t size) {
+  if (region == NULL)
+    return calloc(count, size);
+
+  // Checks if count * size overflows
+  if (size != 0 && count > SIZE_MAX / size)
+    return NULL;
+
+  // The mapping starts zeroed and is never reused, so there is no need to
+  // clear it
+  return mem_alloc(count * size);
+}
+
+void mem_free(void *ptr) {
+  if (region == NULL)
+    free(ptr);
+}
+
+int mem_rwlock_init(pthread_rwlock_t *lock) {
+  pthread_rwlockattr_t attr;
+
+  if (pthread_rwlockattr_init(&attr) != 0)
+    return 1;
+
+  int shared =
+      region != NULL ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE;
+  if (pthread_rwlockattr_setpshared(&attr, shared) != 0) {
+    pthread_rwlockattr_destroy(&attr);
+    return 1;
+  }
+
+  int result = pthread_rwlock_init(lock, &attr) != 0;
+  pthread_rwlockattr_destroy(&attr);
+  return result;
+}
+
+// Maps zeroed memory for an arena, linking it in. The lock must be held.
+static struct ArenaChunk *map_chunk(struct Arena *arena, size_t size,
+                                    int large) {
+  // Large blocks are rounded to whole huge pages so they can use them
+  if (size >= ARENA_HUGE_PAGE) {
+    size_t rounded = (size + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+    if (rounded < size)
+      return NULL;
+    size = rounded;
+  }
+
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+#ifdef MADV_HUGEPAGE
+  if (size >= ARENA_HUGE_PAGE) {
+    madvise(map, size, MADV_HUGEPAGE); // Only advice, failing is harmless
+  }
+#endif
+
+  struct ArenaChunk *chunk = map;
+  chunk->next = arena->chunks;
+  chunk->size = size;
+  chunk->large = large;
+  arena->chunks = chunk;
+  arena->mapped += size;
+  return chunk;
+}
+
+int arena_init(struct Arena *arena) {
+  pthread_mutexattr_t attr;
+
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->left = 0;
+  arena->mapped = 0;
+  arena->free = NULL;
+
+  // Processes sharing the state share what is handed back
+  if (pthread_mutexattr_init(&attr) != 0)
+    return 1;
+  int shared =
+      region != NULL ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE;
+  int result = pthread_mutexattr_setpshared(&attr, shared) != 0 ||
+               pthread_mutex_init(&arena->lock, &attr) != 0;
+  pthread_mutexattr_destroy(&attr);
+  return result;
+}
+
+// Takes a small block from the memory handed back, the first that is large
+// enough, leaving the rest of it for later. The lock must be held.
+static void *reuse_block(struct Arena *arena, size_t needed) {
+  for (struct ArenaFree **link = &arena->free; *link != NULL;
+       link = &(*link)->next) {
+    struct ArenaFree *found = *link;
+    if (found->size < needed)
+      continue;
+
+    if (found->size == needed) {
+      *link = found->next;
+    } else {
+      struct ArenaFree *rest = (struct ArenaFree *)((char *)found + needed);
+      rest->next = found->next;
+      rest->size = found->size - needed;
+      *link = rest;
+    }
+    memset(found, 0, needed);
+    return found;
+  }
+  return NULL;
+}
+
+void *arena_alloc(struct Arena *arena, size_t size) {
+  size_t needed = (size + MEM_CACHE_LINE - 1) & ~(size_t)(MEM_CACHE_LINE - 1);
+  if (needed < size || needed > SIZE_MAX - ARENA_HEADER)
+    return NULL;
+
+  pthread_mutex_lock(&arena->lock);
+  void *block = needed < ARENA_LARGE ? reuse_block(arena, needed) : NULL;
+  if (block != NULL) {
+    pthread_mutex_unlock(&arena->lock);
+    return block;
+  }
+
+  // The shared mapping is a bump allocator already, and only reused through
+  // what is handed back
+  if (region != NULL) {
+    pthread_mutex_unlock(&arena->lock);
+    block = mem_alloc(needed + MEM_CACHE_LINE);
+    if (block == NULL)
+      return NULL;
+    return (char *)block +
+           (MEM_CACHE_LINE - (uintptr_t)block % MEM_CACHE_LINE) %
+               MEM_CACHE_LINE;
+  }
+
+  if (needed >= ARENA_LARGE) {
+    struct ArenaChunk *chunk = map_chunk(arena, ARENA_HEADER + needed, 1);
+    if (chunk != NULL) {
+      block = (char *)chunk + ARENA_HEADER;
+    }
+  } else {
+    if (needed > arena->left) {
+      struct ArenaChunk *chunk = map_chunk(arena, ARENA_CHUNK_SIZE, 0);
+      if (chunk != NULL) {
+        arena->next = (char *)chunk + ARENA_HEADER;
+        arena->left = ARENA_CHUNK_SIZE - ARENA_HEADER;
+      }
+    }
+    if (needed <= arena->left) {
+      block = arena->next;
+      arena->next += needed;
+      arena->left -= needed;
+    }
+  }
+
+  pthread_mutex_unlock(&arena->lock);
+  return block;
+}
+
+void arena_free(struct Arena *arena, void *ptr) {
+  if (ptr == NULL || region != NULL)
+    return;
+
+  // Large blocks start right after the header of their mapping
+  struct ArenaChunk *target = (struct ArenaChunk *)((char *)ptr - ARENA_HEADER);
+
+  pthread_mutex_lock(&arena->lock);
+  for (struct ArenaChunk **link = &arena->chunks; *link != NULL;
+       link = &(*link)->next) {
+    if (*link == target) {
+      // The first small block of a chunk also follows its header
+      if (target->large) {
+        *link = target->next;
+        arena->mapped -= target->size;
+        munmap(target, target->size);
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&arena->lock);
+}
+
+void arena_recycle(struct Arena *arena, void *ptr, size_t size) {
+  size_t rounded = (size + MEM_CACHE_LINE - 1) & ~(size_t)(MEM_CACHE_LINE - 1);
+  if (ptr == NULL || rounded == 0)
+    return;
+
+  struct ArenaFree *freed = ptr;
+  pthread_mutex_lock(&arena->lock);
+  freed->next = arena->free;
+  freed->size = rounded;
+  arena->free = freed;
+  pthread_mutex_unlock(&arena->lock);
+}
+
+void arena_release(struct Arena *arena) {
+  struct ArenaChunk *chunk = arena->chunks;
+  while (chunk != NULL) {
+    struct ArenaChunk *next = chunk->next;
+    munmap(chunk, chunk->size);
+    chunk = next;
+  }
+
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->left = 0;
+  arena->mapped = 0;
+  arena->free = NULL;
+  pthread_mutex_destroy(&arena->lock);
+}
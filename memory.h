@@ -0,0 +1,97 @@
+#ifndef EMS_MEMORY_H
+#define EMS_MEMORY_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Allocator for the EMS state. By default it is backed by malloc; after
+// mem_init_shared every allocation comes from a single mapping shared with
+// the processes forked afterwards, which sees it at the same address.
+
+/// Places every later allocation in a shared mapping. Must be called before
+/// the EMS state is initialized and before forking.
+/// @param size Size of the mapping in bytes.
+/// @return 0 if the mapping was created successfully, 1 otherwise.
+int mem_init_shared(size_t size);
+
+/// Unmaps the shared mapping, if any. Every allocation made from it becomes
+/// invalid.
+void mem_destroy(void);
+
+/// Checks if allocations are placed in the shared mapping.
+/// @return 1 if they are, 0 otherwise.
+int mem_is_shared(void);
+
+/// Allocates memory for the EMS state.
+/// @param size Number of bytes to allocate.
+/// @return Pointer to the memory, NULL if out of memory.
+void *mem_alloc(size_t size);
+
+/// Allocates zeroed memory for the EMS state.
+/// @param count Number of elements.
+/// @param size Size of each element.
+/// @return Pointer to the memory, NULL if out of memory.
+void *mem_calloc(size_t count, size_t size);
+
+/// Frees memory returned by mem_alloc or mem_calloc. Shared memory is only
+/// given back when the whole mapping is destroyed.
+/// @param ptr Memory to free.
+void mem_free(void *ptr);
+
+#define MEM_CACHE_LINE 64
+
+// Allocator for objects freed all at once, such as the events of a list.
+// Small blocks are carved from large chunks, so objects created together sit
+// together; large ones get a mapping of their own, backed by huge pages when
+// the system allows it. Small blocks replaced before the arena is released
+// can be handed back and are reused by later ones. Memory from an arena
+// always starts zeroed.
+struct ArenaChunk;
+struct ArenaFree;
+
+struct Arena {
+  pthread_mutex_t lock;      /// Guards the fields below.
+  struct ArenaChunk *chunks; /// Chunks and large blocks, newest first.
+  char *next;                /// Next free byte of the current chunk.
+  size_t left;               /// Bytes left in the current chunk.
+  size_t mapped;             /// Bytes mapped for the arena.
+  struct ArenaFree *free;    /// Memory handed back, reused by small blocks.
+};
+
+/// Initializes an empty arena.
+/// @param arena Arena to initialize.
+/// @return 0 if the arena was initialized successfully, 1 otherwise.
+int arena_init(struct Arena *arena);
+
+/// Allocates zeroed memory, aligned to MEM_CACHE_LINE. With a shared state
+/// the memory comes from the shared mapping instead, like mem_alloc.
+/// @param arena Arena to allocate from.
+/// @param size Number of bytes to allocate.
+/// @return Pointer to the memory, NULL if out of memory.
+void *arena_alloc(struct Arena *arena, size_t size);
+
+/// Gives back a block before the arena is released. Only large blocks are
+/// unmapped, small ones stay in their chunk until then.
+/// @param arena Arena the block was allocated from.
+/// @param ptr Block returned by arena_alloc, NULL does nothing.
+void arena_free(struct Arena *arena, void *ptr);
+
+/// Hands memory back for later small blocks of an arena, such as a block
+/// that was replaced, or the part of a block starting on a cache line and
+/// running to its end. With a shared state the memory is reused too.
+/// @param arena Arena the memory was allocated from.
+/// @param ptr Start of the memory, aligned to MEM_CACHE_LINE.
+/// @param size Size of the memory in bytes, rounded up to MEM_CACHE_LINE.
+void arena_recycle(struct Arena *arena, void *ptr, size_t size);
+
+/// Frees every block of an arena at once and destroys it.
+/// @param arena Arena to release.
+void arena_release(struct Arena *arena);
+
+/// Initializes a read-write lock that lives in memory from this allocator,
+/// making it process-shared when the memory is.
+/// @param lock Lock to initialize.
+/// @return 0 if the lock was initialized successfully, 1 otherwise.
+int mem_rwlock_init(pthread_rwlock_t *lock);
+
+#endif // EMS_MEMORY_H
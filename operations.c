@@ -1,14 +1,39 @@
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "cache.h"
+#include "constants.h"
 #include "eventlist.h"
+#include "ledger.h"
+#include "memory.h"
+#include "output.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "wal.h"
+
+// Snapshots store the bitmap and free runs exactly as they are laid out in
+// memory, and seats as 32-bit ids
+_Static_assert(sizeof(unsigned int) == sizeof(uint32_t),
+               "reservation ids must be 32 bits wide");
+_Static_assert(sizeof(_Atomic uint64_t) == sizeof(uint64_t) &&
+                   sizeof(_Atomic size_t) == sizeof(uint64_t),
+               "bitmap words and free runs must be 64 bits wide");
 
 // Global variables
 static struct EventList *event_list = NULL;
 static unsigned int state_access_delay_ms = 0;
+static struct Cache state_cache = {0}; // Lines of the state resident in
+                                       // memory, disabled by default
+static struct Snapshot restored = {0}; // Snapshot the events were restored
+                                       // from, if mapped in place
+static _Thread_local uint64_t rows_locked_at = 0; // When this thread last
+                                                  // took seat locks
 
 /// Calculates a timespec from a delay in milliseconds.
 /// @param delay_ms Delay in milliseconds.
@@ -17,29 +42,100 @@ static struct timespec delay_to_timespec(unsigned int delay_ms) {
   return (struct timespec){delay_ms / 1000, (delay_ms % 1000) * 1000000};
 }
 
+/// Gets the number of times an access to a line of the state pays the
+/// access delay: not at all if the line is cached, once to read it from the
+/// store otherwise, and once more if a dirty line is written back to make
+/// room for it.
+/// @param owner Structure the line belongs to.
+/// @param key Line within its owner.
+/// @param write Nonzero if the line is written.
+/// @return Number of store accesses.
+static unsigned int store_accesses(const void *owner, size_t key,
+                                   int write) {
+  if (!cache_enabled(&state_cache))
+    return 1;
+
+  switch (cache_access(&state_cache, owner, key, write)) {
+  case CACHE_HIT:
+    stats_count(STATS_CACHE_HITS);
+    return 0;
+  case CACHE_MISS:
+    stats_count(STATS_CACHE_MISSES);
+    return 1;
+  case CACHE_WRITE_BACK:
+    stats_count(STATS_CACHE_MISSES);
+    stats_count(STATS_CACHE_WRITE_BACKS);
+    return 2;
+  }
+  return 1;
+}
+
 /// Gets the event with the given ID from the state.
 /// @note Will wait to simulate a real system accessing a costly memory
-/// resource.
+/// resource, unless the event is cached.
 /// @param event_id The ID of the event to get.
 /// @return Pointer to the event if found, NULL otherwise.
 static struct Event *get_event_with_delay(unsigned int event_id) {
+  struct Event *event = get_event(event_list, event_id);
+  // Only events that exist are cached, looking for others always waits
+  unsigned int accesses =
+      event == NULL ? 1 : store_accesses(event_list, event_id, 0);
+
   struct timespec delay = delay_to_timespec(state_access_delay_ms);
-  nanosleep(&delay, NULL); // Should not be removed
+  uint64_t start = stats_now();
+  for (unsigned int i = 0; i < accesses; i++) {
+    nanosleep(&delay, NULL); // Should not be removed
+  }
+  if (accesses > 0) {
+    stats_record(STATS_DELAY, start);
+  }
 
-  return get_event(event_list, event_id);
+  return event;
 }
 
 /// Gets the seat with the given index from the state.
 /// @note Will wait to simulate a real system accessing a costly memory
-/// resource.
+/// resource, unless the seat's row is cached.
 /// @param event Event to get the seat from.
 /// @param index Index of the seat to get.
-/// @return Pointer to the seat.
-static unsigned int *get_seat_with_delay(struct Event *event, size_t index) {
+/// @return Reservation id of the seat, 0 if it is free.
+static unsigned int get_seat_with_delay(struct Event *event, size_t index) {
+  unsigned int accesses = store_accesses(event, index / event->cols, 0);
+
+  struct timespec delay = delay_to_timespec(state_access_delay_ms);
+  uint64_t start = stats_now();
+  for (unsigned int i = 0; i < accesses; i++) {
+    nanosleep(&delay, NULL); // Should not be removed
+  }
+  if (accesses > 0) {
+    stats_record(STATS_DELAY, start);
+  }
+
+  return seat_grid_get(&event->seats, index);
+}
+
+/// Sets the seat with the given index in the state.
+/// @note Will wait to simulate a real system accessing a costly memory
+/// resource, unless the seat's row is cached; the row is then written back
+/// once, when it leaves the cache.
+/// @param event Event to set the seat in.
+/// @param index Index of the seat to set.
+/// @param reservation_id Reservation id, 0 to free the seat. Must fit in the
+/// width of the event's seats.
+static void set_seat_with_delay(struct Event *event, size_t index,
+                                unsigned int reservation_id) {
+  unsigned int accesses = store_accesses(event, index / event->cols, 1);
+
   struct timespec delay = delay_to_timespec(state_access_delay_ms);
-  nanosleep(&delay, NULL); // Should not be removed
+  uint64_t start = stats_now();
+  for (unsigned int i = 0; i < accesses; i++) {
+    nanosleep(&delay, NULL); // Should not be removed
+  }
+  if (accesses > 0) {
+    stats_record(STATS_DELAY, start);
+  }
 
-  return &event->data[index];
+  seat_grid_set(&event->seats, index, reservation_id);
 }
 
 /// Gets the index of a seat.
@@ -52,68 +148,562 @@ static size_t seat_index(struct Event *event, size_t row, size_t col) {
   return (row - 1) * event->cols + col - 1;
 }
 
-/// Guarantees that a write isnt interrupted
-/// @param fd File descriptor to write to.
-/// @param buf Buffer to write.
-/// @param count Number of bytes to write.
-/// @return Number of bytes written.
-ssize_t safe_write(int fd, const void *buf, ssize_t count) {
-  ssize_t total_written = 0;
-  ssize_t bytes_written;
+/// Gets the occupancy bitmap of a row.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @return Pointer to the row_words words of the row, NULL if its group is
+/// not allocated and every seat in it is free.
+static _Atomic uint64_t *row_bitmap(struct Event *event, size_t row) {
+  _Atomic uint64_t *group = atomic_load_explicit(
+      &event->occupied[row / event->group_rows], memory_order_acquire);
 
-  while (total_written < count) {
-    bytes_written =
-        write(fd, buf + total_written, (size_t)(count - total_written));
+  if (group == NULL)
+    return NULL;
+  return group + row % event->group_rows * event->row_words;
+}
 
-    if (bytes_written == -1) {
-      if (errno == EINTR) {
-        // The write was interrupted by a signal, try again
-        continue;
-      } else {
-        fprintf(stderr, "Error writing\n");
+/// Gets the occupancy bitmap word holding a seat.
+/// @param event Event to get the word from.
+/// @param index Index of the seat.
+/// @param bit Pointer to the variable to store the seat's bit in.
+/// @return Pointer to the word, NULL if the seat's bitmap group is not
+/// allocated and the seat is free.
+static _Atomic uint64_t *occupancy_word(struct Event *event, size_t index,
+                                        uint64_t *bit) {
+  _Atomic uint64_t *words = row_bitmap(event, index / event->cols);
+  size_t col = index % event->cols;
+
+  *bit = UINT64_C(1) << (col % 64);
+  return words == NULL ? NULL : &words[col / 64];
+}
+
+/// Checks the occupancy bitmap for a seat.
+/// @param event Event the seat belongs to.
+/// @param index Index of the seat.
+/// @return Nonzero if the seat is reserved, 0 if it is free.
+static int seat_reserved(struct Event *event, size_t index) {
+  uint64_t bit;
+  _Atomic uint64_t *word = occupancy_word(event, index, &bit);
+  return word != NULL &&
+         (atomic_load_explicit(word, memory_order_relaxed) & bit) != 0;
+}
+
+/// Allocates the seat tiles and bitmap groups holding some seats, if they
+/// are not allocated yet.
+/// @note The seat locks of every row involved must be held for writing.
+/// @param event Event the seats belong to.
+/// @param num_seats Number of seats.
+/// @param indices Array of seat indices.
+/// @return 0 if they are allocated, 1 if out of memory.
+static int touch_seats(struct Event *event, size_t num_seats,
+                       const size_t *indices) {
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t row = indices[i] / event->cols;
+    size_t group = row / event->group_rows;
+
+    if (seat_grid_touch(&event->seats, indices[i], &event_list->arena) != 0)
+      return 1;
+    if (atomic_load_explicit(&event->occupied[group], memory_order_acquire) !=
+        NULL)
+      continue;
+
+    // Only the last group may have fewer rows
+    size_t rows = event->rows - group * event->group_rows;
+    rows = rows < event->group_rows ? rows : event->group_rows;
+    _Atomic uint64_t *words = arena_alloc(
+        &event_list->arena, rows * event->row_words * sizeof(uint64_t));
+    if (words == NULL)
+      return 1;
+
+    // Rows of a group may be locked by different threads, the loser of a
+    // race hands its words back to the arena
+    _Atomic uint64_t *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&event->occupied[group],
+                                                 &expected, words,
+                                                 memory_order_acq_rel,
+                                                 memory_order_acquire)) {
+      arena_recycle(&event_list->arena, (void *)words,
+                    rows * event->row_words * sizeof(uint64_t));
+    }
+  }
+  return 0;
+}
+
+/// Scans a row of the occupancy bitmap for runs of free seats.
+/// @note Reads the bitmap without locks, the result is only exact while the
+/// row's seat lock is held.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @param needed Length of the run to look for, 0 to measure the longest one.
+/// @param start Pointer to the variable to store the first column (starting
+/// at 0) of the first run of at least needed seats in. May be NULL.
+/// @return Length of the longest run if needed is 0. Otherwise a value of at
+/// least needed if such a run was found, and a smaller one if not.
+static size_t scan_free_run(struct Event *event, size_t row, size_t needed,
+                            size_t *start) {
+  _Atomic uint64_t *words = row_bitmap(event, row);
+  size_t longest = 0;
+  size_t current = 0;
+
+  // A row whose group was never allocated is one run of free seats
+  if (words == NULL) {
+    if (start != NULL)
+      *start = 0;
+    return event->cols;
+  }
+
+  for (size_t i = 0; i < event->row_words; i++) {
+    uint64_t word = atomic_load_explicit(&words[i], memory_order_relaxed);
+    size_t valid = event->cols - i * 64 < 64 ? event->cols - i * 64 : 64;
+    size_t pos = 0;
+
+    while (pos < valid) {
+      // Counts the free seats from pos up to the next reserved one
+      uint64_t rest = word >> pos;
+      size_t zeros = rest == 0 ? 64 - pos : (size_t)__builtin_ctzll(rest);
+      if (zeros > valid - pos)
+        zeros = valid - pos;
+      current += zeros;
+      pos += zeros;
+
+      if (needed > 0 && current >= needed) {
+        if (start != NULL)
+          *start = i * 64 + pos - current;
+        return current;
+      }
+      if (pos >= valid)
+        break;
+
+      // Skips the reserved seats
+      longest = current > longest ? current : longest;
+      current = 0;
+      rest = word >> pos;
+      pos += ~rest == 0 ? 64 - pos : (size_t)__builtin_ctzll(~rest);
+    }
+  }
+
+  return current > longest ? current : longest;
+}
+
+/// Measures the runs of free seats of a row from the occupancy bitmap.
+/// @note The result is only exact while the row's seat lock is held.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @return Runs of the row, as a leaf of the free run tree.
+static struct FreeRuns measure_row(struct Event *event, size_t row) {
+  _Atomic uint64_t *words = row_bitmap(event, row);
+  struct FreeRuns runs = {0, 0, 0, 0, event->cols};
+  size_t current = 0;
+  int reserved = 0; // Set once a reserved seat ends the leading run
+
+  for (size_t i = 0; words != NULL && i < event->row_words; i++) {
+    uint64_t word = atomic_load_explicit(&words[i], memory_order_relaxed);
+    size_t valid = event->cols - i * 64 < 64 ? event->cols - i * 64 : 64;
+    size_t pos = 0;
+
+    while (pos < valid) {
+      uint64_t rest = word >> pos;
+      size_t zeros = rest == 0 ? 64 - pos : (size_t)__builtin_ctzll(rest);
+      if (zeros > valid - pos)
+        zeros = valid - pos;
+      current += zeros;
+      pos += zeros;
+      if (pos >= valid)
         break;
+
+      if (!reserved) {
+        runs.head = current;
+        reserved = 1;
       }
+      runs.longest = current > runs.longest ? current : runs.longest;
+      current = 0;
+      rest = word >> pos;
+      pos += ~rest == 0 ? 64 - pos : (size_t)__builtin_ctzll(~rest);
     }
+  }
 
-    if (bytes_written == 0) {
-      break;
+  // A row whose group was never allocated is one run of free seats
+  if (words == NULL)
+    current = event->cols;
+  if (!reserved)
+    runs.head = current;
+  runs.tail = current;
+  runs.longest = current > runs.longest ? current : runs.longest;
+  runs.row_longest = runs.longest;
+  return runs;
+}
+
+/// Combines the runs of two adjacent ranges of rows.
+/// @param left Runs of the first range.
+/// @param right Runs of the range right after it.
+/// @return Runs of both ranges together.
+static struct FreeRuns merge_runs(const struct FreeRuns *left,
+                                  const struct FreeRuns *right) {
+  struct FreeRuns runs;
+  size_t across = left->tail + right->head;
+
+  runs.head =
+      left->head == left->length ? left->length + right->head : left->head;
+  runs.tail =
+      right->tail == right->length ? right->length + left->tail : right->tail;
+  runs.longest = left->longest > right->longest ? left->longest
+                                                : right->longest;
+  runs.longest = across > runs.longest ? across : runs.longest;
+  runs.row_longest = left->row_longest > right->row_longest
+                         ? left->row_longest
+                         : right->row_longest;
+  runs.length = left->length + right->length;
+  return runs;
+}
+
+/// Builds the free run tree of an event from its occupancy bitmap.
+/// @note Only called before the event is shared.
+/// @param event Event whose free_runs array is allocated.
+static void build_free_runs(struct Event *event) {
+  struct FreeRuns *tree = event->free_runs;
+
+  // Leaves past the last row hold no seats, so they merge as nothing
+  for (size_t leaf = 0; leaf < event->runs_leaves; leaf++) {
+    struct FreeRuns empty = {0, 0, 0, 0, 0};
+    tree[event->runs_leaves + leaf] =
+        leaf < event->rows ? measure_row(event, leaf) : empty;
+  }
+  for (size_t node = event->runs_leaves - 1; node > 0; node--) {
+    tree[node] = merge_runs(&tree[2 * node], &tree[2 * node + 1]);
+  }
+}
+
+/// Refreshes the free run index of the rows holding some seats.
+/// @note The seat locks of every row involved must be held for writing.
+/// @param event Event the seats belong to.
+/// @param num_seats Number of seats.
+/// @param indices Sorted array of seat indices.
+static void refresh_free_runs(struct Event *event, size_t num_seats,
+                              const size_t *indices) {
+  struct FreeRuns *tree = event->free_runs;
+
+  pthread_rwlock_wrlock(&event->runs_lock);
+  // The indices are sorted, so each row shows up as one contiguous group
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t row = indices[i] / event->cols;
+    if (i > 0 && row == indices[i - 1] / event->cols)
+      continue;
+
+    size_t node = event->runs_leaves + row;
+    tree[node] = measure_row(event, row);
+    atomic_store_explicit(&event->max_free_run[row], tree[node].row_longest,
+                          memory_order_relaxed);
+    for (node /= 2; node > 0; node /= 2) {
+      tree[node] = merge_runs(&tree[2 * node], &tree[2 * node + 1]);
+    }
+  }
+  pthread_rwlock_unlock(&event->runs_lock);
+}
+
+/// Finds the first run of adjacent free seats of an event in the free run
+/// tree, in a single row if there is one and otherwise, unless same_row is
+/// set, across rows.
+/// @note Reads the bitmap without seat locks, the run must be checked again
+/// once they are held.
+/// @param event Event to search.
+/// @param num_seats Length of the run.
+/// @param same_row Nonzero if the run must be within a single row.
+/// @return Index of the first seat of the run, SIZE_MAX if there is none.
+static size_t find_free_run(struct Event *event, size_t num_seats,
+                            int same_row) {
+  const struct FreeRuns *tree = event->free_runs;
+  size_t node = 1;
+  size_t offset = 0; // Index of the first seat covered by node
+  size_t start = SIZE_MAX;
+
+  pthread_rwlock_rdlock(&event->runs_lock);
+  int in_row = tree[1].row_longest >= num_seats;
+  if (in_row) {
+    // Goes down to the first row holding such a run
+    while (node < event->runs_leaves) {
+      node *= 2;
+      if (tree[node].row_longest < num_seats) {
+        offset += tree[node].length;
+        node++;
+      }
+    }
+  } else if (!same_row && tree[1].longest >= num_seats) {
+    // No row holds the run, so it starts in the tail of a left subtree and
+    // goes on into the head of its right sibling
+    while (start == SIZE_MAX && node < event->runs_leaves) {
+      const struct FreeRuns *left = &tree[2 * node];
+      if (left->longest >= num_seats) {
+        node = 2 * node;
+      } else if (left->tail + tree[2 * node + 1].head >= num_seats) {
+        start = offset + left->length - left->tail;
+      } else {
+        offset += left->length;
+        node = 2 * node + 1;
+      }
+    }
+  }
+  pthread_rwlock_unlock(&event->runs_lock);
+
+  // Reached a row holding the run, finds its column
+  if (in_row) {
+    size_t col = 0;
+    scan_free_run(event, node - event->runs_leaves, num_seats, &col);
+    start = offset + col;
+  }
+  return start;
+}
+
+/// Gives back the id of a reservation that failed, so the next one takes
+/// it. Once a later id was taken, it is left unused instead.
+/// @param event Event the id was taken from.
+/// @param reservation_id Id taken by the failed reservation.
+static void release_id(struct Event *event, unsigned int reservation_id) {
+  unsigned int taken = reservation_id;
+  atomic_compare_exchange_strong(&event->reservations, &taken,
+                                 reservation_id - 1);
+}
+
+/// Commits a validated reservation, appending it to the log first.
+/// @note The seat locks of every row involved must be held for writing.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats.
+/// @param indices Sorted array of distinct seat indices, all free.
+/// @param lsn Pointer to the variable to store the position of the log
+/// record in, to be passed to wal_sync once the locks are released.
+/// @return 0 if the seats were reserved, 1 if the reservation could not be
+/// recorded or logged, 2 if its id does not fit in the seats until they are
+/// widened (no seat is reserved).
+static int commit_seats(struct Event *event, size_t num_seats,
+                        size_t *indices, uint64_t *lsn) {
+  if (touch_seats(event, num_seats, indices) != 0)
+    return 1;
+
+  // The width only changes under the event lock, which is held, so an id
+  // is only taken if it fits
+  unsigned int limit = seat_grid_limit(event->seats.width);
+  unsigned int reservation_id = atomic_load(&event->reservations);
+  do {
+    if (reservation_id >= limit)
+      return 2;
+  } while (!atomic_compare_exchange_weak(&event->reservations, &reservation_id,
+                                         reservation_id + 1));
+  reservation_id++;
+
+  if (ledger_add(&event->ledger, reservation_id, num_seats, indices) != 0) {
+    release_id(event, reservation_id);
+    return 1;
+  }
+
+  // Records on the same seats reach the log in the order they were made,
+  // since the seat locks are held
+  if (wal_log_reserve(event->id, reservation_id, num_seats, indices, lsn) !=
+      0) {
+    ledger_drop(&event->ledger, reservation_id);
+    release_id(event, reservation_id);
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    uint64_t bit;
+    _Atomic uint64_t *word = occupancy_word(event, indices[i], &bit);
+    atomic_fetch_or_explicit(word, bit, memory_order_relaxed);
+    set_seat_with_delay(event, indices[i], reservation_id);
+  }
+
+  refresh_free_runs(event, num_seats, indices);
+  return 0;
+}
+
+/// Orders seat indices for qsort.
+static int compare_indices(const void *a, const void *b) {
+  size_t left = *(const size_t *)a;
+  size_t right = *(const size_t *)b;
+  return (left > right) - (left < right);
+}
+
+/// Gets the seat lock covering a row.
+/// @param event Event the row belongs to.
+/// @param row Row of the seat, must be valid.
+/// @return Index of the seat lock in event->row_locks.
+static size_t row_lock_index(struct Event *event, size_t row) {
+  return (row - 1) % event->num_row_locks;
+}
+
+/// Gets the set of seat locks needed to access the given seats.
+/// @note Rows outside of the event are skipped, they are rejected later.
+/// @param event Event the seats belong to.
+/// @param num_seats Number of seats.
+/// @param xs Array of rows of the seats.
+/// @return Bitmask with bit i set if event->row_locks[i] is needed.
+static uint64_t row_lock_mask(struct Event *event, size_t num_seats,
+                              size_t *xs) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (xs[i] > 0 && xs[i] <= event->rows) {
+      mask |= UINT64_C(1) << row_lock_index(event, xs[i]);
     }
+  }
+  return mask;
+}
+
+/// Gets the set of all seat locks of an event.
+/// @param event Event to get the seat locks of.
+/// @return Bitmask with one bit set per seat lock.
+static uint64_t all_rows_mask(struct Event *event) {
+  if (event->num_row_locks >= 64)
+    return UINT64_MAX;
+  return (UINT64_C(1) << event->num_row_locks) - 1;
+}
 
-    total_written += bytes_written;
+/// Releases the seat locks in a set, without recording how long they were
+/// held, for lock_rows to undo a partial acquisition.
+/// @param event Event the seat locks belong to.
+/// @param mask Set of seat locks to release.
+static void release_rows(struct Event *event, uint64_t mask) {
+  for (size_t i = 0; i < event->num_row_locks; i++) {
+    if (mask & (UINT64_C(1) << i)) {
+      pthread_rwlock_unlock(&event->row_locks[i]);
+    }
   }
+}
 
-  return total_written;
+/// Releases the seat locks in a set taken by lock_rows.
+/// @param event Event the seat locks belong to.
+/// @param mask Set of seat locks to release.
+static void unlock_rows(struct Event *event, uint64_t mask) {
+  release_rows(event, mask);
+  stats_record(STATS_ROWS_HOLD, rows_locked_at);
 }
 
-// Writes an unsigned int to a file descriptor
-void write_uint(int fd, unsigned int value) {
-  char buffer[2];
-  int length = 0;
+/// Acquires the seat locks in a set, always in ascending order so that
+/// concurrent reservations on overlapping rows cannot deadlock.
+/// @param event Event the seat locks belong to.
+/// @param mask Set of seat locks to acquire.
+/// @param write Nonzero to acquire the locks for writing.
+/// @return 0 if every lock was acquired, 1 otherwise (none is held).
+static int lock_rows(struct Event *event, uint64_t mask, int write) {
+  uint64_t start = stats_now();
 
-  if (value == 0) {
-    buffer[length++] = '0';
+  for (size_t i = 0; i < event->num_row_locks; i++) {
+    if (!(mask & (UINT64_C(1) << i)))
+      continue;
+
+    int result = write ? pthread_rwlock_wrlock(&event->row_locks[i])
+                       : pthread_rwlock_rdlock(&event->row_locks[i]);
+    if (result != 0) {
+      release_rows(event, mask & ((UINT64_C(1) << i) - 1));
+      return 1;
+    }
   }
-  while (value != 0) {
-    buffer[length++] = '0' + (char)(value % 10);
-    value /= 10;
+
+  stats_record(STATS_ROWS_WAIT, start);
+  rows_locked_at = stats_now();
+  return 0;
+}
+
+/// Read-locks the structure of an event.
+/// @param event Event to lock.
+/// @return 0 if the lock was acquired, nonzero otherwise.
+static int lock_event(struct Event *event) {
+  uint64_t start = stats_now();
+  int result = pthread_rwlock_rdlock(&event->rwlock);
+  stats_record(STATS_EVENT_WAIT, start);
+  return result;
+}
+
+/// Widens the seats of an event so the next reservation id fits, for a
+/// reservation that could not be committed. Takes the event lock for
+/// writing, so no lock of the event may be held.
+/// @param event Event to widen.
+/// @return 0 if the next id fits, 1 if out of memory or out of ids.
+static int widen_seats(struct Event *event) {
+  uint64_t start = stats_now();
+  if (pthread_rwlock_wrlock(&event->rwlock) != 0)
+    return 1;
+  stats_record(STATS_EVENT_WAIT, start);
+
+  // Another reservation may have widened them already
+  unsigned int next = atomic_load(&event->reservations) + 1;
+  int result =
+      next == 0 || seat_grid_fit(&event->seats, next, &event_list->arena) != 0;
+  pthread_rwlock_unlock(&event->rwlock);
+  return result;
+}
+
+/// Gets the set of seat locks needed to access the given seats.
+/// @param event Event the seats belong to.
+/// @param num_seats Number of seats.
+/// @param indices Array of valid seat indices.
+/// @return Bitmask with bit i set if event->row_locks[i] is needed.
+static uint64_t seats_lock_mask(struct Event *event, size_t num_seats,
+                                const size_t *indices) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    mask |= UINT64_C(1) << row_lock_index(event, indices[i] / event->cols + 1);
   }
+  return mask;
+}
+
+/// Makes sure the reservations restored from a snapshot are in the event's
+/// ledger, indexing them the first time they are needed.
+/// @note The event lock must be held.
+/// @param event Event to index.
+/// @return 0 if every reservation is in the ledger, 1 otherwise.
+static int index_restored(struct Event *event) {
+  if (ledger_is_indexed(&event->ledger))
+    return 0;
+
+  // The seats must not change while they are scanned
+  if (lock_rows(event, all_rows_mask(event), 0) != 0)
+    return 1;
+  int result =
+      ledger_index(&event->ledger, &event->seats, event->rows * event->cols);
+  unlock_rows(event, all_rows_mask(event));
+  return result;
+}
+
+/// Copies the seats of a reservation out of the event's ledger.
+/// @param event Event the reservation belongs to.
+/// @param reservation_id Id of the reservation.
+/// @param local Array of MAX_RESERVATION_SIZE seats to use if large enough.
+/// @param indices Pointer to the variable to store the array holding the
+/// seats in, either local or allocated.
+/// @return Number of seats, 0 if there is no such reservation or no memory.
+static size_t copy_reservation(struct Event *event,
+                               unsigned int reservation_id, size_t *local,
+                               size_t **indices) {
+  *indices = local;
+  size_t count = ledger_copy(&event->ledger, reservation_id, local,
+                             MAX_RESERVATION_SIZE);
+  if (count <= MAX_RESERVATION_SIZE)
+    return count;
 
-  for (int i = length - 1; i >= 0; --i) {
-    safe_write(fd, &buffer[i], 1);
+  // The seats of a reservation never change, it can only be cancelled
+  if ((*indices = malloc(count * sizeof(size_t))) == NULL) {
+    *indices = local;
+    return 0;
   }
+  return ledger_copy(&event->ledger, reservation_id, *indices, count);
 }
 
 // Iitializes the EMS state
-int ems_init(unsigned int delay_ms) {
+int ems_init(unsigned int delay_ms, size_t cache_lines) {
   if (event_list != NULL) {
     fprintf(stderr, "EMS state has already been initialized\n");
     return 1;
   }
 
+  if (cache_init(&state_cache, cache_lines) != 0)
+    return 1;
+
   event_list = create_list();
   state_access_delay_ms = delay_ms;
 
-  return event_list == NULL;
+  if (event_list == NULL) {
+    cache_destroy(&state_cache);
+    return 1;
+  }
+  return 0;
 }
 
 // Terminates the EMS state
@@ -122,125 +712,320 @@ int ems_terminate() {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
+
+  // Dirty lines are written back before the state they cache goes away
+  struct timespec delay = delay_to_timespec(state_access_delay_ms);
+  for (size_t i = cache_flush(&state_cache); i > 0; i--) {
+    nanosleep(&delay, NULL);
+  }
+  cache_destroy(&state_cache);
+
   free_list(event_list);
+  event_list = NULL;
+  // Mapped events have just been freed, so nothing points into it anymore
+  snapshot_unmap(&restored);
   return 0;
 }
 
-// Creates a new event
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
-    return 1;
-  }
+/// Reserves room for an array in a block, on cache lines of its own.
+/// @param offset Pointer to the size of the block so far, grown to hold the
+/// array.
+/// @param size Size of the array in bytes.
+/// @return Offset of the array in the block, 0 if the block would overflow.
+static size_t add_section(size_t *offset, size_t size) {
+  size_t start = (*offset + MEM_CACHE_LINE - 1) & ~(size_t)(MEM_CACHE_LINE - 1);
+  if (start < *offset || size > SIZE_MAX - start)
+    return 0;
+  *offset = start + size;
+  return start;
+}
 
-  if (get_event_with_delay(event_id) != NULL) {
-    fprintf(stderr, "Event already exists\n");
-    return 1;
+/// Gets the number of groups of an event's occupancy bitmap.
+/// @param event Event with its dimensions set.
+/// @return Number of groups.
+static size_t bitmap_groups(struct Event *event) {
+  return event->rows / event->group_rows +
+         (event->rows % event->group_rows != 0);
+}
+
+/// Places every group of an event's occupancy bitmap in contiguous words,
+/// such as a snapshot mapping or memory allocated along with the event.
+/// @param event Event to place the bitmap of.
+/// @param words Bitmap of every row, rows * row_words words.
+static void place_bitmap(struct Event *event, char *words) {
+  for (size_t group = 0; group < bitmap_groups(event); group++) {
+    atomic_store_explicit(
+        &event->occupied[group],
+        (_Atomic uint64_t *)(words + group * event->group_rows *
+                                         event->row_words * sizeof(uint64_t)),
+        memory_order_relaxed);
   }
+}
 
-  struct Event *event = malloc(sizeof(struct Event)); // check malloc
+/// Allocates an event in a single block of the list's arena: the event,
+/// then its seat locks, its seat tiles and bitmap groups, its free run tree
+/// and, unless they are mapped from elsewhere, its free runs. An event with a single tile
+/// or bitmap group also keeps it in the block, larger ones allocate theirs
+/// on the first reservation in them. The block starts zeroed, so every seat
+/// is free. Locks and ledger are not initialized.
+/// @param event_id Id of the event.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+/// @param seat_width Bytes per seat, 0 if the seats, bitmap and free runs
+/// are mapped and placed by the caller.
+/// @return Pointer to the event, NULL if it is too large or out of memory.
+static struct Event *alloc_event(unsigned int event_id, size_t num_rows,
+                                 size_t num_cols, unsigned int seat_width) {
+  size_t sizes[3];
+  size_t num_row_locks =
+      num_rows < EVENT_LOCK_STRIPES ? num_rows : EVENT_LOCK_STRIPES;
+  size_t row_words = (num_cols + 63) / 64;
+  size_t group_rows = row_words == 0 || row_words >= BITMAP_GROUP_WORDS
+                          ? 1
+                          : BITMAP_GROUP_WORDS / row_words;
+  size_t num_groups = num_rows / group_rows + (num_rows % group_rows != 0);
+  size_t runs_leaves = 1;
+  size_t size = sizeof(struct Event);
+  size_t max_free_run = 0, occupied = 0, cells = 0;
 
-  if (event == NULL) {
-    fprintf(stderr, "Error allocating memory for event\n");
-    return 1;
+  // Checks every size for the widest seats, so narrower ones fit as well
+  if (snapshot_event_sizes(num_rows, num_cols, sizes) != 0)
+    return NULL;
+  size_t num_tiles = seat_grid_num_tiles(num_rows * num_cols);
+  while (runs_leaves < num_rows) {
+    runs_leaves *= 2;
   }
+  if (runs_leaves > SIZE_MAX / 2 / sizeof(struct FreeRuns))
+    return NULL;
+  size_t row_locks =
+      add_section(&size, num_row_locks * sizeof(pthread_rwlock_t));
+  size_t tiles = add_section(&size, num_tiles * sizeof(_Atomic(void *)));
+  size_t groups =
+      add_section(&size, num_groups * sizeof(_Atomic(_Atomic uint64_t *)));
+  size_t free_runs =
+      add_section(&size, 2 * runs_leaves * sizeof(struct FreeRuns));
+  if (row_locks == 0 || tiles == 0 || groups == 0 || free_runs == 0)
+    return NULL;
+  if (seat_width > 0 &&
+      ((max_free_run = add_section(&size, sizes[2])) == 0 ||
+       (num_groups == 1 && (occupied = add_section(&size, sizes[1])) == 0) ||
+       (num_tiles == 1 &&
+        (cells = add_section(&size, num_rows * num_cols * seat_width)) == 0)))
+    return NULL;
 
+  char *block = arena_alloc(&event_list->arena, size);
+  if (block == NULL)
+    return NULL;
+
+  struct Event *event = (struct Event *)block;
   event->id = event_id;
   event->rows = num_rows;
   event->cols = num_cols;
-  event->reservations = 0;
-  event->data = malloc(num_rows * num_cols * sizeof(unsigned int));
-  event->rwlock = (pthread_rwlock_t)PTHREAD_RWLOCK_INITIALIZER;
+  event->num_row_locks = num_row_locks;
+  event->row_locks = (pthread_rwlock_t *)(block + row_locks);
+  event->row_words = row_words;
+  event->group_rows = group_rows;
+  event->occupied = (_Atomic(_Atomic uint64_t *) *)(block + groups);
+  event->free_runs = (struct FreeRuns *)(block + free_runs);
+  event->runs_leaves = runs_leaves;
+  event->mapped = seat_width == 0;
+  seat_grid_init(&event->seats, (_Atomic(void *) *)(block + tiles),
+                 num_rows * num_cols,
+                 seat_width > 0 ? seat_width : sizeof(unsigned int));
+  if (seat_width > 0) {
+    event->max_free_run = (_Atomic size_t *)(block + max_free_run);
+    if (occupied != 0) {
+      place_bitmap(event, block + occupied);
+    }
+    if (cells != 0) {
+      seat_grid_place(&event->seats, block + cells);
+    }
+  }
+  return event;
+}
 
-  if (event->data == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    free(event);
+/// Initializes the event lock, seat locks, free run lock and empty ledger of
+/// an event.
+/// @param event Event whose row_locks array is allocated.
+/// @param unindexed Number of reservations already in the seats, restored
+/// from a snapshot.
+/// @return 0 if every lock was initialized, 1 otherwise (none is left).
+static int init_event_locks(struct Event *event, unsigned int unindexed) {
+  if (mem_rwlock_init(&event->rwlock) != 0)
+    return 1;
+  if (mem_rwlock_init(&event->runs_lock) != 0) {
+    pthread_rwlock_destroy(&event->rwlock);
     return 1;
   }
 
-  if (pthread_rwlock_init(&event->rwlock, NULL) != 0) {
-    fprintf(stderr, "Error initializing rwlock\n");
-    free(event->data);
-    free(event);
+  for (size_t i = 0; i < event->num_row_locks; i++) {
+    if (mem_rwlock_init(&event->row_locks[i]) != 0) {
+      while (i-- > 0) {
+        pthread_rwlock_destroy(&event->row_locks[i]);
+      }
+      pthread_rwlock_destroy(&event->runs_lock);
+      pthread_rwlock_destroy(&event->rwlock);
+      return 1;
+    }
+  }
+
+  if (ledger_init(&event->ledger, unindexed) != 0) {
+    for (size_t i = 0; i < event->num_row_locks; i++) {
+      pthread_rwlock_destroy(&event->row_locks[i]);
+    }
+    pthread_rwlock_destroy(&event->runs_lock);
+    pthread_rwlock_destroy(&event->rwlock);
     return 1;
   }
+  return 0;
+}
 
-  for (size_t i = 0; i < num_rows * num_cols; i++) {
-    event->data[i] = 0;
+/// Allocates and initializes an event with every seat free. The event is
+/// not added to any list.
+/// @param event_id Id of the event.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+/// @return Pointer to the event, NULL on failure.
+static struct Event *new_event(unsigned int event_id, size_t num_rows,
+                               size_t num_cols) {
+  size_t sizes[3];
+  if (snapshot_event_sizes(num_rows, num_cols, sizes) != 0) {
+    fprintf(stderr, "Invalid event dimensions\n");
+    return NULL;
   }
 
-  if (append_to_list(event_list, event) != 0) {
-    fprintf(stderr, "Error appending event to list\n");
-    free(event->data);
-    free(event);
-    return 1;
+  // No id has been handed out yet, so the seats start as narrow as they go
+  struct Event *event =
+      alloc_event(event_id, num_rows, num_cols, seat_width_for(0));
+
+  if (event == NULL) {
+    fprintf(stderr, "Error allocating memory for event\n");
+    return NULL;
   }
 
-  return 0;
+  atomic_init(&event->reservations, 0);
+  if (init_event_locks(event, 0) != 0) {
+    fprintf(stderr, "Error initializing rwlock\n");
+    arena_free(&event_list->arena, event);
+    return NULL;
+  }
+
+  // Every row starts out as a single run of free seats, the seats and bitmap
+  // are already zeroed
+  for (size_t i = 0; i < num_rows; i++) {
+    atomic_init(&event->max_free_run[i], num_cols);
+  }
+  build_free_runs(event);
+
+  return event;
 }
 
-// Reserves seats for an event
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs,
-                size_t *ys) {
+// Creates a new event
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  struct Event *event = get_event_with_delay(event_id);
+  if (get_event_with_delay(event_id) != NULL) {
+    fprintf(stderr, "Event already exists\n");
+    return 1;
+  }
 
+  struct Event *event = new_event(event_id, num_rows, num_cols);
   if (event == NULL) {
-    fprintf(stderr, "Event not found\n");
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event->rwlock) != 0) {
-    fprintf(stderr, "Error locking event\n");
+  // Creations are serialized, so an event is only made visible once it is
+  // in the log, and no reservation on it can be logged before it
+  if (pthread_rwlock_wrlock(&event_list->create_lock) != 0) {
+    fprintf(stderr, "Error locking event list\n");
+    free_event(event_list, event);
     return 1;
   }
 
-  unsigned int reservation_id = ++event->reservations;
+  // Another thread may have created the same event since the check above
+  uint64_t lsn;
+  int result = 0;
+  if (get_event(event_list, event_id) != NULL) {
+    fprintf(stderr, "Event already exists\n");
+    result = 1;
+  } else if (wal_log_create(event_id, num_rows, num_cols, &lsn) != 0) {
+    fprintf(stderr, "Error writing log\n");
+    result = 1;
+  } else if (append_to_list(event_list, event) != 0) {
+    fprintf(stderr, "Error appending event to list\n");
+    result = 1;
+  }
+  pthread_rwlock_unlock(&event_list->create_lock);
 
-  size_t i = 0;
-  for (; i < num_seats; i++) {
-    size_t row = xs[i];
-    size_t col = ys[i];
+  if (result != 0) {
+    free_event(event_list, event);
+    return 1;
+  }
 
-    if (row <= 0 || row > event->rows || col <= 0 || col > event->cols) {
-      fprintf(stderr, "Invalid seat\n");
-      break;
-    }
-    unsigned int *seat =
-        get_seat_with_delay(event, seat_index(event, row, col));
-    if (*seat != 0) {
+  // Other creations go on while the record is synced. The record is already
+  // in the file ahead of any reservation in the event, and syncing one of
+  // those makes it durable too.
+  if (wal_sync(lsn) != 0) {
+    fprintf(stderr, "Error writing log\n");
+    return 1;
+  }
+  return 0;
+}
+
+/// Reserves validated seats of an event, taking its locks.
+/// @param event Event to reserve the seats in.
+/// @param rows_mask Seat locks covering the seats.
+/// @param num_seats Number of seats.
+/// @param indices Sorted array of distinct seat indices.
+/// @param lsn Pointer to the variable to store the position of the log
+/// record in.
+/// @return 0 if the seats were reserved, 1 if not, 2 if the seats of the
+/// event must be widened first. No lock is left held.
+static int try_reserve(struct Event *event, uint64_t rows_mask,
+                       size_t num_seats, size_t *indices, uint64_t *lsn) {
+  // The event lock is shared, reservations only exclude each other through
+  // the seat locks of the rows they touch
+  if (lock_event(event) != 0) {
+    fprintf(stderr, "Error locking event\n");
+    return 1;
+  }
+
+  if (lock_rows(event, rows_mask, 1) != 0) {
+    fprintf(stderr, "Error locking seats\n");
+    pthread_rwlock_unlock(&event->rwlock);
+    return 1;
+  }
+
+  // Checks every seat against the occupancy bitmap, so a conflict is found
+  // without touching the seat array and nothing has to be rolled back
+  int result = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (seat_reserved(event, indices[i])) {
       fprintf(stderr, "Seat already reserved\n");
+      result = 1;
       break;
     }
-
-    *seat = reservation_id;
   }
 
-  // If the reservation was not successful, free the seats that were reserved.
-  if (i < num_seats) {
-    event->reservations--;
-    for (size_t j = 0; j < i; j++) {
-      *get_seat_with_delay(event, seat_index(event, xs[j], ys[j])) = 0;
-    }
-    if (pthread_rwlock_unlock(&event->rwlock) != 0) {
-      fprintf(stderr, "Error unlocking event\n");
-      return 1;
-    }
-    return 1;
+  if (result == 0 &&
+      (result = commit_seats(event, num_seats, indices, lsn)) == 1) {
+    fprintf(stderr, "Error recording reservation\n");
   }
+
+  unlock_rows(event, rows_mask);
   if (pthread_rwlock_unlock(&event->rwlock) != 0) {
     fprintf(stderr, "Error unlocking event\n");
     return 1;
   }
-  return 0;
+  return result;
 }
 
-// Shows the seats of an event
-int ems_show(unsigned int event_id, int fd) {
+// Reserves seats for an event
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs,
+                size_t *ys) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
@@ -253,59 +1038,689 @@ int ems_show(unsigned int event_id, int fd) {
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event->rwlock) != 0) {
-    fprintf(stderr, "Error locking event\n");
-    return 1;
+  // Validates the coordinates before taking any lock, the dimensions of an
+  // event never change
+  size_t local_indices[MAX_RESERVATION_SIZE];
+  size_t *indices = local_indices;
+  if (num_seats > MAX_RESERVATION_SIZE) {
+    indices = malloc(num_seats * sizeof(size_t));
+    if (indices == NULL) {
+      fprintf(stderr, "Error allocating memory for reservation\n");
+      return 1;
+    }
   }
-  for (size_t i = 1; i <= event->rows; i++) {
-    for (size_t j = 1; j <= event->cols; j++) {
-      unsigned int *seat = get_seat_with_delay(event, seat_index(event, i, j));
-      write_uint(fd, *seat);
 
-      if (j < event->cols) {
-        safe_write(fd, " ", 1);
-      }
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t row = xs[i];
+    size_t col = ys[i];
+
+    if (row <= 0 || row > event->rows || col <= 0 || col > event->cols) {
+      fprintf(stderr, "Invalid seat\n");
+      if (indices != local_indices)
+        free(indices);
+      return 1;
     }
+    indices[i] = seat_index(event, row, col);
+  }
 
-    safe_write(fd, "\n", 1);
+  // Sorting visits the seats in memory order and lets repeated coordinates
+  // collapse into a single seat
+  qsort(indices, num_seats, sizeof(size_t), compare_indices);
+  size_t num_unique = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (num_unique == 0 || indices[i] != indices[num_unique - 1]) {
+      indices[num_unique++] = indices[i];
+    }
   }
-  if (pthread_rwlock_unlock(&event->rwlock) != 0) {
-    fprintf(stderr, "Error unlocking event\n");
+
+  // Only a reservation whose id outgrows the seats has to try again
+  uint64_t rows_mask = row_lock_mask(event, num_seats, xs);
+  uint64_t lsn = 0;
+  int result = try_reserve(event, rows_mask, num_unique, indices, &lsn);
+  while (result == 2) {
+    if (widen_seats(event) != 0) {
+      fprintf(stderr, "Error allocating memory for seats\n");
+      result = 1;
+    } else {
+      result = try_reserve(event, rows_mask, num_unique, indices, &lsn);
+    }
+  }
+
+  if (indices != local_indices)
+    free(indices);
+
+  // Waits for the log without holding any lock, so other reservations can
+  // join the same group
+  if (wal_sync(lsn) != 0) {
+    fprintf(stderr, "Error writing log\n");
     return 1;
   }
-  return 0;
+  return result;
 }
 
-// Lists all events
-int ems_list_events(int fd) {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
-    return 1;
+/// Renders seats as space-separated (row,column) pairs on one line.
+/// @param event Event the seats belong to.
+/// @param num_seats Number of seats.
+/// @param indices Array of seat indices.
+/// @param out Buffer to render the seats in.
+/// @return 0 if the seats were rendered, 1 if out of memory.
+static int render_seats(struct Event *event, size_t num_seats,
+                        const size_t *indices, struct Buffer *out) {
+  int failed = 0;
+
+  for (size_t i = 0; i < num_seats; i++) {
+    failed |= buffer_append(out, i > 0 ? " (" : "(", i > 0 ? 2 : 1);
+    failed |=
+        buffer_append_uint(out, (unsigned int)(indices[i] / event->cols + 1));
+    failed |= buffer_append(out, ",", 1);
+    failed |=
+        buffer_append_uint(out, (unsigned int)(indices[i] % event->cols + 1));
+    failed |= buffer_append(out, ")", 1);
+  }
+  failed |= buffer_append(out, "\n", 1);
+  return failed;
+}
+
+/// Reserves the best available adjacent seats of an event, taking its locks.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats to reserve.
+/// @param same_row Nonzero if the seats must all be in the same row.
+/// @param indices Array to store the indices of the reserved seats in.
+/// @param lsn Pointer to the variable to store the position of the log
+/// record in.
+/// @return 0 if the seats were reserved, 1 if there are not enough of them,
+/// -1 if the reservation could not be logged, -2 if the seats of the event
+/// must be widened first, 2 if a lock failed (already reported). No lock is
+/// left held.
+static int try_reserve_best(struct Event *event, size_t num_seats,
+                            int same_row, size_t *indices, uint64_t *lsn) {
+  if (lock_event(event) != 0) {
+    fprintf(stderr, "Error locking event\n");
+    return 2;
+  }
+
+  // The tree finds the run without scanning the rows, and only the seat
+  // locks of its rows are taken. A reservation may take some of its seats
+  // before they are, then the tree has been refreshed and is searched again.
+  int result = 3;
+  while (result == 3) {
+    size_t start = find_free_run(event, num_seats, same_row);
+    if (start == SIZE_MAX) {
+      result = 1;
+      break;
+    }
+
+    for (size_t i = 0; i < num_seats; i++) {
+      indices[i] = start + i;
+    }
+    uint64_t rows_mask = seats_lock_mask(event, num_seats, indices);
+    if (lock_rows(event, rows_mask, 1) != 0) {
+      fprintf(stderr, "Error locking seats\n");
+      result = 2;
+      break;
+    }
+
+    result = 0;
+    for (size_t i = 0; i < num_seats && result == 0; i++) {
+      result = seat_reserved(event, indices[i]) ? 3 : 0;
+    }
+    if (result == 0) {
+      result = -commit_seats(event, num_seats, indices, lsn);
+    }
+    unlock_rows(event, rows_mask);
+  }
+
+  if (pthread_rwlock_unlock(&event->rwlock) != 0) {
+    fprintf(stderr, "Error unlocking event\n");
+    return 2;
+  }
+  return result;
+}
+
+// Reserves the best available adjacent seats of an event
+int ems_reserve_best(unsigned int event_id, size_t num_seats, int same_row,
+                     struct Buffer *out) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE) {
+    fprintf(stderr, "Invalid number of seats\n");
+    return 1;
+  }
+
+  struct Event *event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  // Only a reservation whose id outgrows the seats has to try again
+  size_t indices[MAX_RESERVATION_SIZE];
+  uint64_t lsn = 0;
+  int result = try_reserve_best(event, num_seats, same_row, indices, &lsn);
+  while (result == -2) {
+    result = widen_seats(event) != 0
+                 ? -1
+                 : try_reserve_best(event, num_seats, same_row, indices, &lsn);
+  }
+
+  if (result > 1)
+    return 1;
+  if (result != 0) {
+    fprintf(stderr, result == 1 ? "Not enough free seats\n"
+                                : "Error recording reservation\n");
+    return 1;
+  }
+  if (wal_sync(lsn) != 0) {
+    fprintf(stderr, "Error writing log\n");
+    return 1;
+  }
+
+  // The reservation is committed, only its report can still fail
+  if (render_seats(event, num_seats, indices, out) != 0) {
+    fprintf(stderr, "Error allocating memory for output\n");
+    return 1;
+  }
+  return 0;
+}
+
+/// Validates the seats of one event of a reservation across several events.
+/// @param event Event the seats belong to.
+/// @param num_seats Number of seats.
+/// @param xs Array of rows of the seats.
+/// @param ys Array of columns of the seats.
+/// @param indices Array to store the sorted, distinct seat indices in.
+/// @return Number of distinct seats, 0 if a seat is outside of the event.
+static size_t multi_indices(struct Event *event, size_t num_seats,
+                            const size_t *xs, const size_t *ys,
+                            size_t *indices) {
+  for (size_t i = 0; i < num_seats; i++) {
+    if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 ||
+        ys[i] > event->cols)
+      return 0;
+    indices[i] = seat_index(event, xs[i], ys[i]);
+  }
+
+  qsort(indices, num_seats, sizeof(size_t), compare_indices);
+  size_t num_unique = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (num_unique == 0 || indices[i] != indices[num_unique - 1]) {
+      indices[num_unique++] = indices[i];
+    }
+  }
+  return num_unique;
+}
+
+/// Commits a reservation across several events, all of it or none.
+/// @note The event lock of every event must be held for writing, which
+/// keeps every other command out of them, so their seats can be widened in
+/// place and their next reservation ids are known.
+/// @param num_parts Number of events.
+/// @param events Array of the events.
+/// @param parts Array of the parts of the reservation, their reservation
+/// ids are set here.
+/// @param lsn Pointer to the variable to store the position of the log
+/// record in.
+/// @return 0 if every seat was reserved, 1 if none was (already reported).
+static int commit_multi(size_t num_parts, struct Event **events,
+                        struct WalPart *parts, uint64_t *lsn) {
+  // Every check and allocation happens before anything is visible
+  for (size_t i = 0; i < num_parts; i++) {
+    for (size_t j = 0; j < parts[i].num_seats; j++) {
+      if (seat_reserved(events[i], parts[i].indices[j])) {
+        fprintf(stderr, "Seat already reserved\n");
+        return 1;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < num_parts; i++) {
+    struct Event *event = events[i];
+    parts[i].reservation = atomic_load(&event->reservations) + 1;
+    if (parts[i].reservation == 0 ||
+        seat_grid_fit(&event->seats, parts[i].reservation,
+                      &event_list->arena) != 0 ||
+        touch_seats(event, parts[i].num_seats, parts[i].indices) != 0) {
+      fprintf(stderr, "Error allocating memory for seats\n");
+      return 1;
+    }
+  }
+
+  size_t added = 0;
+  while (added < num_parts &&
+         ledger_add(&events[added]->ledger, parts[added].reservation,
+                    parts[added].num_seats, parts[added].indices) == 0) {
+    added++;
+  }
+  if (added < num_parts ||
+      wal_log_reserve_multi(num_parts, parts, lsn) != 0) {
+    while (added > 0) {
+      added--;
+      ledger_drop(&events[added]->ledger, parts[added].reservation);
+    }
+    fprintf(stderr, "Error recording reservation\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_parts; i++) {
+    struct Event *event = events[i];
+    atomic_store(&event->reservations, parts[i].reservation);
+    for (size_t j = 0; j < parts[i].num_seats; j++) {
+      uint64_t bit;
+      _Atomic uint64_t *word = occupancy_word(event, parts[i].indices[j], &bit);
+      atomic_fetch_or_explicit(word, bit, memory_order_relaxed);
+      set_seat_with_delay(event, parts[i].indices[j], parts[i].reservation);
+    }
+    refresh_free_runs(event, parts[i].num_seats, parts[i].indices);
+  }
+  return 0;
+}
+
+// Reserves seats in several events at once
+int ems_reserve_multi(size_t num_events, const unsigned int *event_ids,
+                      const size_t *event_seats, size_t *xs, size_t *ys) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  if (num_events == 0 || num_events > MAX_MULTI_EVENTS) {
+    fprintf(stderr, "Invalid number of events\n");
+    return 1;
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < num_events; i++) {
+    if (event_seats[i] == 0) {
+      fprintf(stderr, "Invalid number of seats\n");
+      return 1;
+    }
+    total += event_seats[i];
+  }
+
+  size_t local_indices[MAX_RESERVATION_SIZE];
+  size_t *indices = local_indices;
+  if (total > MAX_RESERVATION_SIZE) {
+    indices = malloc(total * sizeof(size_t));
+    if (indices == NULL) {
+      fprintf(stderr, "Error allocating memory for reservation\n");
+      return 1;
+    }
+  }
+
+  // Every event is looked up and every seat validated before any lock is
+  // taken, the dimensions of an event never change
+  struct Event *events[MAX_MULTI_EVENTS];
+  struct WalPart parts[MAX_MULTI_EVENTS];
+  size_t first = 0;
+  int result = 0;
+  for (size_t i = 0; i < num_events && result == 0; i++) {
+    events[i] = get_event_with_delay(event_ids[i]);
+    parts[i].event_id = event_ids[i];
+    parts[i].indices = indices + first;
+
+    if (events[i] == NULL) {
+      fprintf(stderr, "Event not found\n");
+      result = 1;
+    } else if ((parts[i].num_seats =
+                    multi_indices(events[i], event_seats[i], xs + first,
+                                  ys + first, indices + first)) == 0) {
+      fprintf(stderr, "Invalid seat\n");
+      result = 1;
+    }
+    first += event_seats[i];
+
+    // Orders the events by id as they come, so they are locked in the same
+    // order by every reservation and none can deadlock
+    for (size_t j = i; result == 0 && j > 0; j--) {
+      if (parts[j - 1].event_id < parts[j].event_id)
+        break;
+      if (parts[j - 1].event_id == parts[j].event_id) {
+        fprintf(stderr, "Event repeated in reservation\n");
+        result = 1;
+        break;
+      }
+      struct Event *event = events[j];
+      struct WalPart part = parts[j];
+      events[j] = events[j - 1];
+      parts[j] = parts[j - 1];
+      events[j - 1] = event;
+      parts[j - 1] = part;
+    }
+  }
+
+  // A snapshot waits for the whole reservation, or it waits for the snapshot
+  int bundled = 0;
+  if (result == 0) {
+    if (pthread_rwlock_rdlock(&event_list->multi_lock) != 0) {
+      fprintf(stderr, "Error locking list rwlock\n");
+      result = 1;
+    } else {
+      bundled = 1;
+    }
+  }
+
+  size_t locked = 0;
+  for (; result == 0 && locked < num_events; locked++) {
+    uint64_t start = stats_now();
+    if (pthread_rwlock_wrlock(&events[locked]->rwlock) != 0) {
+      fprintf(stderr, "Error locking event\n");
+      result = 1;
+      break;
+    }
+    stats_record(STATS_EVENT_WAIT, start);
+  }
+
+  uint64_t lsn = 0;
+  if (result == 0) {
+    result = commit_multi(num_events, events, parts, &lsn);
+  }
+  while (locked > 0) {
+    pthread_rwlock_unlock(&events[--locked]->rwlock);
+  }
+  if (bundled) {
+    pthread_rwlock_unlock(&event_list->multi_lock);
+  }
+
+  if (indices != local_indices)
+    free(indices);
+
+  if (wal_sync(lsn) != 0) {
+    fprintf(stderr, "Error writing log\n");
+    return 1;
+  }
+  return result;
+}
+
+// Shows the seats of an event
+int ems_show(unsigned int event_id, struct Buffer *out) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event *event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  if (lock_event(event) != 0) {
+    fprintf(stderr, "Error locking event\n");
+    return 1;
+  }
+
+  // Holding every seat lock gives a consistent view of the whole event, and
+  // keeps its set of tiles fixed
+  if (lock_rows(event, all_rows_mask(event), 0) != 0) {
+    fprintf(stderr, "Error locking seats\n");
+    pthread_rwlock_unlock(&event->rwlock);
+    return 1;
+  }
+
+  // The snapshot has the width and the tiles of the seats, every other seat
+  // is known to be free without accessing it
+  struct SeatGrid snapshot;
+  int cloned = seat_grid_clone(&snapshot, &event->seats) == 0;
+  size_t num_tiles = cloned ? seat_grid_num_tiles(snapshot.num_seats) : 0;
+  for (size_t tile = 0; tile < num_tiles; tile++) {
+    if (!seat_grid_has_tile(&snapshot, tile))
+      continue;
+    size_t end = (tile + 1) * SEAT_TILE_SEATS;
+    end = end < snapshot.num_seats ? end : snapshot.num_seats;
+    for (size_t i = tile * SEAT_TILE_SEATS; i < end; i++) {
+      seat_grid_set(&snapshot, i, get_seat_with_delay(event, i));
+    }
+  }
+  unlock_rows(event, all_rows_mask(event));
+  if (pthread_rwlock_unlock(&event->rwlock) != 0) {
+    fprintf(stderr, "Error unlocking event\n");
+    if (cloned)
+      seat_grid_free(&snapshot);
+    return 1;
+  }
+  if (!cloned) {
+    fprintf(stderr, "Error allocating memory for snapshot\n");
+    return 1;
+  }
+
+  // Renders the snapshot without holding any lock
+  int failed = seat_grid_render(&snapshot, event->rows, event->cols, out);
+  seat_grid_free(&snapshot);
+
+  if (failed) {
+    fprintf(stderr, "Error allocating memory for output\n");
+    return 1;
+  }
+  return 0;
+}
+
+/// Counts the free seats of a row from the occupancy bitmap.
+/// @note Reads the bitmap without locks, concurrent reservations may or may
+/// not be counted.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @return Number of free seats in the row.
+static size_t free_seats_in_row(struct Event *event, size_t row) {
+  _Atomic uint64_t *words = row_bitmap(event, row);
+  size_t reserved = 0;
+
+  if (words == NULL)
+    return event->cols;
+
+  // Padding bits past the last column are never set
+  for (size_t i = 0; i < event->row_words; i++) {
+    reserved += (size_t)__builtin_popcountll(
+        atomic_load_explicit(&words[i], memory_order_relaxed));
+  }
+  return event->cols - reserved;
+}
+
+// Shows the number of free seats of an event
+int ems_available(unsigned int event_id, struct Buffer *out) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event *event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  // Only the bitmap is read, so no event or seat lock is taken
+  size_t total_free = 0;
+  for (size_t i = 0; i < event->rows; i++) {
+    total_free += free_seats_in_row(event, i);
+  }
+
+  int failed = buffer_append(out, "Available: ", 11);
+  failed |= buffer_append_size(out, total_free);
+  failed |= buffer_append(out, "/", 1);
+  failed |= buffer_append_size(out, event->rows * event->cols);
+  failed |= buffer_append(out, "\n", 1);
+
+  for (size_t i = 0; i < event->rows; i++) {
+    failed |= buffer_append_size(out, free_seats_in_row(event, i));
+
+    if (i + 1 < event->rows) {
+      failed |= buffer_append(out, " ", 1);
+    }
+  }
+  failed |= buffer_append(out, "\n", 1);
+
+  if (failed) {
+    fprintf(stderr, "Error allocating memory for output\n");
+    return 1;
+  }
+  return 0;
+}
+
+// Cancels a reservation
+int ems_cancel(unsigned int event_id, unsigned int reservation_id) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event *event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  if (lock_event(event) != 0) {
+    fprintf(stderr, "Error locking event\n");
+    return 1;
+  }
+
+  size_t local_indices[MAX_RESERVATION_SIZE];
+  size_t *indices = local_indices;
+  size_t num_seats = 0;
+  int result = 1;
+  uint64_t lsn = 0;
+
+  if (index_restored(event) != 0) {
+    fprintf(stderr, "Error indexing reservations\n");
+  } else if ((num_seats = copy_reservation(event, reservation_id,
+                                           local_indices, &indices)) == 0) {
+    fprintf(stderr, "Reservation not found\n");
+  } else {
+    // Only the rows of the reservation are locked
+    uint64_t rows_mask = seats_lock_mask(event, num_seats, indices);
+    if (lock_rows(event, rows_mask, 1) != 0) {
+      fprintf(stderr, "Error locking seats\n");
+    } else {
+      // Another CANCEL may have released it since it was copied
+      if (ledger_copy(&event->ledger, reservation_id, NULL, 0) == 0) {
+        fprintf(stderr, "Reservation not found\n");
+      } else if (wal_log_cancel(event_id, reservation_id, &lsn) != 0) {
+        fprintf(stderr, "Error recording cancellation\n");
+      } else {
+        ledger_drop(&event->ledger, reservation_id);
+        for (size_t i = 0; i < num_seats; i++) {
+          uint64_t bit;
+          _Atomic uint64_t *word = occupancy_word(event, indices[i], &bit);
+          atomic_fetch_and_explicit(word, ~bit, memory_order_relaxed);
+          set_seat_with_delay(event, indices[i], 0);
+        }
+        refresh_free_runs(event, num_seats, indices);
+        result = 0;
+      }
+      unlock_rows(event, rows_mask);
+    }
+  }
+
+  if (indices != local_indices)
+    free(indices);
+  if (pthread_rwlock_unlock(&event->rwlock) != 0) {
+    fprintf(stderr, "Error unlocking event\n");
+    return 1;
+  }
+
+  if (wal_sync(lsn) != 0) {
+    fprintf(stderr, "Error writing log\n");
+    return 1;
+  }
+  return result;
+}
+
+// Shows the seats of a reservation
+int ems_show_reservation(unsigned int event_id, unsigned int reservation_id,
+                         struct Buffer *out) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event *event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  if (lock_event(event) != 0) {
+    fprintf(stderr, "Error locking event\n");
+    return 1;
+  }
+
+  // Only the ledger is read, no seat lock is held
+  size_t local_indices[MAX_RESERVATION_SIZE];
+  size_t *indices = local_indices;
+  size_t num_seats = 0;
+  int indexed = index_restored(event) == 0;
+  if (indexed) {
+    num_seats =
+        copy_reservation(event, reservation_id, local_indices, &indices);
+  }
+
+  if (pthread_rwlock_unlock(&event->rwlock) != 0) {
+    fprintf(stderr, "Error unlocking event\n");
+    if (indices != local_indices)
+      free(indices);
+    return 1;
+  }
+  if (num_seats == 0) {
+    fprintf(stderr, indexed ? "Reservation not found\n"
+                            : "Error indexing reservations\n");
+    return 1;
+  }
+
+  int failed = render_seats(event, num_seats, indices, out);
+
+  if (indices != local_indices)
+    free(indices);
+  if (failed) {
+    fprintf(stderr, "Error allocating memory for output\n");
+    return 1;
+  }
+  return 0;
+}
+
+// Lists all events
+int ems_list_events(struct Buffer *out) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
   }
   if (pthread_rwlock_rdlock(&event_list->rwlock) != 0) {
     fprintf(stderr, "Error locking event list with read lock\n");
     return 1;
   }
+  int failed = 0;
   if (event_list->head == NULL) {
-    safe_write(fd, "No events\n", 10);
+    failed = buffer_append(out, "No events\n", 10);
     if (pthread_rwlock_unlock(&event_list->rwlock) != 0) {
       fprintf(stderr, "Error unlocking event list\n");
       return 1;
     }
-    return 0;
+    return failed;
   }
 
   struct ListNode *current = event_list->head;
   while (current != NULL) {
-    safe_write(fd, "Event: ", 7);
-    write_uint(fd, (current->event)->id); // event id shouldn't have changed
-    safe_write(fd, "\n", 1);              // so we dont bother with locking
+    failed |= buffer_append(out, "Event: ", 7);
+    // event id shouldn't have changed so we dont bother with locking
+    failed |= buffer_append_uint(out, (current->event)->id);
+    failed |= buffer_append(out, "\n", 1);
     current = current->next;
   }
   if (pthread_rwlock_unlock(&event_list->rwlock) != 0) {
     fprintf(stderr, "Error unlocking event list\n");
     return 1;
   }
+  if (failed) {
+    fprintf(stderr, "Error allocating memory for output\n");
+    return 1;
+  }
   return 0;
 }
 
@@ -314,3 +1729,420 @@ void ems_wait(unsigned int delay_ms) {
   struct timespec delay = delay_to_timespec(delay_ms);
   nanosleep(&delay, NULL);
 }
+
+/// Writes the seats of an event to a snapshot as 32-bit ids, whatever their
+/// width in memory.
+/// @note The seat locks of every row must be held.
+/// @param writer Writer of the snapshot.
+/// @param event Event whose seats to write.
+static void write_seats(struct SnapshotWriter *writer, struct Event *event) {
+  unsigned int ids[1024];
+  size_t num_seats = event->rows * event->cols;
+
+  for (size_t first = 0; first < num_seats; first += 1024) {
+    size_t count = num_seats - first < 1024 ? num_seats - first : 1024;
+    seat_grid_read(&event->seats, first, count, ids);
+    snapshot_write(writer, ids, count * sizeof(unsigned int));
+  }
+}
+
+/// Writes the occupancy bitmap of an event to a snapshot, rows of groups
+/// never allocated as zeros.
+/// @note The seat locks of every row must be held.
+/// @param writer Writer of the snapshot.
+/// @param event Event whose bitmap to write.
+static void write_bitmap(struct SnapshotWriter *writer, struct Event *event) {
+  static const uint64_t zeros[BITMAP_GROUP_WORDS] = {0};
+
+  for (size_t row = 0; row < event->rows; row++) {
+    _Atomic uint64_t *words = row_bitmap(event, row);
+    if (words != NULL) {
+      snapshot_write(writer, (const void *)words,
+                     event->row_words * sizeof(uint64_t));
+      continue;
+    }
+    for (size_t left = event->row_words; left > 0;) {
+      size_t count = left < BITMAP_GROUP_WORDS ? left : BITMAP_GROUP_WORDS;
+      snapshot_write(writer, zeros, count * sizeof(uint64_t));
+      left -= count;
+    }
+  }
+}
+
+// Writes every event to a snapshot file
+int ems_snapshot(const char *path) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct SnapshotWriter writer;
+  if (snapshot_begin(&writer, path) != 0) {
+    fprintf(stderr, "Error creating snapshot %s\n", path);
+    return 1;
+  }
+
+  // Reservations across several events are kept out for the whole
+  // snapshot, since it holds one event at a time and would otherwise catch
+  // some of their events before and the others after
+  if (pthread_rwlock_wrlock(&event_list->multi_lock) != 0) {
+    fprintf(stderr, "Error locking list rwlock\n");
+    writer.failed = 1;
+    snapshot_commit(&writer, path);
+    return 1;
+  }
+
+  // Holding the list lock keeps new events out, so the set of events written
+  // is fixed; other reservations only wait for the event being written
+  if (pthread_rwlock_rdlock(&event_list->rwlock) != 0) {
+    fprintf(stderr, "Error locking list rwlock\n");
+    pthread_rwlock_unlock(&event_list->multi_lock);
+    writer.failed = 1;
+    snapshot_commit(&writer, path);
+    return 1;
+  }
+
+  struct SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION,
+                                  event_list->size, 0};
+  struct SnapshotEvent *table =
+      calloc(event_list->size, sizeof(struct SnapshotEvent));
+  if (table == NULL && event_list->size > 0) {
+    fprintf(stderr, "Error allocating memory for snapshot\n");
+    pthread_rwlock_unlock(&event_list->rwlock);
+    pthread_rwlock_unlock(&event_list->multi_lock);
+    writer.failed = 1;
+    snapshot_commit(&writer, path);
+    return 1;
+  }
+
+  // Dimensions never change, so the table's offset is known up front
+  header.table_offset = (sizeof(header) + SNAPSHOT_ALIGN - 1) /
+                        SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+  for (struct ListNode *node = event_list->head; node; node = node->next) {
+    size_t sizes[3];
+    snapshot_event_sizes(node->event->rows, node->event->cols, sizes);
+    for (size_t i = 0; i < 3; i++) {
+      header.table_offset +=
+          (sizes[i] + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+    }
+  }
+
+  snapshot_write(&writer, &header, sizeof(header));
+  snapshot_align(&writer);
+
+  size_t index = 0;
+  for (struct ListNode *node = event_list->head; node; node = node->next) {
+    struct Event *event = node->event;
+    struct SnapshotEvent *saved = &table[index++];
+    size_t sizes[3];
+
+    snapshot_event_sizes(event->rows, event->cols, sizes);
+    saved->id = event->id;
+    saved->rows = event->rows;
+    saved->cols = event->cols;
+
+    // Same locks as SHOW, so every event is written in a consistent state
+    if (lock_event(event) != 0) {
+      writer.failed = 1;
+      break;
+    }
+    if (lock_rows(event, all_rows_mask(event), 0) != 0) {
+      pthread_rwlock_unlock(&event->rwlock);
+      writer.failed = 1;
+      break;
+    }
+
+    saved->reservations = atomic_load(&event->reservations);
+    saved->data = writer.offset;
+    write_seats(&writer, event);
+    snapshot_align(&writer);
+    saved->occupied = writer.offset;
+    write_bitmap(&writer, event);
+    snapshot_align(&writer);
+    saved->max_free_run = writer.offset;
+    snapshot_write(&writer, (const void *)event->max_free_run, sizes[2]);
+    snapshot_align(&writer);
+
+    unlock_rows(event, all_rows_mask(event));
+    pthread_rwlock_unlock(&event->rwlock);
+  }
+
+  if (pthread_rwlock_unlock(&event_list->rwlock) != 0) {
+    fprintf(stderr, "Error unlocking list rwlock\n");
+  }
+  pthread_rwlock_unlock(&event_list->multi_lock);
+
+  if (writer.offset != header.table_offset) {
+    writer.failed = 1;
+  }
+  snapshot_write(&writer, table, index * sizeof(struct SnapshotEvent));
+  free(table);
+
+  if (snapshot_commit(&writer, path) != 0) {
+    fprintf(stderr, "Error writing snapshot %s\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+/// Copies the seats, bitmap and free runs of an event out of the restored
+/// snapshot, allocating only the tiles and bitmap groups that hold
+/// reservations.
+/// @param event Event allocated with its seats.
+/// @param saved Entry of the event in the snapshot.
+/// @return 0 if the event was copied, 1 if out of memory.
+static int copy_restored(struct Event *event, const struct SnapshotEvent *saved) {
+  const unsigned int *ids = (const unsigned int *)(restored.map + saved->data);
+  const uint64_t *words = (const uint64_t *)(restored.map + saved->occupied);
+
+  for (size_t seat = 0; seat < event->rows * event->cols; seat++) {
+    if (ids[seat] != 0) {
+      if (touch_seats(event, 1, &seat) != 0)
+        return 1;
+      seat_grid_set(&event->seats, seat, ids[seat]);
+    }
+  }
+
+  // Rows without a reservation have no bit set
+  for (size_t row = 0; row < event->rows; row++) {
+    _Atomic uint64_t *bitmap = row_bitmap(event, row);
+    if (bitmap != NULL) {
+      memcpy((void *)bitmap, words + row * event->row_words,
+             event->row_words * sizeof(uint64_t));
+    }
+  }
+
+  memcpy((void *)event->max_free_run, restored.map + saved->max_free_run,
+         event->rows * sizeof(size_t));
+  return 0;
+}
+
+// Restores the events of a snapshot file
+int ems_restore(const char *path) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  if (restored.map != NULL) {
+    fprintf(stderr, "A snapshot has already been restored\n");
+    return 1;
+  }
+
+  int result = snapshot_map(path, &restored);
+  if (result == -1 && errno == ENOENT) {
+    return 0; // Nothing has been saved yet
+  }
+  if (result != 0) {
+    fprintf(stderr, "Invalid snapshot %s\n", path);
+    return 1;
+  }
+
+  // Forked processes would each get their own copy of a private mapping, so
+  // a shared state is copied out of it instead
+  int in_place = !mem_is_shared();
+
+  for (size_t i = 0; i < restored.num_events; i++) {
+    struct SnapshotEvent *saved = &restored.events[i];
+
+    // Sizes were checked when the snapshot was mapped. Seats mapped in place
+    // keep the width they are saved with, copied ones are narrowed.
+    struct Event *event = alloc_event(
+        saved->id, (size_t)saved->rows, (size_t)saved->cols,
+        in_place ? 0 : seat_width_for(saved->reservations));
+    if (event == NULL) {
+      fprintf(stderr, "Error allocating memory for event\n");
+      return 1;
+    }
+
+    atomic_init(&event->reservations, saved->reservations);
+    if (in_place) {
+      seat_grid_place(&event->seats, restored.map + saved->data);
+      place_bitmap(event, restored.map + saved->occupied);
+      event->max_free_run =
+          (_Atomic size_t *)(restored.map + saved->max_free_run);
+    } else if (copy_restored(event, saved) != 0) {
+      fprintf(stderr, "Error allocating memory for event\n");
+      arena_free(&event_list->arena, event);
+      return 1;
+    }
+    build_free_runs(event);
+
+    if (init_event_locks(event, saved->reservations) != 0) {
+      fprintf(stderr, "Error initializing rwlock\n");
+      arena_free(&event_list->arena, event);
+      return 1;
+    }
+
+    int appended = append_to_list(event_list, event);
+    if (appended != 0) {
+      fprintf(stderr, appended == 2 ? "Event already exists\n"
+                                    : "Error appending event to list\n");
+      free_event(event_list, event);
+      return 1;
+    }
+  }
+
+  if (!in_place) {
+    snapshot_unmap(&restored);
+  }
+  return 0;
+}
+
+/// Applies a logged reservation, with the seats and id it was made with.
+/// @note Only called before any other thread is started.
+/// @param record Reservation record.
+/// @param seats Seats of the reservation.
+/// @return 0 if the seats were reserved, 1 if they do not apply to the state.
+static int replay_reservation(const struct WalRecord *record,
+                              const uint64_t *seats) {
+  struct Event *event = get_event(event_list, record->event_id);
+  // size_t is 64 bits wide, see the assertions above
+  const size_t *indices = (const size_t *)seats;
+
+  if (event == NULL || record->count == 0)
+    return 1;
+
+  for (size_t i = 0; i < record->count; i++) {
+    // Seats are logged sorted and distinct
+    if (seats[i] >= event->rows * event->cols ||
+        (i > 0 && seats[i] <= seats[i - 1]))
+      return 1;
+    if (seat_reserved(event, indices[i]))
+      return 1;
+  }
+
+  if (seat_grid_fit(&event->seats, record->reservation, &event_list->arena) !=
+          0 ||
+      touch_seats(event, record->count, indices) != 0) {
+    fprintf(stderr, "Error allocating memory for seats\n");
+    return 1;
+  }
+
+  // Replaying restores the state as it was, without simulating the access
+  // delay of every seat
+  for (size_t i = 0; i < record->count; i++) {
+    uint64_t bit;
+    _Atomic uint64_t *word = occupancy_word(event, indices[i], &bit);
+    atomic_fetch_or_explicit(word, bit, memory_order_relaxed);
+    seat_grid_set(&event->seats, indices[i], record->reservation);
+  }
+  refresh_free_runs(event, record->count, indices);
+  if (ledger_add(&event->ledger, record->reservation, record->count,
+                 indices) != 0) {
+    fprintf(stderr, "Error recording reservation\n");
+  }
+
+  if (atomic_load(&event->reservations) < record->reservation) {
+    atomic_store(&event->reservations, record->reservation);
+  }
+  return 0;
+}
+
+/// Releases the seats of a logged cancellation.
+/// @note Only called before any other thread is started.
+/// @param record Cancellation record.
+/// @return 0 if the seats were released, 1 if there is no such reservation.
+static int replay_cancel(const struct WalRecord *record) {
+  struct Event *event = get_event(event_list, record->event_id);
+  size_t local_indices[MAX_RESERVATION_SIZE];
+  size_t *indices;
+
+  if (event == NULL || index_restored(event) != 0)
+    return 1;
+
+  size_t num_seats =
+      copy_reservation(event, record->reservation, local_indices, &indices);
+  for (size_t i = 0; i < num_seats; i++) {
+    uint64_t bit;
+    _Atomic uint64_t *word = occupancy_word(event, indices[i], &bit);
+    atomic_fetch_and_explicit(word, ~bit, memory_order_relaxed);
+    seat_grid_set(&event->seats, indices[i], 0);
+  }
+  refresh_free_runs(event, num_seats, indices);
+  ledger_drop(&event->ledger, record->reservation);
+
+  if (indices != local_indices)
+    free(indices);
+  return num_seats == 0;
+}
+
+/// Replays each event's part of a logged reservation across several events.
+/// Parts already in a restored snapshot are skipped on their own, since a
+/// snapshot writes each event in turn.
+/// @note Only called before any other thread is started.
+/// @param record Reservation record.
+/// @param words Words following the record.
+/// @return Number of parts that do not apply, or of events if the record is
+/// malformed.
+static size_t replay_multi(const struct WalRecord *record,
+                           const uint64_t *words) {
+  size_t skipped = 0;
+  size_t offset = 0;
+
+  for (uint64_t i = 0; i < record->rows; i++) {
+    if (record->count - offset < 2 ||
+        words[offset + 1] > record->count - offset - 2)
+      return (size_t)(record->rows - i) + skipped;
+
+    struct WalRecord part = {0};
+    part.op = WAL_RESERVE;
+    part.count = (uint16_t)words[offset + 1];
+    part.event_id = (uint32_t)(words[offset] >> 32);
+    part.reservation = (uint32_t)words[offset];
+    skipped += replay_reservation(&part, words + offset + 2) != 0;
+    offset += 2 + part.count;
+  }
+  return skipped;
+}
+
+// Replays a write-ahead log
+int ems_recover(const char *path) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct WalReader log;
+  int result = wal_reader_open(&log, path);
+  if (result == -1 && errno == ENOENT) {
+    return 0; // Nothing has been logged yet
+  }
+  if (result != 0) {
+    fprintf(stderr, "Invalid log %s\n", path);
+    return 1;
+  }
+
+  struct WalRecord record;
+  const uint64_t *seats;
+  size_t skipped = 0;
+
+  while (wal_next(&log, &record, &seats) == 1) {
+    if (record.op == WAL_CREATE) {
+      size_t sizes[3];
+      struct Event *event =
+          snapshot_event_sizes(record.rows, record.cols, sizes) != 0
+              ? NULL
+              : new_event(record.event_id, (size_t)record.rows,
+                          (size_t)record.cols);
+
+      // Events already restored from a snapshot are kept as they are
+      if (event == NULL || append_to_list(event_list, event) != 0) {
+        free_event(event_list, event);
+        skipped++;
+      }
+    } else if (record.op == WAL_RESERVE) {
+      skipped += replay_reservation(&record, seats) != 0;
+    } else if (record.op == WAL_RESERVE_MULTI) {
+      skipped += replay_multi(&record, seats);
+    } else if (record.op != WAL_CANCEL || replay_cancel(&record) != 0) {
+      skipped++;
+    }
+  }
+  wal_reader_close(&log);
+
+  if (skipped > 0) {
+    fprintf(stderr, "Skipped %zu log records that do not apply\n", skipped);
+  }
+  return 0;
+}
@@ -3,10 +3,14 @@
 
 #include <stddef.h>
 
+#include "output.h"
+
 /// Initializes the EMS state.
 /// @param delay_ms State access delay in milliseconds.
+/// @param cache_lines Number of events and rows of seats cached, whose
+/// accesses do not pay the delay. 0 disables the cache.
 /// @return 0 if the EMS state was initialized successfully, 1 otherwise.
-int ems_init(unsigned int delay_ms);
+int ems_init(unsigned int delay_ms, size_t cache_lines);
 
 /// Destroys the EMS state.
 int ems_terminate();
@@ -27,14 +31,90 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs,
                 size_t *ys);
 
-/// Prints the given event.
+/// Reserves adjacent free seats of the given event, picking the first row
+/// (and lowest columns) where they fit, and prints them as SHOWRES does.
+/// The rows are searched through a tree of their free runs, in time
+/// logarithmic in the number of rows.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of seats to reserve, at most MAX_RESERVATION_SIZE.
+/// @param same_row If zero and no row has enough adjacent free seats, the
+/// seats may continue from the end of a row into the start of the next: the
+/// first run of free seats in row order is reserved, the last seat of a row
+/// counting as adjacent to the first of the next. If nonzero, the seats are
+/// always in a single row.
+/// @param out Buffer to append the reserved seats to.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve_best(unsigned int event_id, size_t num_seats, int same_row,
+                     struct Buffer *out);
+
+/// Reserves seats in several events at once: either every seat is reserved,
+/// each event getting its own reservation id, or none is. The events are
+/// locked in id order, so concurrent reservations on the same events cannot
+/// deadlock.
+/// @param num_events Number of events, at most MAX_MULTI_EVENTS.
+/// @param event_ids Array of ids of the events, all distinct.
+/// @param event_seats Array of the number of seats to reserve in each event.
+/// @param xs Array of rows of the seats to reserve, those of each event
+/// following the previous event's.
+/// @param ys Array of columns of the seats to reserve, in the same order.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve_multi(size_t num_events, const unsigned int *event_ids,
+                      const size_t *event_seats, size_t *xs, size_t *ys);
+
+/// Cancels a reservation, releasing its seats.
+/// @param event_id Id of the event the reservation belongs to.
+/// @param reservation_id Id of the reservation.
+/// @return 0 if the reservation was cancelled successfully, 1 otherwise.
+int ems_cancel(unsigned int event_id, unsigned int reservation_id);
+
+/// Prints the seats of a reservation, as (row,column) pairs.
+/// @param event_id Id of the event the reservation belongs to.
+/// @param reservation_id Id of the reservation.
+/// @param out Buffer to append the output to.
+/// @return 0 if the reservation was printed successfully, 1 otherwise.
+int ems_show_reservation(unsigned int event_id, unsigned int reservation_id,
+                         struct Buffer *out);
+
+/// Prints the given event. The seats are copied under the event's locks and
+/// rendered after releasing them.
 /// @param event_id Id of the event to print.
+/// @param out Buffer to append the output to.
 /// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(unsigned int event_id, int fd);
+int ems_show(unsigned int event_id, struct Buffer *out);
+
+/// Prints the number of free seats of the given event, in total and per row.
+/// @note Does not wait for concurrent reservations on the event.
+/// @param event_id Id of the event to print.
+/// @param out Buffer to append the output to.
+/// @return 0 if the availability was printed successfully, 1 otherwise.
+int ems_available(unsigned int event_id, struct Buffer *out);
 
 /// Prints all the events.
+/// @param out Buffer to append the output to.
 /// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int fd);
+int ems_list_events(struct Buffer *out);
+
+/// Writes every event to a snapshot file, replacing it once complete.
+/// @note Creating events and reserving seats in several events at once wait
+/// until the snapshot is written, other reservations only while their event
+/// is being written.
+/// @param path Path of the snapshot file.
+/// @return 0 if the snapshot was written successfully, 1 otherwise.
+int ems_snapshot(const char *path);
+
+/// Restores the events of a snapshot file. Without a shared state, the file
+/// is mapped and its seats are used in place, paged in as they are accessed.
+/// @param path Path of the snapshot file.
+/// @return 0 if the events were restored or the file does not exist, 1
+/// otherwise.
+int ems_restore(const char *path);
+
+/// Replays the events and reservations of a write-ahead log, in the order
+/// they were logged. Records that do not apply, such as those already in a
+/// restored snapshot, are skipped.
+/// @param path Path of the log.
+/// @return 0 if the log was replayed or does not exist, 1 otherwise.
+int ems_recover(const char *path);
 
 /// Waits for a given amount of time.
 /// @param delay_us Delay in milliseconds.
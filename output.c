@@ -0,0 +1,329 @@
+#include "output.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+#define BUFFER_MIN_CAPACITY 256
+
+ssize_t safe_write(int fd, const void *buf, ssize_t count) {
+  ssize_t total_written = 0;
+  ssize_t bytes_written;
+
+  while (total_written < count) {
+    bytes_written = write(fd, (const char *)buf + total_written,
+                          (size_t)(count - total_written));
+
+    if (bytes_written == -1) {
+      if (errno == EINTR) {
+        // The write was interrupted by a signal, try again
+        continue;
+      } else {
+        fprintf(stderr, "Error writing\n");
+        break;
+      }
+    }
+
+    if (bytes_written == 0) {
+      break;
+    }
+
+    total_written += bytes_written;
+  }
+
+  return total_written;
+}
+
+void buffer_init(struct Buffer *buffer) {
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->capacity = 0;
+}
+
+void buffer_free(struct Buffer *buffer) {
+  free(buffer->data);
+  buffer_init(buffer);
+}
+
+// Makes room for at least extra more bytes
+static int buffer_reserve(struct Buffer *buffer, size_t extra) {
+  if (buffer->length + extra <= buffer->capacity)
+    return 0;
+
+  size_t capacity =
+      buffer->capacity < BUFFER_MIN_CAPACITY ? BUFFER_MIN_CAPACITY
+                                             : buffer->capacity;
+  while (capacity < buffer->length + extra) {
+    capacity *= 2;
+  }
+
+  char *data = realloc(buffer->data, capacity);
+  // Checks if realloc failed
+  if (data == NULL)
+    return 1;
+
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return 0;
+}
+
+int buffer_append(struct Buffer *buffer, const char *data, size_t length) {
+  if (buffer_reserve(buffer, length) != 0)
+    return 1;
+
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+  return 0;
+}
+
+int buffer_append_uint(struct Buffer *buffer, unsigned int value) {
+  char digits[10]; // Enough for UINT_MAX
+  size_t length = sizeof(digits);
+
+  do {
+    digits[--length] = '0' + (char)(value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  return buffer_append(buffer, &digits[length], sizeof(digits) - length);
+}
+
+int buffer_append_size(struct Buffer *buffer, size_t value) {
+  char digits[20]; // Enough for SIZE_MAX
+  size_t length = sizeof(digits);
+
+  do {
+    digits[--length] = '0' + (char)(value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  return buffer_append(buffer, &digits[length], sizeof(digits) - length);
+}
+
+/// Writes a run of buffers in order, resuming wherever a write stops.
+/// @param fd File descriptor to write to.
+/// @param iov Buffers to write, none of them empty. Modified.
+/// @param count Number of buffers.
+static void write_run(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd, iov, count);
+
+    if (written == -1) {
+      if (errno == EINTR) {
+        // The write was interrupted by a signal, try again
+        continue;
+      }
+      fprintf(stderr, "Error writing\n");
+      return;
+    }
+    if (written == 0)
+      return;
+
+    // Skips what was written, which may end in the middle of a buffer
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= (ssize_t)iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= (size_t)written;
+    }
+  }
+}
+
+/// Keeps a written output for reuse, or frees it if enough are kept. The
+/// sequencer's lock must be held.
+static void recycle_output(struct OutputSequencer *sequencer,
+                           struct PendingOutput *output) {
+  if (sequencer->num_spare < OUTPUT_SPARE) {
+    output->buffer.length = 0;
+    output->next = sequencer->spare;
+    sequencer->spare = output;
+    sequencer->num_spare++;
+  } else {
+    buffer_free(&output->buffer);
+    free(output);
+  }
+}
+
+/// Checks if the next output to be written has been committed. The
+/// sequencer's lock must be held.
+static int has_turn(const struct OutputSequencer *sequencer) {
+  return sequencer->pending != NULL &&
+         sequencer->pending->ticket == sequencer->next;
+}
+
+/// Writes the outputs of a sequencer as their turns come, until it closes.
+/// @param arg Sequencer to write the outputs of.
+static void *writer_thread(void *arg) {
+  struct OutputSequencer *sequencer = arg;
+  struct iovec iov[OUTPUT_BATCH];
+
+  pthread_mutex_lock(&sequencer->lock);
+  while (1) {
+    while (!has_turn(sequencer) && !sequencer->closing) {
+      pthread_cond_wait(&sequencer->work, &sequencer->lock);
+    }
+    if (!has_turn(sequencer))
+      break;
+
+    // Takes the run of outputs whose turn came, written without the lock so
+    // that commits carry on meanwhile
+    struct PendingOutput *run = sequencer->pending;
+    struct PendingOutput *last = NULL;
+    size_t bytes = 0;
+    int count = 0;
+    int taken = 0;
+    while (has_turn(sequencer) && taken < OUTPUT_BATCH) {
+      last = sequencer->pending;
+      if (last->buffer.length > 0) {
+        iov[count].iov_base = last->buffer.data;
+        iov[count].iov_len = last->buffer.length;
+        count++;
+      }
+      bytes += last->buffer.length;
+      sequencer->pending = last->next;
+      sequencer->next++;
+      taken++;
+    }
+    last->next = NULL;
+    sequencer->writing = 1;
+    pthread_mutex_unlock(&sequencer->lock);
+
+    write_run(sequencer->fd, iov, count);
+
+    pthread_mutex_lock(&sequencer->lock);
+    while (run != NULL) {
+      struct PendingOutput *output = run;
+      run = output->next;
+      recycle_output(sequencer, output);
+    }
+    sequencer->queued -= bytes;
+    sequencer->writing = 0;
+    pthread_cond_broadcast(&sequencer->turn);
+  }
+  pthread_mutex_unlock(&sequencer->lock);
+  return NULL;
+}
+
+int sequencer_init(struct OutputSequencer *sequencer, int fd) {
+  sequencer->fd = fd;
+  sequencer->next = 0;
+  sequencer->pending = NULL;
+  sequencer->spare = NULL;
+  sequencer->num_spare = 0;
+  sequencer->queued = 0;
+  sequencer->writing = 0;
+  sequencer->closing = 0;
+
+  // Checks if mutex_init failed
+  if (pthread_mutex_init(&sequencer->lock, NULL) != 0)
+    return 1;
+
+  // Checks if cond_init failed
+  if (pthread_cond_init(&sequencer->turn, NULL) != 0) {
+    pthread_mutex_destroy(&sequencer->lock);
+    return 1;
+  }
+  if (pthread_cond_init(&sequencer->work, NULL) != 0) {
+    pthread_cond_destroy(&sequencer->turn);
+    pthread_mutex_destroy(&sequencer->lock);
+    return 1;
+  }
+
+  if (pthread_create(&sequencer->writer, NULL, writer_thread, sequencer) !=
+      0) {
+    pthread_cond_destroy(&sequencer->work);
+    pthread_cond_destroy(&sequencer->turn);
+    pthread_mutex_destroy(&sequencer->lock);
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Frees a list of outputs.
+static void free_outputs(struct PendingOutput *outputs) {
+  while (outputs != NULL) {
+    struct PendingOutput *temp = outputs;
+    outputs = temp->next;
+
+    buffer_free(&temp->buffer);
+    free(temp);
+  }
+}
+
+void sequencer_destroy(struct OutputSequencer *sequencer) {
+  // The writer finishes the outputs whose turn came before it exits
+  pthread_mutex_lock(&sequencer->lock);
+  sequencer->closing = 1;
+  pthread_cond_signal(&sequencer->work);
+  pthread_mutex_unlock(&sequencer->lock);
+  pthread_join(sequencer->writer, NULL);
+
+  free_outputs(sequencer->pending);
+  free_outputs(sequencer->spare);
+  pthread_cond_destroy(&sequencer->work);
+  pthread_cond_destroy(&sequencer->turn);
+  pthread_mutex_destroy(&sequencer->lock);
+}
+
+void sequencer_commit(struct OutputSequencer *sequencer, size_t ticket,
+                      struct Buffer *buffer) {
+  pthread_mutex_lock(&sequencer->lock);
+
+  // Lets the writer catch up. The output it waits for never waits, so the
+  // ones queued ahead of this one are always written eventually.
+  while (ticket != sequencer->next &&
+         sequencer->queued > OUTPUT_MAX_QUEUED) {
+    pthread_cond_wait(&sequencer->turn, &sequencer->lock);
+  }
+
+  struct PendingOutput *output = sequencer->spare;
+  if (output != NULL) {
+    sequencer->spare = output->next;
+    sequencer->num_spare--;
+  } else if ((output = malloc(sizeof(struct PendingOutput))) != NULL) {
+    buffer_init(&output->buffer);
+  } else {
+    // Without memory to keep the output, waits for every earlier one to be
+    // written and writes it directly
+    while (ticket != sequencer->next || sequencer->writing) {
+      pthread_cond_wait(&sequencer->turn, &sequencer->lock);
+    }
+    safe_write(sequencer->fd, buffer->data, (ssize_t)buffer->length);
+    buffer->length = 0;
+    sequencer->next++;
+
+    pthread_cond_signal(&sequencer->work);
+    pthread_cond_broadcast(&sequencer->turn);
+    pthread_mutex_unlock(&sequencer->lock);
+    return;
+  }
+
+  // Hands the output over, and the emptied memory of a written one back
+  struct Buffer empty = output->buffer;
+  output->ticket = ticket;
+  output->buffer = *buffer;
+  *buffer = empty;
+  sequencer->queued += output->buffer.length;
+
+  // Keeps the outputs sorted by ticket
+  struct PendingOutput **link = &sequencer->pending;
+  while (*link != NULL && (*link)->ticket < ticket) {
+    link = &(*link)->next;
+  }
+  output->next = *link;
+  *link = output;
+
+  if (ticket == sequencer->next) {
+    pthread_cond_signal(&sequencer->work);
+  }
+  pthread_mutex_unlock(&sequencer->lock);
+}
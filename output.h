@@ -0,0 +1,101 @@
+#ifndef EMS_OUTPUT_H
+#define EMS_OUTPUT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Growable byte buffer that output is rendered into
+struct Buffer {
+  char *data;      /// Bytes written so far.
+  size_t length;   /// Number of bytes written.
+  size_t capacity; /// Number of bytes allocated.
+};
+
+struct PendingOutput {
+  size_t ticket;              /// Position of the output in the job file.
+  struct Buffer buffer;       /// Rendered output.
+  struct PendingOutput *next; /// Next pending output, in ticket order.
+};
+
+// Writes rendered outputs to a file in ticket order, whatever the order in
+// which they are committed. The writes are made by a writer thread of the
+// sequencer, so committing only hands the output over. Runs of consecutive
+// outputs are written together with one writev. Written outputs keep their
+// memory and are handed back to later commits, so the buffers are reused.
+struct OutputSequencer {
+  int fd;                        /// File descriptor to write to.
+  size_t next;                   /// Ticket of the next output to be written.
+  struct PendingOutput *pending; /// Outputs committed but not written yet.
+  struct PendingOutput *spare;   /// Written outputs kept for reuse.
+  size_t num_spare;              /// Number of outputs in spare.
+  size_t queued;                 /// Bytes of the pending outputs.
+  int writing;                   /// Set while the writer writes a run.
+  int closing;                   /// Set when the writer must finish.
+  pthread_mutex_t lock;          /// Guards the fields above.
+  pthread_cond_t turn;           /// Signaled when next or queued change.
+  pthread_cond_t work;           /// Signaled when the writer has work.
+  pthread_t writer;              /// Thread that writes the outputs.
+};
+
+/// Guarantees that a write isnt interrupted
+/// @param fd File descriptor to write to.
+/// @param buf Buffer to write.
+/// @param count Number of bytes to write.
+/// @return Number of bytes written.
+ssize_t safe_write(int fd, const void *buf, ssize_t count);
+
+/// Initializes an empty buffer. Does not allocate.
+/// @param buffer Buffer to initialize.
+void buffer_init(struct Buffer *buffer);
+
+/// Frees the memory of a buffer, leaving it empty.
+/// @param buffer Buffer to free.
+void buffer_free(struct Buffer *buffer);
+
+/// Appends bytes to a buffer.
+/// @param buffer Buffer to append to.
+/// @param data Bytes to append.
+/// @param length Number of bytes to append.
+/// @return 0 if the bytes were appended, 1 if out of memory.
+int buffer_append(struct Buffer *buffer, const char *data, size_t length);
+
+/// Appends the decimal representation of an unsigned int to a buffer.
+/// @param buffer Buffer to append to.
+/// @param value Value to append.
+/// @return 0 if the value was appended, 1 if out of memory.
+int buffer_append_uint(struct Buffer *buffer, unsigned int value);
+
+/// Appends the decimal representation of a size to a buffer.
+/// @param buffer Buffer to append to.
+/// @param value Value to append.
+/// @return 0 if the value was appended, 1 if out of memory.
+int buffer_append_size(struct Buffer *buffer, size_t value);
+
+/// Initializes a sequencer whose first output has ticket 0, and starts its
+/// writer.
+/// @param sequencer Sequencer to initialize.
+/// @param fd File descriptor to write to.
+/// @return 0 if the sequencer was initialized successfully, 1 otherwise.
+int sequencer_init(struct OutputSequencer *sequencer, int fd);
+
+/// Destroys a sequencer once its writer has written every output whose turn
+/// came, dropping the outputs that never got it.
+/// @note No output may be committed meanwhile.
+/// @param sequencer Sequencer to destroy.
+void sequencer_destroy(struct OutputSequencer *sequencer);
+
+/// Commits the output of a command, for the writer to write once every
+/// earlier ticket has been committed. Only waits if more than
+/// OUTPUT_MAX_QUEUED bytes are waiting to be written, or if there is no
+/// memory left to keep the output.
+/// @note Every ticket must be committed, with an empty buffer if the command
+/// has no output, or the outputs after it are never written.
+/// @param sequencer Sequencer to commit to.
+/// @param ticket Ticket of the command.
+/// @param buffer Rendered output. Its contents are taken over and it is left
+/// empty, ready to be reused, possibly with memory of an earlier output.
+void sequencer_commit(struct OutputSequencer *sequencer, size_t ticket,
+                      struct Buffer *buffer);
+
+#endif // EMS_OUTPUT_H
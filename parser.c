@@ -1,36 +1,34 @@
 #include "parser.h"
 
 #include <limits.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
 #include "constants.h"
+#include "reader.h"
 
-static int read_uint(int fd, unsigned int *value, char *next) {
-  char buf[16];
+static int read_uint(struct Reader *reader, unsigned int *value, char *next) {
+  unsigned long ul = 0;
+  int overflow = 0;
 
-  int i = 0;
   while (1) {
-    if (read(fd, buf + i, 1) == 0) {
+    if (reader_getc(reader, next) == 0) {
       *next = '\0';
       break;
     }
 
-    *next = buf[i];
-
-    if (buf[i] > '9' || buf[i] < '0') {
-      buf[i] = '\0';
+    if (*next > '9' || *next < '0') {
       break;
     }
 
-    i++;
+    // Digits are accumulated directly instead of being copied out first
+    ul = ul * 10 + (unsigned long)(*next - '0');
+    if (ul > UINT_MAX) {
+      overflow = 1;
+      ul = UINT_MAX;
+    }
   }
 
-  unsigned long ul = strtoul(buf, NULL, 10);
-
-  if (ul > UINT_MAX) {
+  if (overflow) {
     return 1;
   }
 
@@ -39,122 +37,216 @@ static int read_uint(int fd, unsigned int *value, char *next) {
   return 0;
 }
 
-static void cleanup(int fd) {
+static void cleanup(struct Reader *reader) {
   char ch;
-  while (read(fd, &ch, 1) == 1 && ch != '\n')
+  while (reader_getc(reader, &ch) == 1 && ch != '\n')
     ;
 }
 
-enum Command get_next(int fd) {
+enum Command get_next(struct Reader *reader) {
   char buf[16];
-  if (read(fd, buf, 1) != 1) {
+  if (reader_getc(reader, buf) != 1) {
     return EOC;
   }
 
   switch (buf[0]) {
   case 'C':
-    if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
-      cleanup(fd);
+    if (reader_read(reader, buf + 1, 6) != 6) {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
-    return CMD_CREATE;
+    if (strncmp(buf, "CREATE ", 7) == 0) {
+      return CMD_CREATE;
+    }
+
+    if (strncmp(buf, "CANCEL ", 7) != 0) {
+      cleanup(reader);
+      return CMD_INVALID;
+    }
+
+    return CMD_CANCEL;
 
   case 'R':
-    if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
-      cleanup(fd);
+    if (reader_read(reader, buf + 1, 7) != 7 ||
+        strncmp(buf, "RESERVE", 7) != 0) {
+      cleanup(reader);
+      return CMD_INVALID;
+    }
+
+    if (buf[7] == ' ') {
+      return CMD_RESERVE;
+    }
+
+    if (buf[7] != '_' || reader_read(reader, buf + 8, 5) != 5) {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
-    return CMD_RESERVE;
+    if (strncmp(buf, "RESERVE_BEST ", 13) == 0) {
+      return CMD_RESERVE_BEST;
+    }
+
+    if (reader_getc(reader, buf + 13) != 1) {
+      return CMD_INVALID;
+    }
+
+    if (strncmp(buf, "RESERVE_MULTI ", 14) != 0) {
+      // A bare RESERVE_MULTI has already consumed its line
+      if (buf[13] != '\n') {
+        cleanup(reader);
+      }
+      return CMD_INVALID;
+    }
+
+    return CMD_RESERVE_MULTI;
 
   case 'S':
-    if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
-      cleanup(fd);
+    if (reader_getc(reader, buf + 1) != 1) {
+      return CMD_INVALID;
+    }
+
+    if (buf[1] == 'N') {
+      if (reader_read(reader, buf + 2, 6) != 6 ||
+          strncmp(buf, "SNAPSHOT", 8) != 0) {
+        cleanup(reader);
+        return CMD_INVALID;
+      }
+
+      if (reader_getc(reader, buf + 8) != 0 && buf[8] != '\n') {
+        cleanup(reader);
+        return CMD_INVALID;
+      }
+
+      return CMD_SNAPSHOT;
+    }
+
+    if (buf[1] == 'T') {
+      if (reader_read(reader, buf + 2, 3) != 3 ||
+          strncmp(buf, "STATS", 5) != 0) {
+        cleanup(reader);
+        return CMD_INVALID;
+      }
+
+      if (reader_getc(reader, buf + 5) != 0 && buf[5] != '\n') {
+        cleanup(reader);
+        return CMD_INVALID;
+      }
+
+      return CMD_STATS;
+    }
+
+    if (reader_read(reader, buf + 2, 3) != 3 ||
+        strncmp(buf, "SHOW", 4) != 0) {
+      cleanup(reader);
+      return CMD_INVALID;
+    }
+
+    if (buf[4] == ' ') {
+      return CMD_SHOW;
+    }
+
+    if (buf[4] != 'R' || reader_read(reader, buf + 5, 3) != 3 ||
+        strncmp(buf, "SHOWRES ", 8) != 0) {
+      cleanup(reader);
+      return CMD_INVALID;
+    }
+
+    return CMD_SHOWRES;
+
+  case 'A':
+    if (reader_read(reader, buf + 1, 9) != 9 ||
+        strncmp(buf, "AVAILABLE ", 10) != 0) {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
-    return CMD_SHOW;
+    return CMD_AVAILABLE;
 
   case 'L':
-    if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
-      cleanup(fd);
+    if (reader_read(reader, buf + 1, 3) != 3 ||
+        strncmp(buf, "LIST", 4) != 0) {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
-    if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
-      cleanup(fd);
+    if (reader_getc(reader, buf + 4) != 0 && buf[4] != '\n') {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
     return CMD_LIST_EVENTS;
 
   case 'B':
-    if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
-      cleanup(fd);
+    if (reader_read(reader, buf + 1, 6) != 6 ||
+        strncmp(buf, "BARRIER", 7) != 0) {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
-    if (read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
-      cleanup(fd);
+    if (reader_getc(reader, buf + 7) != 0 && buf[7] != '\n') {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
     return CMD_BARRIER;
 
   case 'W':
-    if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
-      cleanup(fd);
+    if (reader_read(reader, buf + 1, 4) != 4 ||
+        strncmp(buf, "WAIT ", 5) != 0) {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
     return CMD_WAIT;
 
   case 'H':
-    if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
-      cleanup(fd);
+    if (reader_read(reader, buf + 1, 3) != 3 ||
+        strncmp(buf, "HELP", 4) != 0) {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
-    if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
-      cleanup(fd);
+    if (reader_getc(reader, buf + 4) != 0 && buf[4] != '\n') {
+      cleanup(reader);
       return CMD_INVALID;
     }
 
     return CMD_HELP;
 
   case '#':
-    cleanup(fd);
+    cleanup(reader);
     return CMD_EMPTY;
 
   case '\n':
     return CMD_EMPTY;
 
   default:
-    cleanup(fd);
+    cleanup(reader);
     return CMD_INVALID;
   }
 }
 
-int parse_create(int fd, unsigned int *event_id, size_t *num_rows,
-                 size_t *num_cols) {
+int parse_create(struct Reader *reader, unsigned int *event_id,
+                 size_t *num_rows, size_t *num_cols) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (read_uint(reader, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(reader);
     return 1;
   }
 
   unsigned int u_num_rows;
-  if (read_uint(fd, &u_num_rows, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (read_uint(reader, &u_num_rows, &ch) != 0 || ch != ' ') {
+    cleanup(reader);
     return 1;
   }
   *num_rows = (size_t)u_num_rows;
 
   unsigned int u_num_cols;
-  if (read_uint(fd, &u_num_cols, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (read_uint(reader, &u_num_cols, &ch) != 0 ||
+      (ch != '\n' && ch != '\0')) {
+    cleanup(reader);
     return 1;
   }
   *num_cols = (size_t)u_num_cols;
@@ -162,45 +254,41 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows,
   return 0;
 }
 
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs,
-                     size_t *ys) {
+// Reads a list of seats, from its opening to its closing bracket
+static size_t read_seats(struct Reader *reader, size_t max, size_t *xs,
+                         size_t *ys) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
-    return 0;
-  }
-
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
-    cleanup(fd);
+  if (reader_getc(reader, &ch) != 1 || ch != '[') {
+    cleanup(reader);
     return 0;
   }
 
   size_t num_coords = 0;
   while (num_coords < max) {
-    if (read(fd, &ch, 1) != 1 || ch != '(') {
-      cleanup(fd);
+    if (reader_getc(reader, &ch) != 1 || ch != '(') {
+      cleanup(reader);
       return 0;
     }
 
     unsigned int x;
-    if (read_uint(fd, &x, &ch) != 0 || ch != ',') {
-      cleanup(fd);
+    if (read_uint(reader, &x, &ch) != 0 || ch != ',') {
+      cleanup(reader);
       return 0;
     }
     xs[num_coords] = (size_t)x;
 
     unsigned int y;
-    if (read_uint(fd, &y, &ch) != 0 || ch != ')') {
-      cleanup(fd);
+    if (read_uint(reader, &y, &ch) != 0 || ch != ')') {
+      cleanup(reader);
       return 0;
     }
     ys[num_coords] = (size_t)y;
 
     num_coords++;
 
-    if (read(fd, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
-      cleanup(fd);
+    if (reader_getc(reader, &ch) != 1 || (ch != ' ' && ch != ']')) {
+      cleanup(reader);
       return 0;
     }
 
@@ -210,45 +298,161 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs,
   }
 
   if (num_coords == max) {
-    cleanup(fd);
+    cleanup(reader);
+    return 0;
+  }
+
+  return num_coords;
+}
+
+size_t parse_reserve(struct Reader *reader, size_t max,
+                     unsigned int *event_id, size_t *xs, size_t *ys) {
+  char ch;
+
+  if (read_uint(reader, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(reader);
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  size_t num_coords = read_seats(reader, max, xs, ys);
+  if (num_coords == 0)
+    return 0;
+
+  if (reader_getc(reader, &ch) != 1 || (ch != '\n' && ch != '\0')) {
+    cleanup(reader);
     return 0;
   }
 
   return num_coords;
 }
 
-int parse_show(int fd, unsigned int *event_id) {
+size_t parse_reserve_multi(struct Reader *reader, size_t max_events,
+                           size_t max_seats, unsigned int *event_ids,
+                           size_t *event_seats, size_t *xs, size_t *ys) {
+  size_t num_events = 0;
+  size_t total = 0;
+  char ch = ' ';
+
+  // Each event is followed by a space before the next one, or ends the line
+  while (ch == ' ') {
+    if (num_events == max_events ||
+        read_uint(reader, &event_ids[num_events], &ch) != 0 || ch != ' ') {
+      // A trailing space leaves no event id before the end of the line
+      if (ch != '\n' && ch != '\0') {
+        cleanup(reader);
+      }
+      return 0;
+    }
+
+    size_t num_coords =
+        read_seats(reader, max_seats - total, xs + total, ys + total);
+    if (num_coords == 0)
+      return 0;
+    event_seats[num_events++] = num_coords;
+    total += num_coords;
+
+    if (reader_getc(reader, &ch) != 1) {
+      ch = '\0';
+    }
+  }
+
+  if (ch != '\n' && ch != '\0') {
+    cleanup(reader);
+    return 0;
+  }
+
+  return num_events;
+}
+
+int parse_reserve_best(struct Reader *reader, unsigned int *event_id,
+                       size_t *num_seats, int *same_row) {
+  char ch;
+
+  if (read_uint(reader, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(reader);
+    return 1;
+  }
+
+  unsigned int u_num_seats;
+  if (read_uint(reader, &u_num_seats, &ch) != 0) {
+    cleanup(reader);
+    return 1;
+  }
+  *num_seats = (size_t)u_num_seats;
+  *same_row = 1;
+
+  if (ch == ' ') {
+    unsigned int u_same_row;
+    if (read_uint(reader, &u_same_row, &ch) != 0 ||
+        (ch != '\n' && ch != '\0')) {
+      cleanup(reader);
+      return 1;
+    }
+    if (u_same_row > 1) {
+      return 1; // The whole line has already been consumed
+    }
+    *same_row = (int)u_same_row;
+  } else if (ch != '\n' && ch != '\0') {
+    cleanup(reader);
+    return 1;
+  }
+
+  return 0;
+}
+
+int parse_reservation(struct Reader *reader, unsigned int *event_id,
+                      unsigned int *reservation_id) {
+  char ch;
+
+  if (read_uint(reader, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(reader);
+    return 1;
+  }
+
+  if (read_uint(reader, reservation_id, &ch) != 0 ||
+      (ch != '\n' && ch != '\0')) {
+    cleanup(reader);
+    return 1;
+  }
+
+  return 0;
+}
+
+int parse_show(struct Reader *reader, unsigned int *event_id) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (read_uint(reader, event_id, &ch) != 0 ||
+      (ch != '\n' && ch != '\0')) {
+    cleanup(reader);
     return 1;
   }
 
   return 0;
 }
 
-int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
+int parse_available(struct Reader *reader, unsigned int *event_id) {
+  // Same grammar as SHOW
+  return parse_show(reader, event_id);
+}
+
+int parse_wait(struct Reader *reader, unsigned int *delay,
+               unsigned int *thread_id) {
   char ch;
 
-  if (read_uint(fd, delay, &ch) != 0) {
-    cleanup(fd);
+  if (read_uint(reader, delay, &ch) != 0) {
+    cleanup(reader);
     return -1;
   }
 
   if (ch == ' ') {
     if (thread_id == NULL) {
-      cleanup(fd);
+      cleanup(reader);
       return 0;
     }
 
-    if (read_uint(fd, thread_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-      cleanup(fd);
+    if (read_uint(reader, thread_id, &ch) != 0 ||
+        (ch != '\n' && ch != '\0')) {
+      cleanup(reader);
       return -1;
     }
 
@@ -256,7 +460,74 @@ int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
   } else if (ch == '\n' || ch == '\0') {
     return 0;
   } else {
-    cleanup(fd);
+    cleanup(reader);
     return -1;
   }
-}
\ No newline at end of file
+}
+
+enum Command parse_command(struct Reader *reader,
+                           struct CommandRecord *record) {
+  int result = 0;
+  record->type = get_next(reader);
+
+  switch (record->type) {
+  case CMD_CREATE:
+    result = parse_create(reader, &record->event_id, &record->num_rows,
+                          &record->num_cols);
+    break;
+
+  case CMD_RESERVE:
+    record->num_seats = parse_reserve(reader, MAX_RESERVATION_SIZE,
+                                      &record->event_id, record->xs,
+                                      record->ys);
+    result = record->num_seats == 0;
+    break;
+
+  case CMD_RESERVE_MULTI:
+    record->num_events = parse_reserve_multi(
+        reader, MAX_MULTI_EVENTS, MAX_RESERVATION_SIZE, record->event_ids,
+        record->event_seats, record->xs, record->ys);
+    result = record->num_events == 0;
+    break;
+
+  case CMD_RESERVE_BEST:
+    result = parse_reserve_best(reader, &record->event_id, &record->num_seats,
+                                &record->same_row);
+    break;
+
+  case CMD_CANCEL:
+  case CMD_SHOWRES:
+    result = parse_reservation(reader, &record->event_id,
+                               &record->reservation_id);
+    break;
+
+  case CMD_SHOW:
+    result = parse_show(reader, &record->event_id);
+    break;
+
+  case CMD_AVAILABLE:
+    result = parse_available(reader, &record->event_id);
+    break;
+
+  case CMD_WAIT:
+    record->has_thread =
+        parse_wait(reader, &record->delay, &record->thread_id);
+    result = record->has_thread == -1;
+    break;
+
+  case CMD_LIST_EVENTS:
+  case CMD_SNAPSHOT:
+  case CMD_STATS:
+  case CMD_BARRIER:
+  case CMD_HELP:
+  case CMD_EMPTY:
+  case CMD_INVALID:
+  case EOC:
+    break;
+  }
+
+  if (result != 0) {
+    record->type = CMD_INVALID;
+  }
+  return record->type;
+}
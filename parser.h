@@ -3,11 +3,21 @@
 
 #include <stddef.h>
 
+#include "constants.h"
+#include "reader.h"
+
 enum Command {
   CMD_CREATE,
   CMD_RESERVE,
+  CMD_RESERVE_BEST,
+  CMD_RESERVE_MULTI,
+  CMD_CANCEL,
   CMD_SHOW,
+  CMD_SHOWRES,
+  CMD_AVAILABLE,
   CMD_LIST_EVENTS,
+  CMD_SNAPSHOT,
+  CMD_STATS,
   CMD_BARRIER,
   CMD_WAIT,
   CMD_HELP,
@@ -16,43 +26,123 @@ enum Command {
   EOC // End of commands
 };
 
+// A fully parsed command, ready to be executed by any thread
+struct CommandRecord {
+  enum Command type; /// Command, CMD_INVALID if its arguments did not parse.
+  size_t seq;        /// Position of the command in its job file.
+  size_t ticket;     /// Position among the commands that write output.
+
+  unsigned int event_id; /// Event of every command but LIST, SNAPSHOT,
+                         /// BARRIER, WAIT and HELP.
+  unsigned int reservation_id; /// Reservation of CANCEL and SHOWRES.
+  size_t num_rows;       /// Rows of CREATE.
+  size_t num_cols;       /// Columns of CREATE.
+
+  size_t num_seats; /// Seats of RESERVE and RESERVE_BEST.
+  int same_row;     /// Same row flag of RESERVE_BEST.
+  size_t xs[MAX_RESERVATION_SIZE]; /// Rows of the seats of RESERVE and
+                                   /// RESERVE_MULTI.
+  size_t ys[MAX_RESERVATION_SIZE]; /// Columns of the seats of RESERVE and
+                                   /// RESERVE_MULTI.
+
+  size_t num_events; /// Events of RESERVE_MULTI.
+  unsigned int event_ids[MAX_MULTI_EVENTS]; /// Ids of the events of
+                                            /// RESERVE_MULTI.
+  size_t event_seats[MAX_MULTI_EVENTS]; /// Seats of each event of
+                                        /// RESERVE_MULTI, which follow each
+                                        /// other in xs and ys.
+
+  unsigned int delay;     /// Delay of WAIT.
+  int has_thread;         /// Whether WAIT targets a single thread.
+  unsigned int thread_id; /// Thread targeted by WAIT.
+};
+
 /// Reads a line and returns the corresponding command.
-/// @param fd File descriptor to read from.
+/// @param reader Reader to read from.
 /// @return The command read.
-enum Command get_next(int fd);
+enum Command get_next(struct Reader *reader);
 
 /// Parses a CREATE command.
-/// @param fd File descriptor to read from.
+/// @param reader Reader to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @param num_rows Pointer to the variable to store the number of rows in.
 /// @param num_cols Pointer to the variable to store the number of columns in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
-int parse_create(int fd, unsigned int *event_id, size_t *num_rows,
-                 size_t *num_cols);
+int parse_create(struct Reader *reader, unsigned int *event_id,
+                 size_t *num_rows, size_t *num_cols);
 
 /// Parses a RESERVE command.
-/// @param fd File descriptor to read from.
+/// @param reader Reader to read from.
 /// @param max Maximum number of coordinates to read.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @param xs Pointer to the array to store the X coordinates in.
 /// @param ys Pointer to the array to store the Y coordinates in.
 /// @return Number of coordinates read. 0 on failure.
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs,
-                     size_t *ys);
+size_t parse_reserve(struct Reader *reader, size_t max,
+                     unsigned int *event_id, size_t *xs, size_t *ys);
+
+/// Parses a RESERVE_MULTI command: an event id and its seats, as in
+/// RESERVE, for each event.
+/// @param reader Reader to read from.
+/// @param max_events Maximum number of events to read.
+/// @param max_seats Maximum number of coordinates to read, over all events.
+/// @param event_ids Pointer to the array to store the event IDs in.
+/// @param event_seats Pointer to the array to store the number of
+/// coordinates of each event in.
+/// @param xs Pointer to the array to store the X coordinates in.
+/// @param ys Pointer to the array to store the Y coordinates in.
+/// @return Number of events read. 0 on failure.
+size_t parse_reserve_multi(struct Reader *reader, size_t max_events,
+                           size_t max_seats, unsigned int *event_ids,
+                           size_t *event_seats, size_t *xs, size_t *ys);
+
+/// Parses a RESERVE_BEST command.
+/// @param reader Reader to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param num_seats Pointer to the variable to store the number of seats in.
+/// @param same_row Pointer to the variable to store the same row flag in.
+/// Set to 1 when the flag is omitted.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_reserve_best(struct Reader *reader, unsigned int *event_id,
+                       size_t *num_seats, int *same_row);
+
+/// Parses a CANCEL or SHOWRES command.
+/// @param reader Reader to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param reservation_id Pointer to the variable to store the reservation ID
+/// in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_reservation(struct Reader *reader, unsigned int *event_id,
+                      unsigned int *reservation_id);
 
 /// Parses a SHOW command.
-/// @param fd File descriptor to read from.
+/// @param reader Reader to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
-int parse_show(int fd, unsigned int *event_id);
+int parse_show(struct Reader *reader, unsigned int *event_id);
+
+/// Parses an AVAILABLE command.
+/// @param reader Reader to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_available(struct Reader *reader, unsigned int *event_id);
 
 /// Parses a WAIT command.
-/// @param fd File descriptor to read from.
+/// @param reader Reader to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
 /// @param thread_id Pointer to the variable to store the thread ID in. May not
 /// be set.
 /// @return 0 if no thread was specified, 1 if a thread was specified, -1 on
 /// error.
-int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id);
+int parse_wait(struct Reader *reader, unsigned int *delay,
+               unsigned int *thread_id);
+
+/// Reads and parses a whole command.
+/// @param reader Reader to read from.
+/// @param record Pointer to the record to store the command and its
+/// arguments in. Its seq and ticket fields are left untouched.
+/// @return The command read, CMD_INVALID if it could not be parsed.
+enum Command parse_command(struct Reader *reader,
+                           struct CommandRecord *record);
 
 #endif // EMS_PARSER_H
@@ -0,0 +1,83 @@
+#include "queue.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+
+int queue_init(struct Queue *queue, size_t capacity) {
+  // Checks if capacity is a power of two
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    return 1;
+
+  queue->cells = malloc(capacity * sizeof(struct QueueCell));
+  // Checks if malloc failed
+  if (queue->cells == NULL)
+    return 1;
+
+  for (size_t i = 0; i < capacity; i++) {
+    atomic_init(&queue->cells[i].sequence, i);
+    queue->cells[i].item = NULL;
+  }
+  queue->mask = capacity - 1;
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+
+  if (sem_init(&queue->items, 0, 0) != 0) {
+    free(queue->cells);
+    return 1;
+  }
+  if (sem_init(&queue->slots, 0, (unsigned int)capacity) != 0) {
+    sem_destroy(&queue->items);
+    free(queue->cells);
+    return 1;
+  }
+
+  return 0;
+}
+
+void queue_destroy(struct Queue *queue) {
+  sem_destroy(&queue->items);
+  sem_destroy(&queue->slots);
+  free(queue->cells);
+  queue->cells = NULL;
+}
+
+// Waits on a semaphore, retrying if interrupted by a signal
+static void semaphore_wait(sem_t *semaphore) {
+  while (sem_wait(semaphore) != 0 && errno == EINTR)
+    ;
+}
+
+void queue_push(struct Queue *queue, void *item) {
+  semaphore_wait(&queue->slots);
+
+  size_t pos = atomic_fetch_add_explicit(&queue->tail, 1, memory_order_relaxed);
+  struct QueueCell *cell = &queue->cells[pos & queue->mask];
+
+  // The cell is free once its previous item has been popped, which may still
+  // be in progress in a slower consumer
+  while (atomic_load_explicit(&cell->sequence, memory_order_acquire) != pos)
+    sched_yield();
+
+  cell->item = item;
+  atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+  sem_post(&queue->items);
+}
+
+void *queue_pop(struct Queue *queue) {
+  semaphore_wait(&queue->items);
+
+  size_t pos = atomic_fetch_add_explicit(&queue->head, 1, memory_order_relaxed);
+  struct QueueCell *cell = &queue->cells[pos & queue->mask];
+
+  // Another producer may have published a later cell first
+  while (atomic_load_explicit(&cell->sequence, memory_order_acquire) !=
+         pos + 1)
+    sched_yield();
+
+  void *item = cell->item;
+  atomic_store_explicit(&cell->sequence, pos + queue->mask + 1,
+                        memory_order_release);
+  sem_post(&queue->slots);
+  return item;
+}
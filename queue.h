@@ -0,0 +1,45 @@
+#ifndef EMS_QUEUE_H
+#define EMS_QUEUE_H
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+struct QueueCell {
+  _Atomic size_t sequence; /// Position the cell is ready for.
+  void *item;              /// Item stored in the cell.
+};
+
+// Bounded multi-producer multi-consumer queue. Producers and consumers claim
+// cells with atomic counters and never share a lock; the semaphores are only
+// used to sleep while the queue is full or empty.
+struct Queue {
+  struct QueueCell *cells; /// Ring of cells.
+  size_t mask;             /// Number of cells minus one.
+  _Atomic size_t head;     /// Next position to pop from.
+  _Atomic size_t tail;     /// Next position to push to.
+  sem_t items;             /// Number of items ready to be popped.
+  sem_t slots;             /// Number of free cells.
+};
+
+/// Initializes an empty queue.
+/// @param queue Queue to initialize.
+/// @param capacity Maximum number of items, must be a power of two.
+/// @return 0 if the queue was initialized successfully, 1 otherwise.
+int queue_init(struct Queue *queue, size_t capacity);
+
+/// Destroys a queue. Items still in it are not freed.
+/// @param queue Queue to destroy.
+void queue_destroy(struct Queue *queue);
+
+/// Pushes an item, waiting while the queue is full.
+/// @param queue Queue to push to.
+/// @param item Item to push.
+void queue_push(struct Queue *queue, void *item);
+
+/// Pops the oldest item, waiting while the queue is empty.
+/// @param queue Queue to pop from.
+/// @return The item popped.
+void *queue_pop(struct Queue *queue);
+
+#endif // EMS_QUEUE_H
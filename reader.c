@@ -0,0 +1,124 @@
+#include "reader.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int reader_init_buffered(struct Reader *reader, int fd) {
+  reader->kind = READER_BUFFERED;
+  reader->fd = fd;
+  reader->map = NULL;
+  reader->length = 0;
+  reader->buffer = malloc(READER_BUFFER_SIZE);
+  // Checks if malloc failed
+  if (reader->buffer == NULL)
+    return 1;
+
+  reader->pos = reader->buffer;
+  reader->end = reader->buffer;
+  return 0;
+}
+
+int reader_init_mmap(struct Reader *reader, int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return 1;
+
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return 1;
+
+  // Job files are scanned front to back exactly once
+  posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+  reader->kind = READER_MMAP;
+  reader->fd = -1;
+  reader->buffer = NULL;
+  reader->map = map;
+  reader->length = (size_t)st.st_size;
+  reader->pos = map;
+  reader->end = reader->pos + reader->length;
+  return 0;
+}
+
+void reader_init_memory(struct Reader *reader, const char *data,
+                        size_t length) {
+  reader->kind = READER_MEMORY;
+  reader->fd = -1;
+  reader->buffer = NULL;
+  reader->map = NULL;
+  reader->length = length;
+  reader->pos = data;
+  reader->end = data + length;
+}
+
+int reader_open(struct Reader *reader, int fd) {
+  if (reader_init_mmap(reader, fd) == 0)
+    return 0;
+
+  // Empty files, pipes and other unmappable inputs are read in blocks
+  return reader_init_buffered(reader, fd);
+}
+
+void reader_destroy(struct Reader *reader) {
+  switch (reader->kind) {
+  case READER_BUFFERED:
+    free(reader->buffer);
+    reader->buffer = NULL;
+    break;
+
+  case READER_MMAP:
+    munmap(reader->map, reader->length);
+    reader->map = NULL;
+    break;
+
+  case READER_MEMORY:
+    break;
+  }
+
+  reader->pos = NULL;
+  reader->end = NULL;
+}
+
+size_t reader_refill(struct Reader *reader) {
+  if (reader->kind != READER_BUFFERED)
+    return 0; // Mappings and memory regions are fully available up front
+
+  while (1) {
+    ssize_t bytes_read = read(reader->fd, reader->buffer, READER_BUFFER_SIZE);
+
+    if (bytes_read == -1) {
+      if (errno == EINTR) {
+        // The read was interrupted by a signal, try again
+        continue;
+      }
+      return 0;
+    }
+
+    reader->pos = reader->buffer;
+    reader->end = reader->buffer + bytes_read;
+    return (size_t)bytes_read;
+  }
+}
+
+size_t reader_read(struct Reader *reader, char *buf, size_t count) {
+  size_t total_read = 0;
+
+  while (total_read < count) {
+    if (reader->pos == reader->end && reader_refill(reader) == 0)
+      break;
+
+    size_t available = (size_t)(reader->end - reader->pos);
+    size_t chunk =
+        available < count - total_read ? available : count - total_read;
+
+    memcpy(buf + total_read, reader->pos, chunk);
+    reader->pos += chunk;
+    total_read += chunk;
+  }
+
+  return total_read;
+}
@@ -0,0 +1,81 @@
+#ifndef EMS_READER_H
+#define EMS_READER_H
+
+#include <stddef.h>
+
+#define READER_BUFFER_SIZE 65536
+
+enum ReaderKind {
+  READER_BUFFERED, // Refills an internal buffer with large read(2) calls
+  READER_MMAP,     // Scans a read-only mapping of the whole file
+  READER_MEMORY    // Scans a caller-owned memory region
+};
+
+struct Reader {
+  enum ReaderKind kind; /// Backing implementation.
+  int fd;               /// File descriptor being read (buffered readers).
+
+  const char *pos; /// Next byte to be consumed.
+  const char *end; /// One past the last byte currently available.
+
+  char *buffer;  /// Internal buffer (buffered readers).
+  void *map;     /// Start of the mapping (mmap readers).
+  size_t length; /// Length of the mapping (mmap readers).
+};
+
+/// Initializes a reader that refills an internal buffer from a file
+/// descriptor.
+/// @param reader Reader to initialize.
+/// @param fd File descriptor to read from. Not closed by the reader.
+/// @return 0 if the reader was initialized successfully, 1 otherwise.
+int reader_init_buffered(struct Reader *reader, int fd);
+
+/// Initializes a reader that scans a read-only mapping of a regular file.
+/// @param reader Reader to initialize.
+/// @param fd File descriptor of the file to map. May be closed afterwards.
+/// @return 0 if the reader was initialized successfully, 1 otherwise.
+int reader_init_mmap(struct Reader *reader, int fd);
+
+/// Initializes a reader over a memory region owned by the caller.
+/// @param reader Reader to initialize.
+/// @param data Start of the region.
+/// @param length Length of the region.
+void reader_init_memory(struct Reader *reader, const char *data,
+                        size_t length);
+
+/// Initializes the fastest available reader for a file descriptor, falling
+/// back to a buffered reader when the file cannot be mapped.
+/// @param reader Reader to initialize.
+/// @param fd File descriptor to read from.
+/// @return 0 if the reader was initialized successfully, 1 otherwise.
+int reader_open(struct Reader *reader, int fd);
+
+/// Releases the resources held by a reader.
+/// @param reader Reader to destroy.
+void reader_destroy(struct Reader *reader);
+
+/// Refills the reader's window. Only called when it has been exhausted.
+/// @param reader Reader to refill.
+/// @return Number of bytes made available, 0 on end of file or error.
+size_t reader_refill(struct Reader *reader);
+
+/// Reads a single byte.
+/// @param reader Reader to read from.
+/// @param ch Pointer to the variable to store the byte in.
+/// @return 1 if a byte was read, 0 on end of file.
+static inline int reader_getc(struct Reader *reader, char *ch) {
+  if (reader->pos == reader->end && reader_refill(reader) == 0)
+    return 0;
+
+  *ch = *reader->pos++;
+  return 1;
+}
+
+/// Reads up to count bytes, stopping early only at end of file.
+/// @param reader Reader to read from.
+/// @param buf Buffer to store the bytes in.
+/// @param count Number of bytes to read.
+/// @return Number of bytes read.
+size_t reader_read(struct Reader *reader, char *buf, size_t count);
+
+#endif // EMS_READER_H
@@ -0,0 +1,132 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS is not part of POSIX.1-2008
+
+#include "scheduler.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define SLICE(head, tail) ((uint64_t)(head) | (uint64_t)(tail) << 32)
+#define SLICE_HEAD(slice) ((uint32_t)(slice))
+#define SLICE_TAIL(slice) ((uint32_t)((slice) >> 32))
+
+struct SizedFile {
+  off_t size;
+  uint32_t index;
+};
+
+// Orders files from largest to smallest, keeping directory order on ties
+static int compare_sizes(const void *a, const void *b) {
+  const struct SizedFile *x = a;
+  const struct SizedFile *y = b;
+
+  if (x->size != y->size)
+    return x->size < y->size ? 1 : -1;
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+struct Schedule *schedule_create(const off_t *sizes, size_t num_files,
+                                 size_t num_workers, int largest_first) {
+  if (num_workers == 0 || num_files > UINT32_MAX)
+    return NULL;
+
+  struct Schedule *schedule = malloc(sizeof(struct Schedule));
+  struct SizedFile *files = malloc(num_files * sizeof(struct SizedFile));
+  // Checks if malloc failed
+  if (schedule == NULL || (files == NULL && num_files > 0)) {
+    free(schedule);
+    free(files);
+    return NULL;
+  }
+
+  schedule->num_workers = num_workers;
+  schedule->num_files = num_files;
+  schedule->order = malloc(num_files * sizeof(uint32_t));
+  // Only the slices change after fork, so only they have to be shared
+  schedule->length = num_workers * sizeof(_Atomic uint64_t);
+  void *map = mmap(NULL, schedule->length, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if ((schedule->order == NULL && num_files > 0) || map == MAP_FAILED) {
+    if (map != MAP_FAILED)
+      munmap(map, schedule->length);
+    free(schedule->order);
+    free(schedule);
+    free(files);
+    return NULL;
+  }
+  schedule->slices = map;
+
+  for (size_t i = 0; i < num_files; i++) {
+    files[i].size = sizes[i];
+    files[i].index = (uint32_t)i;
+  }
+  if (largest_first) {
+    qsort(files, num_files, sizeof(struct SizedFile), compare_sizes);
+  }
+
+  // Deals the files out like cards, so with largest_first every slice starts
+  // with a share of the largest files
+  size_t head = 0;
+  for (size_t w = 0; w < num_workers; w++) {
+    size_t tail = head;
+    for (size_t i = w; i < num_files; i += num_workers) {
+      schedule->order[tail++] = files[i].index;
+    }
+    atomic_init(&schedule->slices[w], SLICE(head, tail));
+    head = tail;
+  }
+
+  free(files);
+  return schedule;
+}
+
+void schedule_destroy(struct Schedule *schedule) {
+  if (schedule == NULL)
+    return;
+
+  munmap((void *)schedule->slices, schedule->length);
+  free(schedule->order);
+  free(schedule);
+}
+
+// Takes the file at the front of a slice
+static ssize_t take_front(struct Schedule *schedule, size_t worker) {
+  uint64_t slice = atomic_load(&schedule->slices[worker]);
+
+  while (SLICE_HEAD(slice) < SLICE_TAIL(slice)) {
+    if (atomic_compare_exchange_weak(
+            &schedule->slices[worker], &slice,
+            SLICE(SLICE_HEAD(slice) + 1, SLICE_TAIL(slice)))) {
+      return schedule->order[SLICE_HEAD(slice)];
+    }
+  }
+  return -1;
+}
+
+// Takes the file at the back of another worker's slice
+static ssize_t take_back(struct Schedule *schedule, size_t victim) {
+  uint64_t slice = atomic_load(&schedule->slices[victim]);
+
+  while (SLICE_HEAD(slice) < SLICE_TAIL(slice)) {
+    if (atomic_compare_exchange_weak(
+            &schedule->slices[victim], &slice,
+            SLICE(SLICE_HEAD(slice), SLICE_TAIL(slice) - 1))) {
+      return schedule->order[SLICE_TAIL(slice) - 1];
+    }
+  }
+  return -1;
+}
+
+ssize_t schedule_next(struct Schedule *schedule, size_t worker) {
+  ssize_t file = take_front(schedule, worker);
+  if (file >= 0)
+    return file;
+
+  // Files are never added back, so one pass over the others is enough
+  for (size_t i = 1; i < schedule->num_workers; i++) {
+    file = take_back(schedule, (worker + i) % schedule->num_workers);
+    if (file >= 0)
+      return file;
+  }
+  return -1;
+}
@@ -0,0 +1,41 @@
+#ifndef EMS_SCHEDULER_H
+#define EMS_SCHEDULER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Hands out job files to a fixed set of worker processes. Each worker owns a
+// slice of the files and takes them from the front; a worker whose slice is
+// empty steals from the back of another's. The schedule lives in a shared
+// mapping so it keeps working across fork.
+struct Schedule {
+  size_t num_workers; /// Number of slices.
+  size_t num_files;   /// Number of files scheduled.
+  _Atomic uint64_t *slices; /// Per worker, next index to take in the low half
+                            /// and one past the last index in the high half.
+  uint32_t *order; /// Files to process, each worker's slice is contiguous.
+  size_t length;   /// Size of the mapping.
+};
+
+/// Creates a schedule, splitting the files evenly between the workers.
+/// @param sizes Size of each file, used to order the files if requested.
+/// @param num_files Number of files, less than 2^32.
+/// @param num_workers Number of workers.
+/// @param largest_first If set, every worker starts with the largest files.
+/// @return The schedule, NULL on failure.
+struct Schedule *schedule_create(const off_t *sizes, size_t num_files,
+                                 size_t num_workers, int largest_first);
+
+/// Destroys a schedule. Must only be called once, after the workers exit.
+/// @param schedule Schedule to destroy.
+void schedule_destroy(struct Schedule *schedule);
+
+/// Takes the next file for a worker, stealing one if its slice is empty.
+/// @param schedule Schedule to take from.
+/// @param worker Index of the calling worker.
+/// @return Index of the file, -1 once every file has been taken.
+ssize_t schedule_next(struct Schedule *schedule, size_t worker);
+
+#endif // EMS_SCHEDULER_H
@@ -0,0 +1,301 @@
+#include "seats.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+
+// Rendering of 32 free seats, each preceded by its separator
+static const char free_seats[] = " 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0"
+                                 " 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0";
+
+// Defines the kernels for cells of one type, so the loops over many cells
+// run without checking the width of each one
+#define SEAT_KERNELS(type)                                                     \
+  static void read_##type(const type *cells, size_t count,                     \
+                          unsigned int *ids) {                                 \
+    for (size_t i = 0; i < count; i++) {                                       \
+      ids[i] = cells[i];                                                       \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static int render_##type(const type *cells, size_t count, int first,        \
+                           struct Buffer *out) {                               \
+    int failed = 0;                                                            \
+    for (size_t i = 0; i < count; i++) {                                       \
+      if (i > 0 || !first) {                                                   \
+        failed |= buffer_append(out, " ", 1);                                  \
+      }                                                                        \
+      failed |= buffer_append_uint(out, cells[i]);                             \
+    }                                                                          \
+    return failed;                                                             \
+  }
+
+SEAT_KERNELS(uint8_t)
+SEAT_KERNELS(uint16_t)
+SEAT_KERNELS(uint32_t)
+
+_Static_assert(sizeof(unsigned int) == sizeof(uint32_t),
+               "reservation ids must be 32 bits wide");
+_Static_assert((SEAT_TILE_SEATS & (SEAT_TILE_SEATS - 1)) == 0,
+               "tiles must hold a power of two seats");
+
+unsigned int seat_width_for(unsigned int id) {
+  return id <= UINT8_MAX ? 1 : id <= UINT16_MAX ? 2 : 4;
+}
+
+unsigned int seat_grid_limit(unsigned int width) {
+  return width == 1 ? UINT8_MAX : width == 2 ? UINT16_MAX : UINT_MAX;
+}
+
+size_t seat_grid_num_tiles(size_t num_seats) {
+  return num_seats / SEAT_TILE_SEATS + (num_seats % SEAT_TILE_SEATS != 0);
+}
+
+// Number of seats of a tile, only the last one may be partial
+static size_t tile_seats(const struct SeatGrid *grid, size_t tile) {
+  size_t left = grid->num_seats - tile * SEAT_TILE_SEATS;
+  return left < SEAT_TILE_SEATS ? left : SEAT_TILE_SEATS;
+}
+
+static void *load_tile(const struct SeatGrid *grid, size_t tile) {
+  return atomic_load_explicit(&grid->tiles[tile], memory_order_acquire);
+}
+
+void seat_grid_init(struct SeatGrid *grid, _Atomic(void *) *tiles,
+                    size_t num_seats, unsigned int width) {
+  grid->tiles = tiles;
+  grid->num_seats = num_seats;
+  grid->width = width;
+}
+
+void seat_grid_place(struct SeatGrid *grid, void *cells) {
+  for (size_t tile = 0; tile < seat_grid_num_tiles(grid->num_seats); tile++) {
+    atomic_store_explicit(
+        &grid->tiles[tile],
+        (char *)cells + tile * SEAT_TILE_SEATS * grid->width,
+        memory_order_relaxed);
+  }
+}
+
+int seat_grid_has_tile(const struct SeatGrid *grid, size_t tile) {
+  return load_tile(grid, tile) != NULL;
+}
+
+int seat_grid_touch(struct SeatGrid *grid, size_t index, struct Arena *arena) {
+  size_t tile = index / SEAT_TILE_SEATS;
+  if (load_tile(grid, tile) != NULL)
+    return 0;
+
+  void *cells = arena_alloc(arena, tile_seats(grid, tile) * grid->width);
+  if (cells == NULL)
+    return 1;
+
+  // Seats of a tile may span rows locked by different threads. The loser of
+  // a race hands its cells back to the arena.
+  void *expected = NULL;
+  if (!atomic_compare_exchange_strong_explicit(&grid->tiles[tile], &expected,
+                                               cells, memory_order_acq_rel,
+                                               memory_order_acquire)) {
+    arena_recycle(arena, cells, tile_seats(grid, tile) * grid->width);
+  }
+  return 0;
+}
+
+unsigned int seat_grid_get(const struct SeatGrid *grid, size_t index) {
+  const void *cells = load_tile(grid, index / SEAT_TILE_SEATS);
+  size_t offset = index % SEAT_TILE_SEATS;
+
+  if (cells == NULL)
+    return 0;
+  switch (grid->width) {
+  case 1:
+    return ((const uint8_t *)cells)[offset];
+  case 2:
+    return ((const uint16_t *)cells)[offset];
+  default:
+    return ((const uint32_t *)cells)[offset];
+  }
+}
+
+void seat_grid_set(struct SeatGrid *grid, size_t index, unsigned int id) {
+  void *cells = load_tile(grid, index / SEAT_TILE_SEATS);
+  size_t offset = index % SEAT_TILE_SEATS;
+
+  if (cells == NULL)
+    return; // Only freeing a seat, which already is free
+  switch (grid->width) {
+  case 1:
+    ((uint8_t *)cells)[offset] = (uint8_t)id;
+    break;
+  case 2:
+    ((uint16_t *)cells)[offset] = (uint16_t)id;
+    break;
+  default:
+    ((uint32_t *)cells)[offset] = id;
+    break;
+  }
+}
+
+void seat_grid_read(const struct SeatGrid *grid, size_t first, size_t count,
+                    unsigned int *ids) {
+  // Goes through the range one tile at a time
+  while (count > 0) {
+    size_t offset = first % SEAT_TILE_SEATS;
+    size_t chunk = SEAT_TILE_SEATS - offset < count ? SEAT_TILE_SEATS - offset
+                                                    : count;
+    const void *cells = load_tile(grid, first / SEAT_TILE_SEATS);
+
+    if (cells == NULL) {
+      memset(ids, 0, chunk * sizeof(unsigned int));
+    } else if (grid->width == 1) {
+      read_uint8_t((const uint8_t *)cells + offset, chunk, ids);
+    } else if (grid->width == 2) {
+      read_uint16_t((const uint16_t *)cells + offset, chunk, ids);
+    } else {
+      read_uint32_t((const uint32_t *)cells + offset, chunk, ids);
+    }
+
+    first += chunk;
+    count -= chunk;
+    ids += chunk;
+  }
+}
+
+// Number of seats in the allocated tiles of a grid
+static size_t allocated_seats(const struct SeatGrid *grid) {
+  size_t seats = 0;
+  for (size_t tile = 0; tile < seat_grid_num_tiles(grid->num_seats); tile++) {
+    if (load_tile(grid, tile) != NULL) {
+      seats += tile_seats(grid, tile);
+    }
+  }
+  return seats;
+}
+
+int seat_grid_fit(struct SeatGrid *grid, unsigned int id,
+                  struct Arena *arena) {
+  if (id <= seat_grid_limit(grid->width))
+    return 0;
+
+  // Every new tile is allocated before any is replaced, so failing leaves
+  // the grid as it was. The size of the widest cells is checked when the
+  // event is created.
+  unsigned int width = seat_width_for(id);
+  size_t num_tiles = seat_grid_num_tiles(grid->num_seats);
+  void **wide = calloc(num_tiles, sizeof(void *));
+  if (wide == NULL)
+    return 1;
+  for (size_t tile = 0; tile < num_tiles; tile++) {
+    if (load_tile(grid, tile) != NULL &&
+        (wide[tile] = arena_alloc(arena, tile_seats(grid, tile) * width)) ==
+            NULL) {
+      while (tile-- > 0) {
+        arena_recycle(arena, wide[tile], tile_seats(grid, tile) * width);
+      }
+      free(wide);
+      return 1;
+    }
+  }
+
+  // Both grids share the tile array, each tile is read at the old width
+  // before it is replaced, then its old cells are handed back
+  struct SeatGrid wider = *grid;
+  wider.width = width;
+  unsigned int ids[SEAT_TILE_SEATS];
+  for (size_t tile = 0; tile < num_tiles; tile++) {
+    void *narrow = load_tile(grid, tile);
+    if (narrow == NULL)
+      continue;
+
+    size_t count = tile_seats(grid, tile);
+    seat_grid_read(grid, tile * SEAT_TILE_SEATS, count, ids);
+    atomic_store_explicit(&grid->tiles[tile], wide[tile],
+                          memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+      seat_grid_set(&wider, tile * SEAT_TILE_SEATS + i, ids[i]);
+    }
+    arena_recycle(arena, narrow, count * grid->width);
+  }
+
+  free(wide);
+  grid->width = width;
+  return 0;
+}
+
+int seat_grid_clone(struct SeatGrid *copy, const struct SeatGrid *grid) {
+  size_t num_tiles = seat_grid_num_tiles(grid->num_seats);
+  size_t tiles_size = num_tiles * sizeof(_Atomic(void *));
+  _Atomic(void *) *tiles =
+      calloc(1, tiles_size + allocated_seats(grid) * grid->width);
+  if (tiles == NULL)
+    return 1;
+
+  seat_grid_init(copy, tiles, grid->num_seats, grid->width);
+  char *cells = (char *)tiles + tiles_size;
+  for (size_t tile = 0; tile < num_tiles; tile++) {
+    if (load_tile(grid, tile) != NULL) {
+      atomic_init(&tiles[tile], cells);
+      cells += tile_seats(grid, tile) * grid->width;
+    }
+  }
+  return 0;
+}
+
+void seat_grid_free(struct SeatGrid *copy) { free(copy->tiles); }
+
+// Renders a run of free seats
+static int render_free(size_t count, int first, struct Buffer *out) {
+  int failed = 0;
+
+  // The first seat of a row has no separator
+  if (first && count > 0) {
+    failed |= buffer_append(out, "0", 1);
+    count--;
+  }
+  while (count > 0) {
+    size_t chunk = count < sizeof(free_seats) / 2 ? count
+                                                  : sizeof(free_seats) / 2;
+    failed |= buffer_append(out, free_seats, chunk * 2);
+    count -= chunk;
+  }
+  return failed;
+}
+
+int seat_grid_render(const struct SeatGrid *grid, size_t rows, size_t cols,
+                     struct Buffer *out) {
+  int failed = 0;
+
+  for (size_t row = 0; row < rows; row++) {
+    size_t index = row * cols;
+    size_t end = index + cols;
+
+    // A row may span several tiles, and a tile several rows
+    while (index < end) {
+      size_t offset = index % SEAT_TILE_SEATS;
+      size_t count = SEAT_TILE_SEATS - offset < end - index
+                         ? SEAT_TILE_SEATS - offset
+                         : end - index;
+      const void *cells = load_tile(grid, index / SEAT_TILE_SEATS);
+      int first = index == row * cols;
+
+      if (cells == NULL) {
+        failed |= render_free(count, first, out);
+      } else if (grid->width == 1) {
+        failed |= render_uint8_t((const uint8_t *)cells + offset, count,
+                                 first, out);
+      } else if (grid->width == 2) {
+        failed |= render_uint16_t((const uint16_t *)cells + offset, count,
+                                  first, out);
+      } else {
+        failed |= render_uint32_t((const uint32_t *)cells + offset, count,
+                                  first, out);
+      }
+      index += count;
+    }
+
+    failed |= buffer_append(out, "\n", 1);
+  }
+  return failed;
+}
@@ -0,0 +1,125 @@
+#ifndef EMS_SEATS_H
+#define EMS_SEATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "output.h"
+
+// Reservation ids of the seats of an event, stored as narrow as the ids
+// handed out so far allow. A grid starts with one byte per seat and is
+// widened to two, then four, once an id no longer fits; most events never
+// get past the first width.
+//
+// Seats are split into tiles of SEAT_TILE_SEATS consecutive seats, and a
+// tile is only allocated once a seat in it is reserved. Tiles never
+// allocated read as free, so the memory of a grid follows its reservations
+// rather than its capacity.
+//
+// Reading and writing cells needs no lock of its own, and tiles may be
+// allocated concurrently. Widening replaces every tile, so the caller must
+// keep every other access out while it runs.
+
+struct SeatGrid {
+  _Atomic(void *) *tiles; /// Cells of each tile, NULL if not allocated.
+  size_t num_seats;       /// Number of seats.
+  unsigned int width;     /// Bytes per cell: 1, 2 or 4.
+};
+
+/// Gets the narrowest width of a cell that holds an id.
+/// @param id Reservation id.
+/// @return Width in bytes: 1, 2 or 4.
+unsigned int seat_width_for(unsigned int id);
+
+/// Gets the largest id that fits in cells of a given width.
+/// @param width Width of a cell in bytes.
+/// @return Largest id.
+unsigned int seat_grid_limit(unsigned int width);
+
+/// Gets the number of tiles of a grid.
+/// @param num_seats Number of seats.
+/// @return Number of tiles.
+size_t seat_grid_num_tiles(size_t num_seats);
+
+/// Initializes a grid with every seat free and no tile allocated.
+/// @param grid Grid to initialize.
+/// @param tiles Zeroed array of seat_grid_num_tiles(num_seats) tiles.
+/// @param num_seats Number of seats.
+/// @param width Width of a cell in bytes.
+void seat_grid_init(struct SeatGrid *grid, _Atomic(void *) *tiles,
+                    size_t num_seats, unsigned int width);
+
+/// Places every tile of a grid in contiguous cells, such as a snapshot
+/// mapping or memory allocated along with the grid.
+/// @param grid Grid to place, initialized.
+/// @param cells Cells of every seat, num_seats * width bytes.
+void seat_grid_place(struct SeatGrid *grid, void *cells);
+
+/// Checks if a tile of a grid is allocated.
+/// @param grid Grid to check.
+/// @param tile Index of the tile.
+/// @return 1 if it is, 0 if every seat in it is free.
+int seat_grid_has_tile(const struct SeatGrid *grid, size_t tile);
+
+/// Allocates the tile holding a seat, if it is not allocated yet.
+/// @param grid Grid the seat belongs to.
+/// @param index Index of the seat.
+/// @param arena Arena to allocate the tile from.
+/// @return 0 if the tile is allocated, 1 if out of memory.
+int seat_grid_touch(struct SeatGrid *grid, size_t index, struct Arena *arena);
+
+/// Gets the reservation id of a seat.
+/// @param grid Grid to read.
+/// @param index Index of the seat.
+/// @return Reservation id, 0 if the seat is free.
+unsigned int seat_grid_get(const struct SeatGrid *grid, size_t index);
+
+/// Sets the reservation id of a seat.
+/// @param grid Grid to write.
+/// @param index Index of the seat.
+/// @param id Reservation id, must be at most seat_grid_limit(grid->width).
+/// Unless it is 0, the seat's tile must be allocated.
+void seat_grid_set(struct SeatGrid *grid, size_t index, unsigned int id);
+
+/// Copies the reservation ids of a range of seats out as full-width ids.
+/// @param grid Grid to read.
+/// @param first Index of the first seat.
+/// @param count Number of seats.
+/// @param ids Array of count ids to store them in.
+void seat_grid_read(const struct SeatGrid *grid, size_t first, size_t count,
+                    unsigned int *ids);
+
+/// Widens the cells of a grid, if needed, so that an id fits in them. Every
+/// allocated tile is replaced by one from an arena, and its old cells are
+/// handed back to the arena, which they must come from.
+/// @note No other thread may access the grid meanwhile.
+/// @param grid Grid to widen.
+/// @param id Reservation id that must fit.
+/// @param arena Arena to allocate the new tiles from.
+/// @return 0 if the id fits, 1 if out of memory (the grid is unchanged).
+int seat_grid_fit(struct SeatGrid *grid, unsigned int id,
+                  struct Arena *arena);
+
+/// Allocates a grid with the same width and allocated tiles as another,
+/// every seat free, in a single block of memory.
+/// @param copy Grid to initialize.
+/// @param grid Grid to take the layout of.
+/// @return 0 if the grid was allocated, 1 if out of memory.
+int seat_grid_clone(struct SeatGrid *copy, const struct SeatGrid *grid);
+
+/// Frees a grid allocated by seat_grid_clone.
+/// @param copy Grid to free.
+void seat_grid_free(struct SeatGrid *copy);
+
+/// Renders the seats of a grid, one line per row of space-separated ids.
+/// @param grid Grid to render.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @param out Buffer to render the seats in.
+/// @return 0 if the seats were rendered, 1 if out of memory.
+int seat_grid_render(const struct SeatGrid *grid, size_t rows, size_t cols,
+                     struct Buffer *out);
+
+#endif // EMS_SEATS_H
@@ -0,0 +1,540 @@
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "reader.h"
+
+struct ServerWorker {
+  struct Server *server; /// Server the worker belongs to.
+  int id;                /// Index of the worker's statistics.
+  pthread_t thread;      /// Thread of the worker.
+};
+
+// Write end of the wake pipe of the running server, for the signal handler
+static int stop_fd = -1;
+static volatile sig_atomic_t stopping = 0;
+
+/// Stops the running server. Called from a signal handler.
+static void handle_stop(int signum) {
+  int saved_errno = errno;
+
+  (void)signum;
+  stopping = 1;
+  if (write(stop_fd, "", 1) == -1) {
+    // The pipe is full, so the front end wakes up anyway
+  }
+  errno = saved_errno;
+}
+
+/// Makes the operations on a file descriptor return instead of blocking.
+/// @return 0 if the flag was set, 1 otherwise.
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1;
+}
+
+/// Opens the listening socket of a server.
+/// @param path Path of the socket.
+/// @return File descriptor, -1 on failure (an error is printed).
+static int open_socket(const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+  // Only replaces a socket that no server listens on anymore
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode) ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      fprintf(stderr, "Socket path already in use: %s\n", path);
+      close(fd);
+      return -1;
+    }
+    unlink(path);
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SERVER_BACKLOG) != 0 || set_nonblocking(fd) != 0) {
+    fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// Closes a connection and frees it. Its command must not be executing.
+static void close_connection(struct Server *server, struct Connection *conn) {
+  if (conn->prev != NULL) {
+    conn->prev->next = conn->next;
+  } else {
+    server->clients = conn->next;
+  }
+  if (conn->next != NULL) {
+    conn->next->prev = conn->prev;
+  }
+  server->num_clients--;
+
+  close(conn->fd);
+  buffer_free(&conn->in);
+  buffer_free(&conn->out);
+  free(conn);
+}
+
+/// Gives up on sending outputs to a client and on reading from it. The
+/// commands it already sent are still executed.
+static void drop_output(struct Server *server, struct Connection *conn) {
+  if (!conn->dead) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  }
+  conn->dead = 1;
+  conn->hangup = 1;
+
+  // A worker writes the outputs while it executes a command, so they are
+  // thrown away once it completes
+  if (!conn->busy) {
+    conn->out.length = 0;
+    conn->sent = 0;
+  }
+}
+
+/// Sends as much of the outputs of a client as its socket takes.
+static void send_output(struct Server *server, struct Connection *conn) {
+  while (conn->sent < conn->out.length) {
+    ssize_t sent = send(conn->fd, conn->out.data + conn->sent,
+                        conn->out.length - conn->sent, MSG_NOSIGNAL);
+
+    if (sent == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN) {
+        drop_output(server, conn);
+      }
+      return;
+    }
+    conn->sent += (size_t)sent;
+  }
+
+  // Everything was sent, the memory is reused for the next outputs
+  conn->out.length = 0;
+  conn->sent = 0;
+}
+
+/// Reads what a client sent, up to SERVER_MAX_PENDING bytes not parsed yet.
+static void receive_input(struct Server *server, struct Connection *conn) {
+  char chunk[SERVER_READ_SIZE];
+
+  // Moves the bytes not parsed yet to the front
+  if (conn->consumed > 0) {
+    memmove(conn->in.data, conn->in.data + conn->consumed,
+            conn->in.length - conn->consumed);
+    conn->in.length -= conn->consumed;
+    conn->consumed = 0;
+  }
+
+  while (conn->in.length < SERVER_MAX_PENDING) {
+    ssize_t received = read(conn->fd, chunk, sizeof(chunk));
+
+    if (received == 0) {
+      conn->hangup = 1;
+      return;
+    }
+    if (received == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN) {
+        drop_output(server, conn);
+      }
+      return;
+    }
+    if (buffer_append(&conn->in, chunk, (size_t)received) != 0) {
+      fprintf(stderr, "Failed to allocate memory for client\n");
+      drop_output(server, conn);
+      return;
+    }
+  }
+}
+
+/// Parses the next command of a client and hands it to the workers, unless
+/// one is executing or the client is not reading its outputs.
+static void dispatch(struct Server *server, struct Connection *conn) {
+  while (!conn->busy && conn->out.length - conn->sent < SERVER_MAX_PENDING) {
+    size_t left = conn->in.length - conn->consumed;
+    if (left == 0)
+      return;
+
+    const char *start = conn->in.data + conn->consumed;
+    const char *newline = memchr(start, '\n', left);
+    size_t length;
+    if (newline != NULL) {
+      length = (size_t)(newline - start) + 1;
+    } else if (conn->hangup) {
+      length = left; // The last command may lack its newline
+    } else {
+      if (left >= SERVER_MAX_PENDING) {
+        fprintf(stderr, "Command too long\n");
+        conn->consumed = conn->in.length;
+        drop_output(server, conn);
+      }
+      return;
+    }
+
+    // Each command is parsed on its own, so it never runs into the next one
+    struct Reader reader;
+    reader_init_memory(&reader, start, length);
+    uint64_t parsing = stats_now();
+    enum Command type = parse_command(&reader, &conn->cmd);
+    stats_record(STATS_PARSE, parsing);
+    conn->consumed += (size_t)(reader.pos - start);
+
+    // Commands of a connection already wait for each other
+    if (type == CMD_EMPTY || type == CMD_BARRIER)
+      continue;
+
+    conn->busy = 1;
+    queue_push(&server->ready, conn);
+  }
+}
+
+/// Closes a connection once it is done, or waits for what it needs next.
+static void settle(struct Server *server, struct Connection *conn) {
+  if (!conn->busy && conn->hangup && conn->consumed == conn->in.length &&
+      conn->sent == conn->out.length) {
+    close_connection(server, conn);
+    return;
+  }
+  if (conn->dead)
+    return;
+
+  uint32_t events = 0;
+  if (!conn->hangup && conn->in.length - conn->consumed < SERVER_MAX_PENDING) {
+    events |= EPOLLIN;
+  }
+  if (!conn->busy && conn->sent < conn->out.length) {
+    events |= EPOLLOUT;
+  }
+  if (events != conn->events) {
+    struct epoll_event event = {.events = events, .data.ptr = conn};
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->events = events;
+  }
+}
+
+/// Accepts every pending client.
+static void accept_clients(struct Server *server) {
+  while (1) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN) {
+        fprintf(stderr, "Failed to accept client: %s\n", strerror(errno));
+      }
+      return;
+    }
+    if (server->num_clients == SERVER_MAX_CLIENTS) {
+      fprintf(stderr, "Too many clients\n");
+      close(fd);
+      continue;
+    }
+
+    struct Connection *conn = calloc(1, sizeof(struct Connection));
+    if (conn == NULL || set_nonblocking(fd) != 0) {
+      fprintf(stderr, "Failed to accept client\n");
+      free(conn);
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    conn->events = EPOLLIN;
+    buffer_init(&conn->in);
+    buffer_init(&conn->out);
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      fprintf(stderr, "Failed to accept client: %s\n", strerror(errno));
+      free(conn);
+      close(fd);
+      continue;
+    }
+
+    conn->next = server->clients;
+    if (server->clients != NULL) {
+      server->clients->prev = conn;
+    }
+    server->clients = conn;
+    server->num_clients++;
+  }
+}
+
+/// Serves the events of a client's socket.
+static void serve_client(struct Server *server, struct Connection *conn,
+                         uint32_t events) {
+  // Commands received before a hangup are still executed
+  if (events & EPOLLIN) {
+    receive_input(server, conn);
+  }
+  if (!conn->dead && (events & (EPOLLERR | EPOLLHUP))) {
+    drop_output(server, conn);
+  }
+  if (!conn->dead && (events & EPOLLOUT)) {
+    send_output(server, conn);
+  }
+  dispatch(server, conn);
+  settle(server, conn);
+}
+
+/// Sends the outputs of the commands the workers completed, and dispatches
+/// the next commands of their connections.
+static void complete_commands(struct Server *server) {
+  char drained[64];
+  while (read(server->wake[0], drained, sizeof(drained)) > 0)
+    ;
+
+  pthread_mutex_lock(&server->lock);
+  struct Connection *done = server->done;
+  server->done = NULL;
+  pthread_mutex_unlock(&server->lock);
+
+  while (done != NULL) {
+    struct Connection *conn = done;
+    done = conn->done;
+
+    conn->busy = 0;
+    if (conn->dead) {
+      conn->out.length = 0;
+      conn->sent = 0;
+    } else {
+      send_output(server, conn);
+    }
+    dispatch(server, conn);
+    settle(server, conn);
+  }
+}
+
+/// Executes the commands the front end hands out, until it hands out NULL.
+static void *server_worker(void *arg) {
+  struct ServerWorker *worker = arg;
+  struct Server *server = worker->server;
+
+  stats_attach(&server->stats[worker->id]);
+  while (1) {
+    struct Connection *conn = queue_pop(&server->ready);
+    if (conn == NULL)
+      break;
+
+    server->handler(server->context, &conn->cmd, &conn->out);
+
+    pthread_mutex_lock(&server->lock);
+    int first = server->done == NULL;
+    conn->done = server->done;
+    server->done = conn;
+    pthread_mutex_unlock(&server->lock);
+
+    // A single byte wakes the front end for every command completed until
+    // it takes the list
+    if (first && write(server->wake[1], "", 1) == -1) {
+      // The pipe is full, so the front end wakes up anyway
+    }
+  }
+  stats_attach(NULL);
+  return NULL;
+}
+
+/// Waits for the sockets of a server and serves them, until stopped.
+static void run_front_end(struct Server *server) {
+  struct epoll_event events[SERVER_MAX_EVENTS];
+
+  while (!stopping) {
+    int count = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+    if (count == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Failed to wait for clients: %s\n", strerror(errno));
+      return;
+    }
+
+    // Completions may close connections, so they wait until no event of
+    // this batch refers to one
+    int woken = 0;
+    for (int i = 0; i < count; i++) {
+      void *source = events[i].data.ptr;
+      if (source == &server->listen_fd) {
+        accept_clients(server);
+      } else if (source == &server->wake[0]) {
+        woken = 1;
+      } else {
+        serve_client(server, source, events[i].events);
+      }
+    }
+    if (woken) {
+      complete_commands(server);
+    }
+  }
+}
+
+/// Creates the sockets, pipe and queue of a server.
+/// @return 0 if the server was opened, 1 otherwise (an error is printed).
+static int open_server(struct Server *server, const char *path) {
+  if ((server->listen_fd = open_socket(path)) == -1)
+    return 1;
+
+  if (pipe(server->wake) != 0) {
+    fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+    close(server->listen_fd);
+    unlink(path);
+    return 1;
+  }
+  struct epoll_event listen_event = {.events = EPOLLIN,
+                                     .data.ptr = &server->listen_fd};
+  struct epoll_event wake_event = {.events = EPOLLIN,
+                                   .data.ptr = &server->wake[0]};
+  if (set_nonblocking(server->wake[0]) != 0 ||
+      set_nonblocking(server->wake[1]) != 0 ||
+      (server->epoll_fd = epoll_create1(0)) == -1 ||
+      epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd,
+                &listen_event) != 0 ||
+      epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake[0],
+                &wake_event) != 0) {
+    fprintf(stderr, "Failed to create epoll instance: %s\n", strerror(errno));
+    if (server->epoll_fd != -1) {
+      close(server->epoll_fd);
+    }
+    close(server->wake[0]);
+    close(server->wake[1]);
+    close(server->listen_fd);
+    unlink(path);
+    return 1;
+  }
+
+  int queued = queue_init(&server->ready, SERVER_MAX_CLIENTS) == 0;
+  if (!queued || pthread_mutex_init(&server->lock, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize command queue\n");
+    if (queued) {
+      queue_destroy(&server->ready);
+    }
+    close(server->epoll_fd);
+    close(server->wake[0]);
+    close(server->wake[1]);
+    close(server->listen_fd);
+    unlink(path);
+    return 1;
+  }
+  return 0;
+}
+
+int server_run(const char *path, int num_workers, struct Stats *stats,
+               ServerHandler handler, void *context) {
+  struct Server server;
+  struct ServerWorker *workers = calloc((size_t)num_workers,
+                                        sizeof(struct ServerWorker));
+
+  if (workers == NULL) {
+    fprintf(stderr, "Failed to allocate memory for workers\n");
+    return 1;
+  }
+  server.epoll_fd = -1;
+  server.clients = NULL;
+  server.num_clients = 0;
+  server.done = NULL;
+  server.handler = handler;
+  server.context = context;
+  server.stats = stats;
+  if (open_server(&server, path) != 0) {
+    free(workers);
+    return 1;
+  }
+
+  // Only the front end handles the stop signals, and they interrupt its
+  // wait for the sockets
+  sigset_t signals;
+  sigset_t previous;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+  int num_started = 0;
+  for (int i = 0; i < num_workers; i++) {
+    workers[i].server = &server;
+    workers[i].id = i;
+    if (pthread_create(&workers[i].thread, NULL, server_worker,
+                       &workers[i]) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      break;
+    }
+    num_started++;
+  }
+
+  struct sigaction action;
+  struct sigaction previous_int;
+  struct sigaction previous_term;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_stop;
+  sigemptyset(&action.sa_mask);
+  stop_fd = server.wake[1];
+  stopping = 0;
+  sigaction(SIGINT, &action, &previous_int);
+  sigaction(SIGTERM, &action, &previous_term);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  if (num_started > 0) {
+    printf("Listening on %s\n", path);
+    fflush(stdout);
+    stats_attach(&stats[num_workers]);
+    run_front_end(&server);
+    stats_attach(NULL);
+  }
+
+  sigaction(SIGINT, &previous_int, NULL);
+  sigaction(SIGTERM, &previous_term, NULL);
+  stop_fd = -1;
+
+  // Workers finish the commands handed out before they stop
+  for (int i = 0; i < num_started; i++) {
+    queue_push(&server.ready, NULL);
+  }
+  for (int i = 0; i < num_started; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  // Sends what the sockets take of the last outputs
+  while (server.clients != NULL) {
+    if (!server.clients->dead) {
+      send_output(&server, server.clients);
+    }
+    close_connection(&server, server.clients);
+  }
+
+  close(server.listen_fd);
+  unlink(path);
+  close(server.epoll_fd);
+  close(server.wake[0]);
+  close(server.wake[1]);
+  queue_destroy(&server.ready);
+  pthread_mutex_destroy(&server.lock);
+  free(workers);
+  return num_started > 0 ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#ifndef EMS_SERVER_H
+#define EMS_SERVER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "output.h"
+#include "parser.h"
+#include "queue.h"
+#include "stats.h"
+
+// Serves the commands of job files to clients of a Unix socket. A single
+// front end thread waits on every connection with epoll, reads the
+// commands and parses them, and writes the outputs back. A pool of workers
+// executes them. The commands of each connection run one at a time, in the
+// order they were sent, so every client sees its outputs in the order of
+// its commands. Different connections run in parallel.
+
+/// Executes a command for a client.
+/// @param context Context given to server_run.
+/// @param cmd Command to execute, never CMD_EMPTY or CMD_BARRIER.
+/// @param out Buffer to append the output of the command to. Must be left
+/// as it was if the command fails.
+typedef void (*ServerHandler)(void *context, struct CommandRecord *cmd,
+                              struct Buffer *out);
+
+struct Connection {
+  int fd;          /// Socket of the client.
+  uint32_t events; /// Events the front end waits for on the socket.
+  int busy;        /// Set while a worker executes cmd.
+  int hangup;      /// Set once the client sent its last command.
+  int dead;        /// Set once outputs can no longer be sent.
+
+  struct Buffer in;          /// Bytes received from the client.
+  size_t consumed;           /// Bytes of in already parsed.
+  struct Buffer out;         /// Outputs to send to the client.
+  size_t sent;               /// Bytes of out already sent.
+  struct CommandRecord cmd;  /// Command being executed.
+
+  struct Connection *prev;   /// Previous connection of the server.
+  struct Connection *next;   /// Next connection of the server.
+  struct Connection *done;   /// Next connection whose command completed.
+};
+
+struct Server {
+  int listen_fd; /// Listening socket.
+  int epoll_fd;  /// Where the front end waits for its sockets.
+  int wake[2];   /// Pipe the front end is woken through.
+
+  struct Connection *clients; /// Every open connection.
+  size_t num_clients;         /// Number of open connections.
+
+  struct Queue ready;         /// Connections with a command to execute.
+  pthread_mutex_t lock;       /// Guards done.
+  struct Connection *done;    /// Connections whose command completed.
+
+  ServerHandler handler; /// Executes the commands.
+  void *context;         /// Context of the handler.
+  struct Stats *stats;   /// Statistics of each worker, then of the front
+                         /// end.
+};
+
+/// Serves clients on a Unix socket until SIGINT or SIGTERM is received. The
+/// socket is created at a path, replacing a stale socket left there, and
+/// removed when the server stops.
+/// @param path Path of the socket.
+/// @param num_workers Number of workers.
+/// @param stats Array of num_workers + 1 statistics for the workers, then
+/// the front end.
+/// @param handler Executes the commands.
+/// @param context Context of the handler.
+/// @return 0 if the server stopped on a signal, 1 if it failed to start.
+int server_run(const char *path, int num_workers, struct Stats *stats,
+               ServerHandler handler, void *context);
+
+#endif // EMS_SERVER_H
@@ -0,0 +1,156 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "output.h"
+
+int snapshot_event_sizes(uint64_t rows, uint64_t cols, size_t sizes[3]) {
+  uint64_t row_words = cols / 64 + (cols % 64 != 0);
+
+  if (rows == 0) {
+    sizes[0] = sizes[1] = sizes[2] = 0;
+    return 0;
+  }
+
+  // Checks that none of the sizes overflow
+  if (rows > SIZE_MAX / sizeof(uint64_t) ||
+      cols > SIZE_MAX / rows / sizeof(uint32_t) ||
+      row_words > SIZE_MAX / rows / sizeof(uint64_t))
+    return 1;
+
+  sizes[0] = (size_t)(rows * cols * sizeof(uint32_t));
+  sizes[1] = (size_t)(rows * row_words * sizeof(uint64_t));
+  sizes[2] = (size_t)(rows * sizeof(uint64_t));
+  return 0;
+}
+
+// Checks that a section lies within the mapping and is aligned
+static int section_valid(const struct Snapshot *snapshot, uint64_t offset,
+                         size_t size) {
+  return offset % SNAPSHOT_ALIGN == 0 && offset <= snapshot->length &&
+         size <= snapshot->length - offset;
+}
+
+int snapshot_map(const char *path, struct Snapshot *snapshot) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return -1;
+
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(struct SnapshotHeader)) {
+    close(fd);
+    return 1;
+  }
+
+  // Pages are copied on write, so the file itself is never modified
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 1;
+
+  snapshot->map = map;
+  snapshot->length = (size_t)st.st_size;
+
+  struct SnapshotHeader *header = map;
+  if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+      header->num_events > SIZE_MAX / sizeof(struct SnapshotEvent) ||
+      !section_valid(snapshot, header->table_offset,
+                     (size_t)header->num_events *
+                         sizeof(struct SnapshotEvent))) {
+    snapshot_unmap(snapshot);
+    return 1;
+  }
+
+  snapshot->events = (struct SnapshotEvent *)(snapshot->map +
+                                              header->table_offset);
+  snapshot->num_events = (size_t)header->num_events;
+
+  for (size_t i = 0; i < snapshot->num_events; i++) {
+    struct SnapshotEvent *event = &snapshot->events[i];
+    size_t sizes[3];
+
+    if (snapshot_event_sizes(event->rows, event->cols, sizes) != 0 ||
+        !section_valid(snapshot, event->data, sizes[0]) ||
+        !section_valid(snapshot, event->occupied, sizes[1]) ||
+        !section_valid(snapshot, event->max_free_run, sizes[2])) {
+      snapshot_unmap(snapshot);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void snapshot_unmap(struct Snapshot *snapshot) {
+  if (snapshot->map == NULL)
+    return;
+
+  munmap(snapshot->map, snapshot->length);
+  snapshot->map = NULL;
+  snapshot->length = 0;
+  snapshot->events = NULL;
+  snapshot->num_events = 0;
+}
+
+int snapshot_begin(struct SnapshotWriter *writer, const char *path) {
+  writer->offset = 0;
+  writer->failed = 0;
+
+  static _Atomic unsigned int writers = 0;
+
+  // Threads and job processes may snapshot at once, each to its own file
+  if (snprintf(writer->tmp_path, sizeof(writer->tmp_path), "%s.%ld.%u", path,
+               (long)getpid(), atomic_fetch_add(&writers, 1)) >=
+      (int)sizeof(writer->tmp_path))
+    return 1;
+
+  writer->fd = open(writer->tmp_path, O_WRONLY | O_CREAT | O_TRUNC,
+                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  return writer->fd == -1;
+}
+
+void snapshot_write(struct SnapshotWriter *writer, const void *data,
+                    size_t length) {
+  const char *bytes = data;
+
+  // safe_write takes a signed count, so huge sections are split
+  while (!writer->failed && length > 0) {
+    size_t chunk = length < SSIZE_MAX ? length : SSIZE_MAX;
+
+    if (safe_write(writer->fd, bytes, (ssize_t)chunk) != (ssize_t)chunk) {
+      writer->failed = 1;
+      return;
+    }
+    bytes += chunk;
+    length -= chunk;
+    writer->offset += chunk;
+  }
+}
+
+void snapshot_align(struct SnapshotWriter *writer) {
+  static const char zeros[SNAPSHOT_ALIGN];
+  size_t padding = (size_t)(-writer->offset % SNAPSHOT_ALIGN);
+
+  snapshot_write(writer, zeros, padding);
+}
+
+int snapshot_commit(struct SnapshotWriter *writer, const char *path) {
+  // The old snapshot is only replaced by a complete one
+  if (!writer->failed && fsync(writer->fd) != 0)
+    writer->failed = 1;
+  if (close(writer->fd) != 0)
+    writer->failed = 1;
+
+  if (writer->failed || rename(writer->tmp_path, path) != 0) {
+    unlink(writer->tmp_path);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+#ifndef EMS_SNAPSHOT_H
+#define EMS_SNAPSHOT_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Snapshots hold the whole event set in the layout the EMS uses in memory,
+// so a snapshot can be mapped and used in place: restoring one only reads
+// the event table, and seats are paged in as they are accessed.
+//
+// Layout, every section aligned to SNAPSHOT_ALIGN bytes:
+//   header | seats, bitmap and free runs of each event | event table
+// Fields are stored in the byte order of the machine that wrote the file.
+
+#define SNAPSHOT_MAGIC 0x53534d45 // "EMSS" when stored little endian
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN 64
+
+struct SnapshotHeader {
+  uint32_t magic;        /// SNAPSHOT_MAGIC.
+  uint32_t version;      /// SNAPSHOT_VERSION.
+  uint64_t num_events;   /// Number of entries in the event table.
+  uint64_t table_offset; /// Offset of the event table.
+};
+
+struct SnapshotEvent {
+  uint32_t id;           /// Event id.
+  uint32_t reservations; /// Reservation counter.
+  uint64_t rows;         /// Number of rows.
+  uint64_t cols;         /// Number of columns.
+  uint64_t data;         /// Offset of the rows * cols seats.
+  uint64_t occupied;     /// Offset of the occupancy bitmap.
+  uint64_t max_free_run; /// Offset of the free run of each row.
+};
+
+// A snapshot mapped into memory
+struct Snapshot {
+  char *map;                    /// Start of the mapping.
+  size_t length;                /// Length of the mapping.
+  struct SnapshotEvent *events; /// Event table.
+  size_t num_events;            /// Number of events.
+};
+
+// A snapshot being written, to a temporary file until it is committed
+struct SnapshotWriter {
+  int fd;                       /// Temporary file.
+  uint64_t offset;              /// Number of bytes written.
+  int failed;                   /// Set once any write fails.
+  char tmp_path[PATH_MAX + 32]; /// Path of the temporary file.
+};
+
+/// Gets the sizes of the seat arrays of an event.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @param sizes Array to store the sizes of the seats, the bitmap and the
+/// free runs in.
+/// @return 0 if the sizes fit in memory, 1 otherwise.
+int snapshot_event_sizes(uint64_t rows, uint64_t cols, size_t sizes[3]);
+
+/// Maps a snapshot, checking its header and every entry of its table.
+/// @param path Path of the snapshot.
+/// @param snapshot Snapshot to fill in.
+/// @return 0 if the snapshot was mapped, 1 if it is invalid, -1 if it could
+/// not be opened (errno is set).
+int snapshot_map(const char *path, struct Snapshot *snapshot);
+
+/// Unmaps a snapshot. Does nothing if nothing is mapped.
+/// @param snapshot Snapshot to unmap.
+void snapshot_unmap(struct Snapshot *snapshot);
+
+/// Starts writing a snapshot next to the given path.
+/// @param writer Writer to initialize.
+/// @param path Path the snapshot will have once committed.
+/// @return 0 if the temporary file was created, 1 otherwise.
+int snapshot_begin(struct SnapshotWriter *writer, const char *path);
+
+/// Appends bytes to a snapshot. Failures are remembered until commit.
+/// @param writer Writer to append to.
+/// @param data Bytes to append.
+/// @param length Number of bytes to append.
+void snapshot_write(struct SnapshotWriter *writer, const void *data,
+                    size_t length);
+
+/// Pads a snapshot to the next section boundary.
+/// @param writer Writer to pad.
+void snapshot_align(struct SnapshotWriter *writer);
+
+/// Finishes a snapshot, replacing the file at path only if every write
+/// succeeded. The temporary file is removed otherwise.
+/// @param writer Writer to finish.
+/// @param path Path given to snapshot_begin.
+/// @return 0 if the snapshot was committed, 1 otherwise.
+int snapshot_commit(struct SnapshotWriter *writer, const char *path);
+
+#endif // EMS_SNAPSHOT_H
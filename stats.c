@@ -0,0 +1,209 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+// Statistics the calling thread records into, NULL if it records none
+static _Thread_local struct Stats *current = NULL;
+
+static const char *const histogram_names[STATS_NUM_HISTOGRAMS] = {
+    [CMD_CREATE] = "CREATE",         [CMD_RESERVE] = "RESERVE",
+    [CMD_RESERVE_BEST] = "RESERVE_BEST", [CMD_CANCEL] = "CANCEL",
+    [CMD_RESERVE_MULTI] = "RESERVE_MULTI",
+    [CMD_SHOW] = "SHOW",             [CMD_SHOWRES] = "SHOWRES",
+    [CMD_AVAILABLE] = "AVAILABLE",   [CMD_LIST_EVENTS] = "LIST",
+    [CMD_SNAPSHOT] = "SNAPSHOT",     [CMD_STATS] = "STATS",
+    [CMD_BARRIER] = "BARRIER",       [CMD_WAIT] = "WAIT",
+    [CMD_HELP] = "HELP",             [CMD_EMPTY] = "EMPTY",
+    [CMD_INVALID] = "INVALID",
+    [EOC + STATS_PARSE] = "parse",
+    [EOC + STATS_PARSER_WAIT] = "parser_wait",
+    [EOC + STATS_PARSER_HOLD] = "parser_hold",
+    [EOC + STATS_BARRIER_WAIT] = "barrier_wait",
+    [EOC + STATS_EVENT_WAIT] = "event_lock_wait",
+    [EOC + STATS_ROWS_WAIT] = "row_lock_wait",
+    [EOC + STATS_ROWS_HOLD] = "row_lock_hold",
+    [EOC + STATS_DELAY] = "access_delay",
+    [EOC + STATS_OUTPUT] = "output",
+};
+
+// Category of the spans traced for the metrics, commands are "execute"
+static const char *const metric_categories[STATS_NUM_METRICS] = {
+    [STATS_PARSE] = "parse",        [STATS_PARSER_WAIT] = "lock",
+    [STATS_PARSER_HOLD] = "hold",   [STATS_BARRIER_WAIT] = "barrier",
+    [STATS_EVENT_WAIT] = "lock",    [STATS_ROWS_WAIT] = "lock",
+    [STATS_ROWS_HOLD] = "hold",     [STATS_DELAY] = "delay",
+    [STATS_OUTPUT] = "write",
+};
+
+static const char *const counter_names[STATS_NUM_COUNTERS] = {
+    [STATS_FAILED_COMMANDS] = "failed_commands",
+    [STATS_FAILED_RESERVATIONS] = "failed_reservations",
+    [STATS_CACHE_HITS] = "cache_hits",
+    [STATS_CACHE_MISSES] = "cache_misses",
+    [STATS_CACHE_WRITE_BACKS] = "cache_write_backs",
+};
+
+// A histogram added up from several threads
+struct Totals {
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t buckets[STATS_BUCKETS];
+};
+
+struct Stats *stats_create(size_t count) {
+  return calloc(count, sizeof(struct Stats));
+}
+
+void stats_destroy(struct Stats *stats) { free(stats); }
+
+void stats_attach(struct Stats *stats) { current = stats; }
+
+uint64_t stats_now(void) {
+  struct timespec now;
+
+  if (current == NULL || clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+    return 0;
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static size_t bucket_of(uint64_t value) {
+  if (value < STATS_SUB_BUCKETS)
+    return (size_t)value;
+
+  // Position of the highest bit, then the bits right below it
+  unsigned int exponent = 63 - (unsigned int)__builtin_clzll(value);
+  unsigned int shift = exponent - STATS_SUB_BITS;
+  return (size_t)(shift + 1) * STATS_SUB_BUCKETS +
+         (size_t)((value >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+// Largest value that falls in a bucket
+static uint64_t bucket_limit(size_t bucket) {
+  if (bucket < STATS_SUB_BUCKETS)
+    return bucket;
+
+  unsigned int shift = (unsigned int)(bucket / STATS_SUB_BUCKETS) - 1;
+  uint64_t sub = STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS;
+  return ((sub + 1) << shift) - 1;
+}
+
+// Only the owner thread writes, so a load and a store are enough
+static void add(_Atomic uint64_t *counter, uint64_t value) {
+  atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+      memory_order_relaxed);
+}
+
+// Records a span in a histogram of the calling thread, and in its trace
+static void record(size_t index, const char *category, uint64_t start) {
+  struct StatsHistogram *histogram = &current->histograms[index];
+  uint64_t now = stats_now();
+  uint64_t value = now > start ? now - start : 0;
+
+  trace_span(histogram_names[index], category, start, now);
+
+  add(&histogram->count, 1);
+  add(&histogram->total, value);
+  add(&histogram->buckets[bucket_of(value)], 1);
+  if (value > atomic_load_explicit(&histogram->max, memory_order_relaxed)) {
+    atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+  }
+}
+
+void stats_record_command(enum Command type, uint64_t start) {
+  if (current != NULL && type < EOC) {
+    record(type, "execute", start);
+  }
+}
+
+void stats_record(enum StatsMetric metric, uint64_t start) {
+  if (current != NULL) {
+    record(EOC + metric, metric_categories[metric], start);
+  }
+}
+
+void stats_count(enum StatsCounter counter) {
+  if (current != NULL) {
+    add(&current->counters[counter], 1);
+  }
+}
+
+static void add_up(struct Totals *totals, struct StatsHistogram *histogram) {
+  totals->count += atomic_load_explicit(&histogram->count, memory_order_relaxed);
+  totals->total += atomic_load_explicit(&histogram->total, memory_order_relaxed);
+  uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+  if (max > totals->max) {
+    totals->max = max;
+  }
+  for (size_t i = 0; i < STATS_BUCKETS; i++) {
+    totals->buckets[i] +=
+        atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+  }
+}
+
+// Smallest bucket limit that at least percent of the values are under
+static uint64_t percentile(const struct Totals *totals, unsigned int percent) {
+  uint64_t rank = (totals->count * percent + 99) / 100;
+  uint64_t seen = 0;
+
+  for (size_t i = 0; i < STATS_BUCKETS; i++) {
+    seen += totals->buckets[i];
+    if (seen >= rank && seen > 0) {
+      uint64_t limit = bucket_limit(i);
+      return limit < totals->max ? limit : totals->max;
+    }
+  }
+  return totals->max;
+}
+
+static int report_line(struct Buffer *out, const char *name,
+                       const struct Totals *totals) {
+  char line[256];
+  int length = snprintf(
+      line, sizeof(line),
+      "%s count=%llu mean=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus "
+      "max=%.1fus\n",
+      name, (unsigned long long)totals->count,
+      (double)totals->total / (double)totals->count / 1000.0,
+      (double)percentile(totals, 50) / 1000.0,
+      (double)percentile(totals, 90) / 1000.0,
+      (double)percentile(totals, 99) / 1000.0, (double)totals->max / 1000.0);
+
+  if (length < 0 || (size_t)length >= sizeof(line))
+    return 1;
+  return buffer_append(out, line, (size_t)length);
+}
+
+int stats_report(struct Stats *stats, size_t count, struct Buffer *out) {
+  for (size_t h = 0; h < STATS_NUM_HISTOGRAMS; h++) {
+    struct Totals totals = {0};
+
+    for (size_t i = 0; i < count; i++) {
+      add_up(&totals, &stats[i].histograms[h]);
+    }
+    if (totals.count > 0 &&
+        report_line(out, histogram_names[h], &totals) != 0)
+      return 1;
+  }
+
+  for (size_t counter = 0; counter < STATS_NUM_COUNTERS; counter++) {
+    uint64_t total = 0;
+    char line[64];
+
+    for (size_t i = 0; i < count; i++) {
+      total += atomic_load_explicit(&stats[i].counters[counter],
+                                    memory_order_relaxed);
+    }
+    int length = snprintf(line, sizeof(line), "%s=%llu\n",
+                          counter_names[counter], (unsigned long long)total);
+    if (length < 0 || (size_t)length >= sizeof(line) ||
+        buffer_append(out, line, (size_t)length) != 0)
+      return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef EMS_STATS_H
+#define EMS_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "output.h"
+#include "parser.h"
+
+// Latency statistics of the threads running a job file. Each thread records
+// into its own Stats, without locks; a report adds up those of every thread.
+// Every span recorded is also traced, if the thread records a trace.
+//
+// Histograms are log-linear, as in HDR histograms: values below
+// STATS_SUB_BUCKETS nanoseconds have a bucket each, and every power of two
+// above is split into STATS_SUB_BUCKETS buckets, so a value is known to
+// within 1 / STATS_SUB_BUCKETS of itself.
+
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+// Times measured besides the commands themselves
+enum StatsMetric {
+  STATS_PARSE,         /// Reading one command from the job file.
+  STATS_PARSER_WAIT,   /// Waiting for the parsing mutex.
+  STATS_PARSER_HOLD,   /// Holding the parsing mutex.
+  STATS_BARRIER_WAIT,  /// Waiting at a BARRIER.
+  STATS_EVENT_WAIT,    /// Waiting for an event's lock.
+  STATS_ROWS_WAIT,     /// Waiting for the locks of an event's rows.
+  STATS_ROWS_HOLD,     /// Holding the locks of an event's rows.
+  STATS_DELAY,         /// Simulated state access delay.
+  STATS_OUTPUT,        /// Committing an output to the writer.
+  STATS_NUM_METRICS
+};
+
+enum StatsCounter {
+  STATS_FAILED_COMMANDS,     /// Commands that failed, any kind.
+  STATS_FAILED_RESERVATIONS, /// RESERVE, RESERVE_BEST and RESERVE_MULTI
+                             /// that failed.
+  STATS_CACHE_HITS,          /// State accesses served by the cache.
+  STATS_CACHE_MISSES,        /// State accesses that went to the store.
+  STATS_CACHE_WRITE_BACKS,   /// Dirty cache lines evicted to the store.
+  STATS_NUM_COUNTERS
+};
+
+// Written by its owner thread only, read by any; atomics keep the reads
+// defined, and relaxed ones compile to plain moves
+struct StatsHistogram {
+  _Atomic uint64_t count;                  /// Number of values recorded.
+  _Atomic uint64_t total;                  /// Sum of the values.
+  _Atomic uint64_t max;                    /// Largest value.
+  _Atomic uint64_t buckets[STATS_BUCKETS]; /// Number of values per bucket.
+};
+
+// Histograms of the command types come first, then those of the metrics
+#define STATS_NUM_HISTOGRAMS (EOC + STATS_NUM_METRICS)
+
+struct Stats {
+  struct StatsHistogram histograms[STATS_NUM_HISTOGRAMS]; /// Per command
+                                                         /// type, then per
+                                                         /// StatsMetric.
+  _Atomic uint64_t counters[STATS_NUM_COUNTERS]; /// Per StatsCounter.
+};
+
+/// Allocates zeroed statistics for a number of threads.
+/// @param count Number of threads.
+/// @return Array of count statistics, NULL if out of memory.
+struct Stats *stats_create(size_t count);
+
+/// Frees statistics allocated by stats_create.
+/// @param stats Array to free.
+void stats_destroy(struct Stats *stats);
+
+/// Makes the calling thread record into the given statistics.
+/// @param stats Statistics of the thread, NULL to stop recording.
+void stats_attach(struct Stats *stats);
+
+/// Gets the time to measure from.
+/// @return Current time in nanoseconds, 0 if the calling thread does not
+/// record statistics, so untracked threads never read the clock.
+uint64_t stats_now(void);
+
+/// Records the time elapsed since start as a command of the calling thread.
+/// @param type Type of the command.
+/// @param start Value of stats_now when the command started.
+void stats_record_command(enum Command type, uint64_t start);
+
+/// Records the time elapsed since start in one of the calling thread's
+/// metrics.
+/// @param metric Metric to record.
+/// @param start Value of stats_now when the measured span started.
+void stats_record(enum StatsMetric metric, uint64_t start);
+
+/// Increments one of the calling thread's counters.
+/// @param counter Counter to increment.
+void stats_count(enum StatsCounter counter);
+
+/// Renders a report of the statistics of several threads added up, one
+/// line per command type and metric that was recorded and one per counter.
+/// @param stats Array of statistics.
+/// @param count Number of statistics.
+/// @param out Buffer to render the report in.
+/// @return 0 if the report was rendered, 1 if out of memory.
+int stats_report(struct Stats *stats, size_t count, struct Buffer *out);
+
+#endif // EMS_STATS_H
@@ -0,0 +1,232 @@
+import os
+import signal
+import socket
+import subprocess
+import tempfile
+import time
+import unittest
+
+EMS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "ems")
+
+
+class ServerTest(unittest.TestCase):
+    """Runs ems as a server on a Unix socket in a temporary directory, which
+    is kept across restarts of the server within a test."""
+
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.addCleanup(self.dir.cleanup)
+        self.path = os.path.join(self.dir.name, "ems.sock")
+
+    def start(self, delay_ms, *options):
+        self.server = subprocess.Popen(
+            [EMS, "-d", str(delay_ms), "-S", self.path, "-t", "2", *options],
+            cwd=self.dir.name, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        # The server prints a line once it listens
+        self.assertTrue(self.server.stdout.readline().startswith(b"Listening"))
+
+    def stop(self):
+        self.server.send_signal(signal.SIGTERM)
+        _, err = self.server.communicate(timeout=30)
+        return self.server.returncode, err
+
+    def kill(self):
+        # Nothing gets to run on the way out, as in a crash
+        self.server.kill()
+        self.server.communicate(timeout=30)
+
+    def connect(self):
+        client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        client.connect(self.path)
+        return client
+
+    def request(self, commands):
+        client = self.connect()
+        client.sendall(commands)
+        client.shutdown(socket.SHUT_WR)
+        reply = b""
+        while True:
+            data = client.recv(65536)
+            if not data:
+                break
+            reply += data
+        client.close()
+        return reply
+
+    def test_disconnect_mid_command(self):
+        self.start(300)
+        try:
+            # Hangs up while a worker still writes the output of SHOW
+            client = self.connect()
+            client.sendall(b"CREATE 1 3 3\nSHOW 1\n")
+            time.sleep(0.5)
+            client.close()
+
+            # The server keeps serving the other clients
+            reply = self.request(b"CREATE 2 1 2\nRESERVE 2 [(1,2)]\nSHOW 2\n")
+            self.assertEqual(reply, b"0 1\n")
+        finally:
+            status, err = self.stop()
+        self.assertNotIn(b"ThreadSanitizer", err)
+        self.assertEqual(status, 0, err.decode(errors="replace"))
+
+    def test_available(self):
+        self.start(0)
+        try:
+            # Reserved seats on both sides of a bitmap word boundary
+            reply = self.request(b"CREATE 1 2 70\n"
+                                 b"RESERVE 1 [(1,1) (1,64) (1,65) (2,70)]\n"
+                                 b"AVAILABLE 1\n")
+            self.assertEqual(reply, b"Available: 136/140\n67 69\n")
+        finally:
+            status, err = self.stop()
+        self.assertEqual(status, 0, err.decode(errors="replace"))
+
+    def test_reserve_best(self):
+        self.start(0)
+        try:
+            reply = self.request(b"CREATE 1 3 4\n"
+                                 b"RESERVE 1 [(1,1) (2,4) (3,2)]\n"
+                                 # No row has four adjacent free seats
+                                 b"RESERVE_BEST 1 4 1\n"
+                                 # Goes on from the end of row 1 into row 2
+                                 b"RESERVE_BEST 1 4 0\n"
+                                 # First row, then lowest columns that fit
+                                 b"RESERVE_BEST 1 2\n"
+                                 b"RESERVE_BEST 1 2\n"
+                                 b"SHOW 1\n")
+            self.assertEqual(reply, b"(1,2) (1,3) (1,4) (2,1)\n"
+                                    b"(2,2) (2,3)\n"
+                                    b"(3,3) (3,4)\n"
+                                    b"1 2 2 2\n2 3 3 1\n0 1 4 4\n")
+        finally:
+            status, err = self.stop()
+        self.assertEqual(status, 0, err.decode(errors="replace"))
+        self.assertIn(b"Not enough free seats", err)
+    def test_cancel_and_showres(self):
+        self.start(0)
+        try:
+            reply = self.request(b"CREATE 1 2 3\n"
+                                 b"RESERVE 1 [(1,1) (2,3)]\n"
+                                 b"RESERVE 1 [(1,2)]\n"
+                                 b"SHOWRES 1 1\n"
+                                 b"CANCEL 1 1\n"
+                                 # Cancelled seats can be reserved again
+                                 b"RESERVE 1 [(2,3)]\n"
+                                 b"SHOWRES 1 2\n"
+                                 b"SHOW 1\n")
+            self.assertEqual(reply, b"(1,1) (2,3)\n"
+                                    b"(1,2)\n"
+                                    b"0 2 0\n0 0 3\n")
+            # A cancelled reservation is gone
+            self.assertEqual(self.request(b"SHOWRES 1 1\nCANCEL 1 1\n"), b"")
+        finally:
+            status, err = self.stop()
+        self.assertEqual(status, 0, err.decode(errors="replace"))
+        self.assertIn(b"Reservation not found", err)
+
+    def test_reserve_multi(self):
+        self.start(0)
+        try:
+            reply = self.request(b"CREATE 1 1 3\n"
+                                 b"CREATE 2 1 2\n"
+                                 b"RESERVE 2 [(1,2)]\n"
+                                 # Fails in event 2, so nothing is reserved
+                                 b"RESERVE_MULTI 1 [(1,1)] 2 [(1,1) (1,2)]\n"
+                                 b"RESERVE_MULTI 2 [(1,1)] 1 [(1,1) (1,3)]\n"
+                                 b"SHOW 1\n"
+                                 b"SHOW 2\n"
+                                 b"SHOWRES 1 1\n")
+            self.assertEqual(reply, b"1 0 1\n2 1\n(1,1) (1,3)\n")
+        finally:
+            status, err = self.stop()
+        self.assertEqual(status, 0, err.decode(errors="replace"))
+        self.assertIn(b"Seat already reserved", err)
+
+    def test_snapshot_restore(self):
+        snapshot = os.path.join(self.dir.name, "ems.snap")
+        self.start(0, "-s", snapshot)
+        try:
+            reply = self.request(b"CREATE 1 2 3\n"
+                                 b"CREATE 2 1 70\n"
+                                 b"RESERVE 1 [(1,1) (2,3)]\n"
+                                 b"RESERVE 1 [(1,2)]\n"
+                                 b"RESERVE 2 [(1,70)]\n"
+                                 b"SNAPSHOT\n"
+                                 # Not in the snapshot
+                                 b"RESERVE 1 [(2,1)]\n")
+            self.assertEqual(reply, b"")
+        finally:
+            status, err = self.stop()
+        self.assertEqual(status, 0, err.decode(errors="replace"))
+
+        self.start(0, "-s", snapshot)
+        try:
+            reply = self.request(b"SHOW 1\n"
+                                 b"SHOWRES 1 1\n"
+                                 b"CANCEL 1 2\n"
+                                 # Ids go on from the restored ones
+                                 b"RESERVE 1 [(1,2) (2,2)]\n"
+                                 b"SHOW 1\n"
+                                 b"AVAILABLE 2\n")
+            self.assertEqual(reply, b"1 2 0\n0 0 1\n"
+                                    b"(1,1) (2,3)\n"
+                                    b"1 3 0\n0 3 1\n"
+                                    b"Available: 69/70\n69\n")
+        finally:
+            status, err = self.stop()
+        self.assertEqual(status, 0, err.decode(errors="replace"))
+
+    def test_log_replay_after_kill(self):
+        log = os.path.join(self.dir.name, "ems.log")
+        self.start(0, "-l", log)
+        try:
+            reply = self.request(b"CREATE 1 2 3\n"
+                                 b"CREATE 2 1 1\n"
+                                 b"RESERVE 1 [(1,1) (2,3)]\n"
+                                 b"RESERVE 1 [(1,2)]\n"
+                                 b"RESERVE_BEST 1 2\n"
+                                 b"RESERVE_MULTI 1 [(1,3)] 2 [(1,1)]\n"
+                                 b"CANCEL 1 1\n")
+            self.assertEqual(reply, b"(2,1) (2,2)\n")
+        finally:
+            self.kill()
+
+        # A record torn by the crash ends the log
+        with open(log, "ab") as f:
+            f.write(b"\x02\x00\x05")
+
+        self.start(0, "-l", log)
+        try:
+            self.assertEqual(
+                self.request(b"SHOW 1\nSHOW 2\nRESERVE 1 [(1,1)]\n"),
+                b"0 2 4\n3 3 0\n1\n")
+        finally:
+            self.kill()
+
+        # Records appended after the torn one was cut off are replayed too
+        self.start(0, "-l", log)
+        try:
+            self.assertEqual(self.request(b"SHOW 1\n"), b"5 2 4\n3 3 0\n")
+        finally:
+            status, err = self.stop()
+        self.assertEqual(status, 0, err.decode(errors="replace"))
+
+    def test_job_file_logs(self):
+        # Without a shared state, each job file replays only its own log
+        log = os.path.join(self.dir.name, "ems.log")
+        jobs = {"a.jobs": b"(1,1)", "b.jobs": b"(1,2)"}
+        for commands in (b"CREATE 1 1 2\nRESERVE 1 [%s]\n", b"SHOW 1\n"):
+            for name, seat in jobs.items():
+                with open(os.path.join(self.dir.name, name), "wb") as f:
+                    f.write(commands.replace(b"%s", seat))
+            subprocess.run([EMS, "-d", "0", "-p", self.dir.name, "-t", "1",
+                            "-l", log], check=True, capture_output=True)
+
+        for name, shown in (("a.out", b"1 0\n"), ("b.out", b"0 1\n")):
+            with open(os.path.join(self.dir.name, name), "rb") as f:
+                self.assertEqual(f.read(), shown)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,144 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "output.h"
+
+#define TRACE_FLUSH_SIZE 65536
+#define TRACE_LINE_SIZE 256
+
+// Ring the calling thread records into, NULL if it records none
+static _Thread_local struct TraceRing *current = NULL;
+
+struct Trace *trace_create(size_t threads) {
+  struct Trace *trace = malloc(sizeof(struct Trace));
+  if (trace == NULL)
+    return NULL;
+
+  trace->num_rings = 0;
+  if ((trace->rings = calloc(threads, sizeof(struct TraceRing))) == NULL) {
+    free(trace);
+    return NULL;
+  }
+
+  // Pages of a ring are only touched once its thread records that far
+  for (; trace->num_rings < threads; trace->num_rings++) {
+    struct TraceRing *ring = &trace->rings[trace->num_rings];
+    if ((ring->spans = malloc(TRACE_RING_SPANS * sizeof(struct TraceSpan))) ==
+        NULL) {
+      trace_destroy(trace);
+      return NULL;
+    }
+    ring->recorded = 0;
+    ring->label = "thread";
+  }
+  return trace;
+}
+
+void trace_destroy(struct Trace *trace) {
+  if (trace == NULL)
+    return;
+
+  for (size_t i = 0; i < trace->num_rings; i++) {
+    free(trace->rings[i].spans);
+  }
+  free(trace->rings);
+  free(trace);
+}
+
+void trace_attach(struct Trace *trace, size_t thread, const char *label) {
+  current = trace != NULL ? &trace->rings[thread] : NULL;
+  if (current != NULL) {
+    current->label = label;
+  }
+}
+
+void trace_span(const char *name, const char *category, uint64_t start,
+                uint64_t end) {
+  if (current == NULL)
+    return;
+
+  struct TraceSpan *span =
+      &current->spans[current->recorded++ % TRACE_RING_SPANS];
+  span->name = name;
+  span->category = category;
+  span->start = start;
+  span->end = end;
+}
+
+// Appends a line of at most TRACE_LINE_SIZE bytes, as returned by snprintf,
+// writing the buffer out once it is large enough
+static int append(struct Buffer *out, int fd, const char *line, int length) {
+  if (length < 0 || length >= TRACE_LINE_SIZE ||
+      buffer_append(out, line, (size_t)length) != 0)
+    return 1;
+
+  if (out->length >= TRACE_FLUSH_SIZE) {
+    if (safe_write(fd, out->data, (ssize_t)out->length) !=
+        (ssize_t)out->length)
+      return 1;
+    out->length = 0;
+  }
+  return 0;
+}
+
+int trace_write(struct Trace *trace, int fd) {
+  struct Buffer out;
+  char line[TRACE_LINE_SIZE];
+  const char *header = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  long pid = (long)getpid();
+  int result = 0;
+  const char *separator = "";
+
+  buffer_init(&out);
+  result = append(&out, fd, header, (int)strlen(header));
+
+  for (size_t i = 0; i < trace->num_rings && result == 0; i++) {
+    struct TraceRing *ring = &trace->rings[i];
+    if (ring->recorded == 0)
+      continue;
+
+    // Names the thread's row in the timeline
+    result = append(&out, fd, line,
+                    snprintf(line, sizeof(line),
+                             "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+                             "\"pid\":%ld,\"tid\":%zu,"
+                             "\"args\":{\"name\":\"%s %zu\"}}",
+                             separator, pid, i, ring->label, i));
+    separator = ",\n";
+
+    // Only the latest TRACE_RING_SPANS spans are left, oldest first
+    size_t first = ring->recorded > TRACE_RING_SPANS
+                       ? ring->recorded - TRACE_RING_SPANS
+                       : 0;
+    for (size_t s = first; s < ring->recorded && result == 0; s++) {
+      struct TraceSpan *span = &ring->spans[s % TRACE_RING_SPANS];
+      uint64_t duration = span->end > span->start ? span->end - span->start : 0;
+
+      // Timestamps are in microseconds, kept to the nanosecond
+      result = append(
+          &out, fd, line,
+          snprintf(line, sizeof(line),
+                   ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                   "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%ld,"
+                   "\"tid\":%zu}",
+                   span->name, span->category,
+                   (unsigned long long)(span->start / 1000),
+                   (unsigned int)(span->start % 1000),
+                   (unsigned long long)(duration / 1000),
+                   (unsigned int)(duration % 1000), pid, i));
+    }
+  }
+
+  if (result == 0 && (append(&out, fd, "\n]}\n", 4) != 0 ||
+                      safe_write(fd, out.data, (ssize_t)out.length) !=
+                          (ssize_t)out.length)) {
+    result = 1;
+  }
+  buffer_free(&out);
+  return result;
+}
@@ -0,0 +1,62 @@
+#ifndef EMS_TRACE_H
+#define EMS_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Timeline of the spans each thread spent parsing, waiting for locks,
+// executing and writing, exported in the Chrome trace event format. Each
+// thread appends to its own ring, without locks; rings are only read once
+// their threads have finished.
+
+struct TraceSpan {
+  const char *name;     /// Name of the span, a string literal.
+  const char *category; /// Category of the span, a string literal.
+  uint64_t start;       /// Start, in nanoseconds of CLOCK_MONOTONIC.
+  uint64_t end;         /// End, in nanoseconds of CLOCK_MONOTONIC.
+};
+
+struct TraceRing {
+  struct TraceSpan *spans; /// TRACE_RING_SPANS spans, oldest overwritten.
+  size_t recorded;         /// Number of spans ever recorded.
+  const char *label;       /// Label of the thread, a string literal.
+};
+
+// Rings of the threads running one job file
+struct Trace {
+  struct TraceRing *rings; /// Ring of each thread.
+  size_t num_rings;        /// Number of rings.
+};
+
+/// Creates a trace with an empty ring per thread.
+/// @param threads Number of threads.
+/// @return The trace, NULL if out of memory.
+struct Trace *trace_create(size_t threads);
+
+/// Destroys a trace, freeing its memory.
+/// @param trace Trace to destroy, NULL does nothing.
+void trace_destroy(struct Trace *trace);
+
+/// Makes the calling thread record into one of the rings of a trace.
+/// @param trace Trace to record into, NULL to stop recording.
+/// @param thread Index of the ring.
+/// @param label Label of the thread in the timeline, a string literal.
+void trace_attach(struct Trace *trace, size_t thread, const char *label);
+
+/// Records a span of the calling thread, if it records into a trace.
+/// @param name Name of the span, a string literal.
+/// @param category Category of the span, a string literal.
+/// @param start Start, in nanoseconds of CLOCK_MONOTONIC.
+/// @param end End, in nanoseconds of CLOCK_MONOTONIC.
+void trace_span(const char *name, const char *category, uint64_t start,
+                uint64_t end);
+
+/// Writes a trace as Chrome trace event JSON, with the id of the calling
+/// process as the process of every span.
+/// @note Every thread that recorded into the trace must have finished.
+/// @param trace Trace to write.
+/// @param fd File descriptor to write to.
+/// @return 0 if the trace was written, 1 otherwise.
+int trace_write(struct Trace *trace, int fd);
+
+#endif // EMS_TRACE_H
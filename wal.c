@@ -0,0 +1,386 @@
+#include "wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "output.h"
+
+#define WAL_GROUP_BYTES 65536 // A group this large is synced without waiting
+                              // for the rest of the budget
+
+// Log state of this process. Forked processes inherit it before any record
+// is appended, and all of them append to the same file.
+static struct {
+  int fd;                 /// Log file, -1 if the log is not open.
+  unsigned int budget_us; /// Longest wait for a group to fill.
+  pthread_mutex_t lock;   /// Guards the fields below.
+  pthread_cond_t filled;  /// Signaled when the group reaches WAL_GROUP_BYTES.
+  pthread_cond_t flushed; /// Signaled when a group has been synced.
+  size_t pending;         /// Bytes appended since the last sync started.
+  uint64_t appended;      /// Position of the last record appended.
+  uint64_t durable;       /// Position of the last record on disk.
+  int flushing;           /// Set while a group is being synced.
+  int failed;             /// Set once a record could not be written or
+                          /// synced.
+} wal = {.fd = -1};
+
+// FNV-1a, enough to tell a torn record from a complete one
+static uint32_t checksum(uint32_t hash, const void *data, size_t length) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t record_checksum(struct WalRecord record,
+                                const uint64_t *seats) {
+  record.checksum = 0;
+  uint32_t hash = checksum(2166136261u, &record, sizeof(record));
+  return record.count > 0
+             ? checksum(hash, seats, record.count * sizeof(uint64_t))
+             : hash;
+}
+
+int wal_open(const char *path, unsigned int budget_us) {
+  if (wal.fd != -1)
+    return 1;
+
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  struct stat st;
+  if (fd == -1)
+    return 1;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return 1;
+  }
+
+  if (st.st_size == 0) {
+    struct WalHeader header = {WAL_MAGIC, WAL_VERSION};
+    if (safe_write(fd, &header, sizeof(header)) != sizeof(header) ||
+        fsync(fd) != 0) {
+      close(fd);
+      return 1;
+    }
+  } else {
+    // Finds where the valid records end, refusing files that are not logs
+    struct WalReader log;
+    struct WalRecord record;
+    const uint64_t *seats;
+
+    if (wal_reader_open(&log, path) != 0) {
+      close(fd);
+      return 1;
+    }
+    while (wal_next(&log, &record, &seats) == 1)
+      ;
+    uint64_t valid = log.valid;
+    wal_reader_close(&log);
+
+    // New records must follow the last valid one, not the torn one
+    if (valid < (uint64_t)st.st_size &&
+        (ftruncate(fd, (off_t)valid) != 0 || fsync(fd) != 0)) {
+      close(fd);
+      return 1;
+    }
+  }
+
+  if (pthread_mutex_init(&wal.lock, NULL) != 0) {
+    close(fd);
+    return 1;
+  }
+  if (pthread_cond_init(&wal.filled, NULL) != 0) {
+    pthread_mutex_destroy(&wal.lock);
+    close(fd);
+    return 1;
+  }
+  if (pthread_cond_init(&wal.flushed, NULL) != 0) {
+    pthread_cond_destroy(&wal.filled);
+    pthread_mutex_destroy(&wal.lock);
+    close(fd);
+    return 1;
+  }
+
+  wal.fd = fd;
+  wal.budget_us = budget_us;
+  wal.pending = 0;
+  wal.appended = 0;
+  wal.durable = 0;
+  wal.flushing = 0;
+  wal.failed = 0;
+  return 0;
+}
+
+void wal_close(void) {
+  if (wal.fd == -1)
+    return;
+
+  close(wal.fd);
+  wal.fd = -1;
+  pthread_cond_destroy(&wal.flushed);
+  pthread_cond_destroy(&wal.filled);
+  pthread_mutex_destroy(&wal.lock);
+}
+
+/// Writes a record to the end of the log, to be synced with the current
+/// group. The record reaches the file before this returns, so records
+/// appended while the caller holds its seat locks are in the file in the
+/// order of those locks, whichever process appends them.
+/// @param record Record, its checksum is filled in.
+/// @param seats Array of the record->count seats following the record.
+/// @param lsn Pointer to the variable to store the position of the record in.
+/// @return 0 if the record was written, 1 otherwise.
+static int append_record(struct WalRecord *record, const uint64_t *seats,
+                         uint64_t *lsn) {
+  record->checksum = record_checksum(*record, seats);
+
+  struct iovec parts[2] = {
+      {record, sizeof(*record)},
+      {(void *)seats, record->count * sizeof(uint64_t)}};
+  size_t length = parts[0].iov_len + parts[1].iov_len;
+
+  pthread_mutex_lock(&wal.lock);
+  // A record after a torn one could never be replayed
+  if (wal.failed) {
+    pthread_mutex_unlock(&wal.lock);
+    return 1;
+  }
+
+  // One write per record, so records of other processes cannot interleave
+  // with it; a short write only happens when the disk is full
+  ssize_t written;
+  do {
+    written = writev(wal.fd, parts, record->count > 0 ? 2 : 1);
+  } while (written == -1 && errno == EINTR);
+  if (written != (ssize_t)length) {
+    wal.failed = 1;
+    pthread_mutex_unlock(&wal.lock);
+    return 1;
+  }
+
+  *lsn = ++wal.appended;
+  wal.pending += length;
+  if (wal.pending >= WAL_GROUP_BYTES) {
+    pthread_cond_signal(&wal.filled);
+  }
+  pthread_mutex_unlock(&wal.lock);
+  return 0;
+}
+
+int wal_log_create(unsigned int event_id, size_t rows, size_t cols,
+                   uint64_t *lsn) {
+  *lsn = 0;
+  if (wal.fd == -1)
+    return 0;
+
+  struct WalRecord record = {0};
+  record.op = WAL_CREATE;
+  record.event_id = event_id;
+  record.rows = rows;
+  record.cols = cols;
+  return append_record(&record, NULL, lsn);
+}
+
+int wal_log_reserve(unsigned int event_id, unsigned int reservation,
+                    size_t num_seats, const size_t *indices, uint64_t *lsn) {
+  *lsn = 0;
+  if (wal.fd == -1)
+    return 0;
+  if (num_seats > UINT16_MAX)
+    return 1;
+
+  uint64_t local_seats[MAX_RESERVATION_SIZE];
+  uint64_t *seats = local_seats;
+  if (num_seats > MAX_RESERVATION_SIZE &&
+      (seats = malloc(num_seats * sizeof(uint64_t))) == NULL)
+    return 1;
+  for (size_t i = 0; i < num_seats; i++) {
+    seats[i] = indices[i];
+  }
+
+  struct WalRecord record = {0};
+  record.op = WAL_RESERVE;
+  record.count = (uint16_t)num_seats;
+  record.event_id = event_id;
+  record.reservation = reservation;
+  int result = append_record(&record, seats, lsn);
+
+  if (seats != local_seats)
+    free(seats);
+  return result;
+}
+
+int wal_log_reserve_multi(size_t num_parts, const struct WalPart *parts,
+                          uint64_t *lsn) {
+  *lsn = 0;
+  if (wal.fd == -1)
+    return 0;
+
+  size_t count = 0;
+  for (size_t i = 0; i < num_parts; i++) {
+    count += 2 + parts[i].num_seats;
+  }
+  if (count > UINT16_MAX)
+    return 1;
+
+  uint64_t local_words[MAX_RESERVATION_SIZE + 2 * MAX_MULTI_EVENTS];
+  uint64_t *words = local_words;
+  if (count > sizeof(local_words) / sizeof(uint64_t) &&
+      (words = malloc(count * sizeof(uint64_t))) == NULL)
+    return 1;
+
+  size_t length = 0;
+  for (size_t i = 0; i < num_parts; i++) {
+    words[length++] =
+        (uint64_t)parts[i].event_id << 32 | parts[i].reservation;
+    words[length++] = parts[i].num_seats;
+    for (size_t j = 0; j < parts[i].num_seats; j++) {
+      words[length++] = parts[i].indices[j];
+    }
+  }
+
+  struct WalRecord record = {0};
+  record.op = WAL_RESERVE_MULTI;
+  record.count = (uint16_t)count;
+  record.rows = num_parts;
+  int result = append_record(&record, words, lsn);
+
+  if (words != local_words)
+    free(words);
+  return result;
+}
+
+int wal_log_cancel(unsigned int event_id, unsigned int reservation,
+                   uint64_t *lsn) {
+  *lsn = 0;
+  if (wal.fd == -1)
+    return 0;
+
+  struct WalRecord record = {0};
+  record.op = WAL_CANCEL;
+  record.event_id = event_id;
+  record.reservation = reservation;
+  return append_record(&record, NULL, lsn);
+}
+
+// Waits up to the budget for the group to fill. The lock must be held.
+static void wait_for_group(void) {
+  struct timespec deadline;
+
+  if (wal.budget_us == 0 || clock_gettime(CLOCK_REALTIME, &deadline) != 0)
+    return;
+
+  deadline.tv_nsec += (long)(wal.budget_us % 1000000) * 1000;
+  deadline.tv_sec += (time_t)(wal.budget_us / 1000000 +
+                              (unsigned long)deadline.tv_nsec / 1000000000);
+  deadline.tv_nsec %= 1000000000;
+
+  while (wal.pending < WAL_GROUP_BYTES &&
+         pthread_cond_timedwait(&wal.filled, &wal.lock, &deadline) !=
+             ETIMEDOUT)
+    ;
+}
+
+int wal_sync(uint64_t lsn) {
+  if (lsn == 0)
+    return 0;
+
+  pthread_mutex_lock(&wal.lock);
+  while (wal.durable < lsn && !wal.failed) {
+    // Another commit is syncing, this record goes out with it or next
+    if (wal.flushing) {
+      pthread_cond_wait(&wal.flushed, &wal.lock);
+      continue;
+    }
+
+    // Leads the group: lets other commits join, then syncs all of them
+    wal.flushing = 1;
+    wait_for_group();
+
+    uint64_t last = wal.appended;
+    wal.pending = 0;
+    pthread_mutex_unlock(&wal.lock);
+
+    // Also makes every earlier record of other processes durable, so a
+    // record on disk is never missing one it was ordered after
+    int failed = fdatasync(wal.fd) != 0;
+
+    pthread_mutex_lock(&wal.lock);
+    if (failed) {
+      wal.failed = 1;
+    } else {
+      wal.durable = last;
+    }
+    wal.flushing = 0;
+    pthread_cond_broadcast(&wal.flushed);
+  }
+
+  int result = wal.durable < lsn;
+  pthread_mutex_unlock(&wal.lock);
+  return result;
+}
+
+int wal_reader_open(struct WalReader *log, const char *path) {
+  struct WalHeader header;
+
+  if ((log->fd = open(path, O_RDONLY)) == -1)
+    return -1;
+  if (reader_open(&log->reader, log->fd) != 0) {
+    close(log->fd);
+    return 1;
+  }
+
+  log->seats = NULL;
+  log->capacity = 0;
+  log->valid = sizeof(header);
+
+  if (reader_read(&log->reader, (char *)&header, sizeof(header)) !=
+          sizeof(header) ||
+      header.magic != WAL_MAGIC || header.version != WAL_VERSION) {
+    wal_reader_close(log);
+    return 1;
+  }
+  return 0;
+}
+
+int wal_next(struct WalReader *log, struct WalRecord *record,
+             const uint64_t **seats) {
+  if (reader_read(&log->reader, (char *)record, sizeof(*record)) !=
+      sizeof(*record))
+    return 0;
+
+  if (record->count > log->capacity) {
+    uint64_t *grown = realloc(log->seats, record->count * sizeof(uint64_t));
+    if (grown == NULL)
+      return 0;
+    log->seats = grown;
+    log->capacity = record->count;
+  }
+
+  size_t length = record->count * sizeof(uint64_t);
+  if ((length > 0 &&
+       reader_read(&log->reader, (char *)log->seats, length) != length) ||
+      record_checksum(*record, log->seats) != record->checksum)
+    return 0;
+
+  log->valid += sizeof(*record) + length;
+  *seats = log->seats;
+  return 1;
+}
+
+void wal_reader_close(struct WalReader *log) {
+  reader_destroy(&log->reader);
+  close(log->fd);
+  free(log->seats);
+  log->seats = NULL;
+  log->capacity = 0;
+}
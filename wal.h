@@ -0,0 +1,151 @@
+#ifndef EMS_WAL_H
+#define EMS_WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reader.h"
+
+// Write-ahead log of the events created and the seats reserved and
+// released, so they survive a restart. A record is written to the file as
+// soon as it is appended, while the operation still holds its locks, so
+// conflicting operations of every process sharing the file are logged in
+// the order they took effect. A commit then waits until its record is on
+// disk, and the first one to wait syncs every record written so far at once.
+//
+// Layout: header | records, each followed by the seats of a reservation.
+// Records carry a checksum, so a record torn by a crash ends the log.
+// Fields are stored in the byte order of the machine that wrote the file.
+
+#define WAL_MAGIC 0x4c534d45 // "EMSL" when stored little endian
+#define WAL_VERSION 1
+
+enum WalOp {
+  WAL_CREATE = 1,
+  WAL_RESERVE = 2,
+  WAL_CANCEL = 3,
+  WAL_RESERVE_MULTI = 4
+};
+
+struct WalHeader {
+  uint32_t magic;   /// WAL_MAGIC.
+  uint32_t version; /// WAL_VERSION.
+};
+
+// Every operation is one record, WAL_RESERVE is followed by count seats.
+// WAL_RESERVE_MULTI is followed by count words holding, for each of its
+// events, the event and reservation ids (event id in the upper half), the
+// number of seats and the seats; being a single record, it is either
+// replayed whole or torn whole.
+struct WalRecord {
+  uint16_t op;          /// Operation, one of WalOp.
+  uint16_t count;       /// Number of seats or words following the record.
+  uint32_t event_id;    /// Event id.
+  uint32_t checksum;    /// Checksum of the record and its seats, taken with
+                        /// this field set to 0.
+  uint32_t reservation; /// Reservation id of WAL_RESERVE and WAL_CANCEL.
+  uint64_t rows;        /// Number of rows of WAL_CREATE, number of events of
+                        /// WAL_RESERVE_MULTI.
+  uint64_t cols;        /// Number of columns of WAL_CREATE.
+};
+
+// One event's part of a reservation across several events
+struct WalPart {
+  unsigned int event_id;    /// Event id.
+  unsigned int reservation; /// Reservation id in the event.
+  size_t num_seats;         /// Number of seats.
+  const size_t *indices;    /// Array of the indices of the seats.
+};
+
+// A log being replayed
+struct WalReader {
+  int fd;               /// Log file.
+  struct Reader reader; /// Reader over the log file.
+  uint64_t *seats;      /// Seats of the last record read.
+  size_t capacity;      /// Number of seats allocated.
+  uint64_t valid;       /// Bytes up to the end of the last valid record.
+};
+
+/// Opens a log for appending, creating it if it does not exist. A torn
+/// record at its end is cut off first. Must be called before forking, and
+/// before any other thread is started.
+/// @param path Path of the log.
+/// @param budget_us Longest time, in microseconds, a commit waits for later
+/// ones to join its group before the group is written.
+/// @return 0 if the log was opened successfully, 1 otherwise.
+int wal_open(const char *path, unsigned int budget_us);
+
+/// Closes the log, if it is open.
+void wal_close(void);
+
+/// Appends the creation of an event to the log.
+/// @param event_id Id of the event.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @param lsn Pointer to the variable to store the record's position in, 0
+/// if the log is not open.
+/// @return 0 if the record was appended, 1 if out of memory or if the log
+/// could not be written.
+int wal_log_create(unsigned int event_id, size_t rows, size_t cols,
+                   uint64_t *lsn);
+
+/// Appends a reservation to the log.
+/// @param event_id Id of the event.
+/// @param reservation Id of the reservation.
+/// @param num_seats Number of seats.
+/// @param indices Array of the indices of the seats.
+/// @param lsn Pointer to the variable to store the record's position in, 0
+/// if the log is not open.
+/// @return 0 if the record was appended, 1 if out of memory, if there are
+/// too many seats or if the log could not be written.
+int wal_log_reserve(unsigned int event_id, unsigned int reservation,
+                    size_t num_seats, const size_t *indices, uint64_t *lsn);
+
+/// Appends a reservation across several events to the log, as one record.
+/// @param num_parts Number of events.
+/// @param parts Array of the parts of the reservation, one per event.
+/// @param lsn Pointer to the variable to store the record's position in, 0
+/// if the log is not open.
+/// @return 0 if the record was appended, 1 if out of memory, if there are
+/// too many seats or if the log could not be written.
+int wal_log_reserve_multi(size_t num_parts, const struct WalPart *parts,
+                          uint64_t *lsn);
+
+/// Appends the cancellation of a reservation to the log.
+/// @param event_id Id of the event.
+/// @param reservation Id of the reservation.
+/// @param lsn Pointer to the variable to store the record's position in, 0
+/// if the log is not open.
+/// @return 0 if the record was appended, 1 if out of memory or if the log
+/// could not be written.
+int wal_log_cancel(unsigned int event_id, unsigned int reservation,
+                   uint64_t *lsn);
+
+/// Waits until a record and every record written to the log before it, by
+/// any process, is on disk.
+/// @param lsn Position of the record, 0 returns at once.
+/// @return 0 if the record is on disk, 1 if the log could not be written.
+int wal_sync(uint64_t lsn);
+
+/// Opens a log for replaying. The log is only read.
+/// @param log Reader to initialize.
+/// @param path Path of the log.
+/// @return 0 if the log was opened, 1 if it is invalid, -1 if it could not
+/// be opened (errno is set).
+int wal_reader_open(struct WalReader *log, const char *path);
+
+/// Reads the next record of a log.
+/// @param log Reader to read from.
+/// @param record Pointer to the record to store the operation in.
+/// @param seats Pointer to the variable to store the seats of a reservation
+/// in, valid until the next call.
+/// @return 1 if a record was read, 0 at the end of the log or at the first
+/// record that is incomplete or corrupted.
+int wal_next(struct WalReader *log, struct WalRecord *record,
+             const uint64_t **seats);
+
+/// Closes a log opened for replaying.
+/// @param log Reader to close.
+void wal_reader_close(struct WalReader *log);
+
+#endif // EMS_WAL_H